@@ -0,0 +1,317 @@
+// Micro-benchmarks of the proxy's hot paths, fed from a captured register dump:
+//
+//   parse      store the FC03 responses of one DTU round, map and decode the
+//              channels and aggregate each inverter (the DTU side of a poll)
+//   aggregate  aggregate_and_update_registers_(): build the SunSpec block
+//   request    process_tcp_request_() for the reads a Victron GX issues
+//   unchanged  parse and aggregate of a round identical to the previous one
+//              (the common case: the DTU refreshes its data far less often
+//              than it is polled)
+//
+// Each iteration is timed separately, so the report shows tail latency as
+// well as throughput. Except for "unchanged", snapshots of the dump are
+// cycled through so change detection sees realistic data.
+//
+//   bench_hotpaths [--dump=captures/...txt] [--iterations=N] [--only=NAME] [--fleet=N]
+//
+// --fleet=N runs N copies of the captured inverters on the one DTU (serials
+// counted up, channels appended), for read plans larger than the capture.
+
+#include "sunspec_proxy/sunspec_proxy.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::sunspec_proxy;
+
+namespace {
+
+typedef std::map<uint16_t, uint16_t> Snapshot;  // Register address -> value
+
+// Same format as dtu_sim.py: "<hex address>: <hex words>", blank line
+// between snapshots, '#' comments
+std::vector<Snapshot> load_dump(const char *path) {
+  std::vector<Snapshot> snapshots;
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) return snapshots;
+  Snapshot cur;
+  char line[1024];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    char *hash = strchr(line, '#');
+    if (hash != nullptr) *hash = 0;
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\n' || *p == '\r' || *p == 0) {
+      if (hash == nullptr && !cur.empty()) {
+        snapshots.push_back(cur);
+        cur.clear();
+      }
+      continue;
+    }
+    char *end;
+    unsigned long addr = strtoul(p, &end, 16);
+    if (*end != ':') continue;
+    p = end + 1;
+    for (;;) {
+      unsigned long w = strtoul(p, &end, 16);
+      if (end == p) break;
+      cur[(uint16_t) addr++] = (uint16_t) w;
+      p = end;
+    }
+  }
+  if (!cur.empty()) snapshots.push_back(cur);
+  fclose(f);
+  return snapshots;
+}
+
+// Appends copies - 1 more sets of the dump's channels, with the low serial
+// word counted up by the copy number
+void replicate_channels(std::vector<Snapshot> &snapshots, int copies) {
+  for (auto &snap : snapshots) {
+    uint16_t channels = snap.empty() ? 0 : (snap.rbegin()->first - HM_DATA_BASE) / HM_MPPT_STRIDE + 1;
+    Snapshot base = snap;
+    for (int r = 1; r < copies; r++) {
+      for (const auto &kv : base) {
+        uint16_t addr = kv.first + r * channels * HM_MPPT_STRIDE;
+        bool sn_low = (kv.first - HM_DATA_BASE) % HM_MPPT_STRIDE == HM_INV_SN_3;
+        snap[addr] = sn_low ? kv.second + r : kv.second;
+      }
+    }
+  }
+}
+
+struct Stats {
+  std::vector<uint32_t> ns;
+
+  void report(const char *name) {
+    if (ns.empty()) return;
+    std::sort(ns.begin(), ns.end());
+    double total = 0;
+    for (uint32_t v : ns) total += v;
+    auto pct = [&](double q) { return ns[std::min(ns.size() - 1, (size_t) (q * ns.size()))] / 1000.0; };
+    printf("%-10s %8zu iter %10.0f op/s  mean %8.2f  p50 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f us\n", name,
+           ns.size(), ns.size() / (total / 1e9), total / ns.size() / 1000.0, pct(0.5), pct(0.99), pct(0.999),
+           ns.back() / 1000.0);
+  }
+};
+
+inline uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Exposes the protected hot paths to the benchmark
+class BenchProxy : public SunSpecProxy {
+ public:
+  // One FC03 response frame per read-plan chunk, per snapshot
+  void build_responses(const std::vector<Snapshot> &snapshots) {
+    DtuLink &l = dtu_links_[0];
+    for (const auto &snap : snapshots) {
+      std::vector<std::vector<uint8_t>> round;
+      for (const auto &c : l.read_plan) {
+        std::vector<uint8_t> f(9 + c.count * 2);
+        f[4] = (3 + c.count * 2) >> 8;
+        f[5] = (3 + c.count * 2) & 0xFF;
+        f[6] = l.address;
+        f[7] = 0x03;
+        f[8] = c.count * 2;
+        for (int i = 0; i < c.count; i++) {
+          auto it = snap.find(c.start + i);
+          uint16_t v = it == snap.end() ? 0 : it->second;
+          f[9 + i * 2] = v >> 8;
+          f[10 + i * 2] = v & 0xFF;
+        }
+        round.push_back(f);
+      }
+      responses_.push_back(round);
+    }
+  }
+
+  void parse_round(size_t snapshot) {
+    DtuLink &l = dtu_links_[0];
+    const auto &round = responses_[snapshot % responses_.size()];
+    for (size_t c = 0; c < round.size(); c++) store_dtu_chunk_(l, round[c].data(), round[c].size(), c);
+    map_mppt_to_inverters_(l);
+    parse_dtu_registers_(l);
+    aggregate_dtu_inverters_(l);
+  }
+
+  void aggregate() { aggregate_and_update_registers_(); }
+
+  // A client slot backed by one end of a socket pair; responses are drained
+  // from the other end outside the timed region
+  bool open_client() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return false;
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL, 0) | O_NONBLOCK);
+    client_.fd = sv[0];
+    peer_fd_ = sv[1];
+    return true;
+  }
+
+  void request(const uint8_t *frame, int len) { process_tcp_request_(client_, frame, len); }
+
+  void drain() {
+    uint8_t buf[4096];
+    while (recv(peer_fd_, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+  }
+
+  uint16_t channels() const { return dtu_links_[0].channels; }
+  uint8_t unit_id() const { return agg_config_.unit_id; }
+
+ private:
+  std::vector<std::vector<std::vector<uint8_t>>> responses_;
+  TcpClient client_;
+  int peer_fd_{-1};
+};
+
+std::vector<uint8_t> read_request(uint16_t txn, uint8_t unit, uint16_t start, uint16_t count) {
+  return {(uint8_t) (txn >> 8), (uint8_t) txn, 0, 0, 0, 6, unit, 0x03,
+          (uint8_t) (start >> 8), (uint8_t) start, (uint8_t) (count >> 8), (uint8_t) count};
+}
+
+const char *opt(const char *arg, const char *name) {
+  size_t n = strlen(name);
+  return strncmp(arg, name, n) == 0 && arg[n] == '=' ? arg + n + 1 : nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const char *dump = "captures/hms2000-4t_hms800-2t.txt";
+  const char *only = "";
+  int iterations = 20000;
+  int fleet = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *v;
+    if ((v = opt(argv[i], "--dump")) != nullptr) {
+      dump = v;
+    } else if ((v = opt(argv[i], "--iterations")) != nullptr) {
+      iterations = atoi(v);
+    } else if ((v = opt(argv[i], "--only")) != nullptr) {
+      only = v;
+    } else if ((v = opt(argv[i], "--fleet")) != nullptr) {
+      fleet = atoi(v);
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  std::vector<Snapshot> snapshots = load_dump(dump);
+  if (snapshots.empty()) {
+    fprintf(stderr, "%s: no register data\n", dump);
+    return 1;
+  }
+
+  // The inverters of the bundled capture; the DTU is never contacted
+  shim_log_level() = 1;
+  static BenchProxy proxy;
+  proxy.add_dtu("127.0.0.1", 1, 1);
+  proxy.set_tcp_port(0);
+  proxy.set_unit_id(126);
+  proxy.set_phases(3);
+  proxy.set_rated_voltage(230);
+  if (fleet < 1 || fleet * 2 > MAX_RTU_SOURCES) {
+    fprintf(stderr, "--fleet wants 1..%d\n", MAX_RTU_SOURCES / 2);
+    return 2;
+  }
+  replicate_channels(snapshots, fleet);
+  // Sources keep pointers to their strings
+  static std::vector<std::string> strings;
+  strings.reserve(fleet * 4);
+  uint8_t port = 1;
+  for (int r = 0; r < fleet; r++) {
+    char serial[16];
+    snprintf(serial, sizeof(serial), "1520a025%04x", (0x566b + r) & 0xffff);
+    strings.push_back(serial);
+    strings.push_back(std::string("Inv A") + (r > 0 ? std::to_string(r) : ""));
+    proxy.add_rtu_source(port++, 3, 2000, 1, 4, strings[strings.size() - 1].c_str(), "HMS-2000-4T",
+                         strings[strings.size() - 2].c_str());
+    snprintf(serial, sizeof(serial), "1410a011%04x", (0x2233 + r) & 0xffff);
+    strings.push_back(serial);
+    strings.push_back(std::string("Inv B") + (r > 0 ? std::to_string(r) : ""));
+    proxy.add_rtu_source(port++, 1, 800, 2, 2, strings[strings.size() - 1].c_str(), "HMS-800-2T",
+                         strings[strings.size() - 2].c_str());
+  }
+  proxy.setup();
+  proxy.build_responses(snapshots);
+  if (!proxy.open_client()) {
+    perror("socketpair");
+    return 1;
+  }
+  printf("%zu snapshot(s) from %s, %d channels, %d iterations\n", snapshots.size(), dump, proxy.channels(),
+         iterations);
+
+  auto enabled = [&](const char *name) { return only[0] == 0 || strcmp(only, name) == 0; };
+
+  if (enabled("parse")) {
+    Stats s;
+    s.ns.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+      uint64_t t0 = now_ns();
+      proxy.parse_round(i);
+      s.ns.push_back(now_ns() - t0);
+    }
+    s.report("parse");
+  }
+
+  if (enabled("aggregate")) {
+    Stats s;
+    s.ns.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+      // Alternate the input so the aggregate isn't computed from one state
+      proxy.parse_round(i);
+      uint64_t t0 = now_ns();
+      proxy.aggregate();
+      s.ns.push_back(now_ns() - t0);
+    }
+    s.report("aggregate");
+  }
+
+  if (enabled("unchanged")) {
+    Stats s;
+    s.ns.reserve(iterations);
+    proxy.parse_round(0);
+    proxy.aggregate();
+    for (int i = 0; i < iterations; i++) {
+      uint64_t t0 = now_ns();
+      proxy.parse_round(0);
+      proxy.aggregate();
+      s.ns.push_back(now_ns() - t0);
+    }
+    s.report("unchanged");
+  }
+
+  if (enabled("request")) {
+    // The GX's steady-state reads: model 103 (inverter) and model 123
+    // (controls); plus the SunS header it re-reads on reconnect
+    std::vector<std::vector<uint8_t>> gx = {
+        read_request(1, proxy.unit_id(), SUNSPEC_BASE + 70, 52),
+        read_request(2, proxy.unit_id(), SUNSPEC_BASE + 150, 26),
+        read_request(3, proxy.unit_id(), SUNSPEC_BASE, 4),
+    };
+    Stats s;
+    s.ns.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+      const auto &req = gx[i % gx.size()];
+      uint64_t t0 = now_ns();
+      proxy.request(req.data(), req.size());
+      s.ns.push_back(now_ns() - t0);
+      proxy.drain();
+    }
+    s.report("request");
+  }
+  return 0;
+}
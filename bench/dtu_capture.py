@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Capture the 0x4000 data block of a real DTU-Pro in dtu_sim.py's format.
+
+Reads --channels channel blocks (25 registers each, the same requests the
+proxy sends) every --interval seconds and appends one snapshot per round.
+
+Usage: dtu_capture.py --host=192.168.1.100 --channels=6 [--rounds=10] > dump.txt
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+HM_DATA_BASE = 0x4000
+HM_MPPT_STRIDE = 25
+CHANNELS_PER_READ = 5  # 5 x 25 = 125 registers, the FC03 maximum
+
+
+def read(sock, tid, unit, start, count):
+    sock.sendall(struct.pack(">HHHBBHH", tid, 0, 6, unit, 3, start, count))
+    hdr = sock.recv(7, socket.MSG_WAITALL)
+    _, _, length, _ = struct.unpack(">HHHB", hdr)
+    body = sock.recv(length - 1, socket.MSG_WAITALL)
+    if body[0] & 0x80:
+        raise RuntimeError("exception 0x%02x reading 0x%04x" % (body[1], start))
+    return struct.unpack(">%dH" % (body[1] // 2), body[2:])
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("--host", required=True)
+    p.add_argument("--port", type=int, default=502)
+    p.add_argument("--address", type=int, default=101, help="DTU Modbus unit id")
+    p.add_argument("--channels", type=int, required=True)
+    p.add_argument("--rounds", type=int, default=1)
+    p.add_argument("--interval", type=float, default=10.0)
+    args = p.parse_args()
+
+    sock = socket.create_connection((args.host, args.port), timeout=5)
+    tid = 1
+    print("# DTU-Pro %s:%d unit %d, %d channels" % (args.host, args.port, args.address, args.channels))
+    for r in range(args.rounds):
+        if r > 0:
+            time.sleep(args.interval)
+        print("\n# %s" % time.strftime("%Y-%m-%d %H:%M:%S"))
+        for first in range(0, args.channels, CHANNELS_PER_READ):
+            n = min(CHANNELS_PER_READ, args.channels - first)
+            start = HM_DATA_BASE + first * HM_MPPT_STRIDE
+            regs = read(sock, tid, args.address, start, n * HM_MPPT_STRIDE)
+            tid = tid % 0xFFFF + 1
+            for ch in range(n):
+                words = regs[ch * HM_MPPT_STRIDE:(ch + 1) * HM_MPPT_STRIDE]
+                print("%04x: %s" % (start + ch * HM_MPPT_STRIDE, " ".join("%04x" % w for w in words)))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+"""Hoymiles DTU-Pro Modbus TCP simulator.
+
+Serves the 0x4000 data block from a captured register dump and accepts the
+FC05 control coils (0xC000.., see README "Control Register Map"). Snapshots
+from the dump are replayed in order, advancing every --step seconds, so a
+whole day can be compressed into a few minutes. The per-port status records
+at 0x1000 are derived from the 0x4000 block (one port per inverter, in the
+order the dump lists them), and the control registers read back what FC05
+last wrote.
+
+Network behaviour of a real DTU can be emulated:
+  --rtt=MS       base response delay (a DTU-Pro takes 50-300 ms)
+  --jitter=MS    extra uniform random delay per response
+  --split        send each response in two TCP segments
+  --serial       answer one request at a time across all connections
+  --no-broadcast reject the all-inverter coils 0xC000/0xC001
+  --alarm=P:CODE port P reports alarm CODE
+  --late=P       hold a response back 4 s (past the proxy's read timeout)
+                 with probability P
+  --outage=T:D   stop answering T s after start, for D s; connections stay
+                 open, like a DTU that dropped off Wi-Fi (half-open)
+  --limit-delay=S the inverters follow limit writes after S s: each
+                 channel's power reads as power x limit %
+
+Usage: dtu_sim.py [--port=502] [--dump=captures/....txt] [--step=S] [options]
+"""
+
+import argparse
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+
+MAX_CHANNELS = 99 * 8
+CTRL_ALL_ONOFF = 0xC000
+CTRL_ALL_LIMIT = 0xC001
+CTRL_PORT_BASE = 0xC006
+PORT_BASE = 0x1000
+PORT_STRIDE = 0x28
+LATE_S = 4.0
+
+
+def load_dump(path):
+    """Parse "<hex address>: <hex words>" lines into a list of snapshots.
+
+    Each snapshot is a dict {register address: value}; a blank line after
+    data starts the next snapshot, '#' starts a comment.
+    """
+    snapshots, cur = [], {}
+    with open(path) as f:
+        for line in f:
+            if not line.strip():
+                if cur:
+                    snapshots.append(cur)
+                    cur = {}
+                continue
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            addr, words = line.split(":", 1)
+            addr = int(addr, 16)
+            for i, w in enumerate(words.split()):
+                cur[addr + i] = int(w, 16)
+    if cur:
+        snapshots.append(cur)
+    if not snapshots:
+        sys.exit("%s: no register data" % path)
+    return snapshots
+
+
+class Dtu:
+    def __init__(self, args):
+        self.args = args
+        self.snapshots = load_dump(args.dump)
+        self.start = time.monotonic()
+        self.lock = threading.Lock()  # --serial
+        self.requests = 0
+        self.writes = []
+        self.ctrl = {}  # Control registers as last written
+        self.ports = [self.port_records(snap) for snap in self.snapshots]
+        self.channel_ports = [self.channel_port_map(snap) for snap in self.snapshots]
+        self.applied = {}  # --limit-delay: control registers the inverters act on
+        self.apply_at = None
+        self.alarms = dict(tuple(int(x) for x in a.split(":")) for a in args.alarm)
+
+    def port_records(self, snap):
+        """Byte-packed 0x1000 records, one per inverter: the first channel's data."""
+        recs, seen = {}, []
+        for ch in range(MAX_CHANNELS):
+            base = 0x4000 + ch * 25
+            if snap.get(base) != 12:
+                break
+            sn = tuple(snap.get(base + i, 0) for i in (1, 2, 3))
+            if sn in seen:
+                continue
+            seen.append(sn)
+            recs[len(seen) - 1] = [snap.get(base + i, 0) for i in range(15)]
+        return recs
+
+    def channel_port_map(self, snap):
+        """Port of each 0x4000 channel, in the order port_records() numbers them."""
+        ports, seen = [], []
+        for ch in range(MAX_CHANNELS):
+            base = 0x4000 + ch * 25
+            if snap.get(base) != 12:
+                break
+            sn = tuple(snap.get(base + i, 0) for i in (1, 2, 3))
+            if sn not in seen:
+                seen.append(sn)
+            ports.append(seen.index(sn))
+        return ports
+
+    def power_reg(self, regs, addr):
+        """Channel power as the inverter delivers it under the applied limit."""
+        if self.apply_at is not None and time.monotonic() >= self.apply_at:
+            self.applied, self.apply_at = dict(self.ctrl), None
+        ch = (addr - 0x4000) // 25
+        ports = self.channel_ports[self.index()]
+        if ch >= len(ports):
+            return regs.get(addr, 0)
+        pct = self.applied.get(CTRL_PORT_BASE + ports[ch] * 6 + 1, self.applied.get(CTRL_ALL_LIMIT, 100))
+        return regs.get(addr, 0) * min(pct, 100) // 100
+
+    def port_reg(self, addr):
+        port, off = divmod(addr - PORT_BASE, PORT_STRIDE)
+        ch = self.ports[self.index()].get(port)
+        if ch is None or off >= 17:
+            return 0
+        sn = struct.pack(">HHH", ch[1], ch[2], ch[3])
+        alarm = self.alarms.get(port, 0)
+        rec = (bytes([ch[0]]) + sn + bytes([port])
+               + struct.pack(">9H", *ch[5:14])
+               + struct.pack(">HHHBB", ch[14], alarm, 1 if alarm else 0, 1, 0))
+        return struct.unpack_from(">H", rec, off * 2)[0]
+
+    def ctrl_reg(self, addr):
+        if addr >= CTRL_PORT_BASE:
+            port, off = divmod(addr - CTRL_PORT_BASE, 6)
+            default = (self.ctrl.get(CTRL_ALL_ONOFF, 1), self.ctrl.get(CTRL_ALL_LIMIT, 100))
+            if off < 2:
+                return self.ctrl.get(addr, default[off])
+        return self.ctrl.get(addr, 0)
+
+    def index(self):
+        if self.args.step <= 0:
+            return 0
+        return int((time.monotonic() - self.start) / self.args.step) % len(self.snapshots)
+
+    def reg(self, regs, addr):
+        if addr >= 0xC000:
+            return self.ctrl_reg(addr)
+        if PORT_BASE <= addr < 0x4000:
+            return self.port_reg(addr)
+        if self.args.limit_delay is not None and addr >= 0x4000 and (addr - 0x4000) % 25 == 9:
+            return self.power_reg(regs, addr)
+        return regs.get(addr, 0)
+
+    def respond(self, fc, unit, frame):
+        addr, value = struct.unpack(">HH", frame[8:12])
+        if fc == 0x03:
+            if value < 1 or value > 125:
+                return bytes([fc | 0x80, 0x03])
+            regs = self.snapshots[self.index()]
+            data = b"".join(struct.pack(">H", self.reg(regs, addr + i)) for i in range(value))
+            return bytes([fc, len(data)]) + data
+        if fc == 0x05:
+            self.writes.append((addr, value))
+            print("FC05 0x%04x = %d" % (addr, value), flush=True)
+            if self.args.no_broadcast and addr in (CTRL_ALL_ONOFF, CTRL_ALL_LIMIT):
+                return bytes([fc | 0x80, 0x02])
+            if addr in (CTRL_ALL_ONOFF, CTRL_ALL_LIMIT):
+                # Applies to every port
+                off = addr - CTRL_ALL_ONOFF
+                for k in [k for k in self.ctrl if k >= CTRL_PORT_BASE and (k - CTRL_PORT_BASE) % 6 == off]:
+                    del self.ctrl[k]
+            self.ctrl[addr] = value
+            if self.args.limit_delay is not None:
+                self.apply_at = time.monotonic() + self.args.limit_delay
+            return frame[7:12]
+        return bytes([fc | 0x80, 0x01])
+
+    def delay(self):
+        late = LATE_S if random.random() < self.args.late else 0.0
+        return (self.args.rtt + random.uniform(0, self.args.jitter)) / 1000.0 + late
+
+    def in_outage(self):
+        if not self.args.outage:
+            return False
+        start, length = (float(v) for v in self.args.outage.split(":"))
+        t = time.monotonic() - self.start
+        return start <= t < start + length
+
+    def handle(self, conn):
+        buf = b""
+        try:
+            while True:
+                d = conn.recv(1024)
+                if not d:
+                    break
+                buf += d
+                while len(buf) >= 8:
+                    tid, proto, length, unit, fc = struct.unpack(">HHHBB", buf[:8])
+                    if len(buf) < 6 + length:
+                        break
+                    frame, buf = buf[:6 + length], buf[6 + length:]
+                    if proto != 0 or length < 6:
+                        continue
+                    self.requests += 1
+                    if self.in_outage():
+                        continue
+                    pdu = self.respond(fc, unit, frame)
+                    resp = struct.pack(">HHHB", tid, 0, len(pdu) + 1, unit) + pdu
+                    if self.args.serial:
+                        with self.lock:
+                            self.send(conn, resp)
+                    else:
+                        self.send(conn, resp)
+        except OSError:
+            pass
+        conn.close()
+
+    def send(self, conn, resp):
+        time.sleep(self.delay())
+        if self.args.split:
+            k = random.randint(1, len(resp) - 1)
+            conn.sendall(resp[:k])
+            time.sleep(0.01)
+            conn.sendall(resp[k:])
+        else:
+            conn.sendall(resp)
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=502)
+    p.add_argument("--dump", default="captures/hms2000-4t_hms800-2t.txt")
+    p.add_argument("--step", type=float, default=10.0, help="seconds per snapshot (0 = first only)")
+    p.add_argument("--rtt", type=float, default=0.0)
+    p.add_argument("--jitter", type=float, default=0.0)
+    p.add_argument("--split", action="store_true")
+    p.add_argument("--serial", action="store_true")
+    p.add_argument("--no-broadcast", action="store_true")
+    p.add_argument("--alarm", action="append", default=[], metavar="PORT:CODE")
+    p.add_argument("--late", type=float, default=0.0)
+    p.add_argument("--outage", metavar="T:D")
+    p.add_argument("--limit-delay", type=float)
+    args = p.parse_args()
+
+    dtu = Dtu(args)
+    s = socket.socket()
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind((args.host, args.port))
+    s.listen(4)
+    print("DTU simulator on %s:%d, %d snapshot(s) from %s" % (args.host, args.port, len(dtu.snapshots), args.dump),
+          flush=True)
+    while True:
+        conn, _ = s.accept()
+        threading.Thread(target=dtu.handle, args=(conn,), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
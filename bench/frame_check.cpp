@@ -0,0 +1,92 @@
+// Regression checks for MbapStreamDecoder: streams of frames fed in chunks
+// of every size, so the buffer fills, drains and refills across its end.
+//
+//   frame_check
+//
+// Exits non-zero on the first frame that comes out wrong, missing, or when
+// write_space() doesn't offer what write_ptr() makes room for.
+
+#include "sunspec_proxy/modbus_frame.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+using namespace esphome::sunspec_proxy;
+
+namespace {
+
+static const size_t N = 2 * MBAP_MAX_ADU;
+
+int failures = 0;
+
+void fail(const char *what, size_t chunk, size_t frame) {
+  fprintf(stderr, "FAIL %s (chunks of %zu, frame %zu)\n", what, chunk, frame);
+  failures++;
+}
+
+// FC03 request (12 bytes) or response with `regs` registers
+std::vector<uint8_t> make_frame(uint16_t tid, uint16_t regs) {
+  uint16_t pdu = regs == 0 ? 5 : 2 + regs * 2;
+  std::vector<uint8_t> f = {(uint8_t)(tid >> 8), (uint8_t) tid, 0, 0, (uint8_t)((pdu + 1) >> 8),
+                            (uint8_t)(pdu + 1), 126, 0x03};
+  for (uint16_t i = 1; i < pdu; i++) f.push_back((uint8_t)(tid + i));
+  return f;
+}
+
+// Feeds `frames` in chunks of `chunk` bytes, consuming after every chunk the
+// way read_modbus_tcp_response_() does; recv() is a copy of up to the space
+void run(const std::vector<std::vector<uint8_t>> &frames, size_t chunk) {
+  std::vector<uint8_t> stream;
+  for (const auto &f : frames) stream.insert(stream.end(), f.begin(), f.end());
+
+  MbapStreamDecoder<N> rx;
+  size_t sent = 0, next = 0;
+  while (next < frames.size()) {
+    // Space first, the way GCC evaluates recv()'s arguments
+    size_t space = rx.write_space();
+    uint8_t *p = rx.write_ptr();
+    if (space != N - rx.pending()) {
+      fail("write_space() out of step with write_ptr()", chunk, next);
+      return;
+    }
+    size_t n = std::min({chunk, space, stream.size() - sent});
+    if (n == 0) {
+      fail("no room left although frames were consumed", chunk, next);
+      return;
+    }
+    std::copy(&stream[sent], &stream[sent + n], p);
+    rx.commit(n);
+    sent += n;
+
+    const uint8_t *frame;
+    int len;
+    while ((len = rx.next_frame(&frame)) > 0) {
+      const auto &want = frames[next];
+      if ((size_t) len != want.size() || !std::equal(want.begin(), want.end(), frame)) {
+        fail("frame differs", chunk, next);
+        return;
+      }
+      next++;
+    }
+  }
+  if (rx.pending() != 0) fail("bytes left over", chunk, next);
+}
+
+}  // namespace
+
+int main() {
+  // Pipelined client requests (many more bytes than the buffer holds), then
+  // DTU responses of mixed sizes up to a full ADU
+  std::vector<std::vector<uint8_t>> requests, responses;
+  for (uint16_t t = 1; t <= 300; t++) requests.push_back(make_frame(t, 0));
+  for (uint16_t t = 1; t <= 60; t++) responses.push_back(make_frame(t, t % 3 == 0 ? 125 : t % 50 + 1));
+
+  for (size_t chunk = 1; chunk <= N; chunk++) {
+    run(requests, chunk);
+    run(responses, chunk);
+  }
+  if (failures > 0) return 1;
+  printf("frame_check: OK\n");
+  return 0;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Fetch GET /history from the proxy's metrics port and print it as CSV.
+
+Also the reference decoder of the export format (see history.h): a 24-byte
+header, one 16-byte entry per series, then 128-byte blocks, little-endian.
+Times are uptime seconds on the device; --wall converts them with the
+header's now_s and the local clock.
+
+Usage: history_dump.py [--url=http://HOST:9100] [--tier=0|1] [--since=S] [--wall]
+"""
+
+import argparse
+import struct
+import sys
+import time
+import urllib.request
+
+HEADER = struct.Struct("<4sBBBBIIIHH")
+SERIES = struct.Struct("<BB14s")
+BLOCK_HEADER = struct.Struct("<IHBB4H")
+SKIP = 0xFF
+
+
+def decode_block(block, interval):
+    """Yield (series, time_s, [power_dw, dc_voltage_dv, dc_current_ca, temperature_dc])."""
+    start, count, series, used, *first = BLOCK_HEADER.unpack_from(block)
+    payload = block[BLOCK_HEADER.size:BLOCK_HEADER.size + used]
+    t, cur = start, list(first)
+    yield series, t, cur
+    i = 0
+    while i < len(payload):
+        h = payload[i]
+        i += 1
+        if h == SKIP:
+            t += payload[i] * interval
+            i += 1
+            continue
+        for f in range(4):
+            cls = (h >> (f * 2)) & 3
+            if cls == 1:
+                d = struct.unpack_from("<b", payload, i)[0]
+            elif cls == 2:
+                d = struct.unpack_from("<h", payload, i)[0]
+            else:
+                continue
+            i += cls
+            cur[f] = (cur[f] + d) & 0xFFFF
+        t += interval
+        yield series, t, list(cur)
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--url", default="http://127.0.0.1:9100")
+    p.add_argument("--tier", type=int, default=0)
+    p.add_argument("--since", type=int, default=0)
+    p.add_argument("--wall", action="store_true", help="print local wall-clock times")
+    args = p.parse_args()
+
+    data = urllib.request.urlopen("%s/history?tier=%d&since=%d" % (args.url, args.tier, args.since)).read()
+    magic, version, tier, nseries, _, interval, now_s, since, block_size, _ = HEADER.unpack_from(data)
+    if magic != b"SPHI" or version != 1:
+        sys.exit("not a version 1 history export")
+    off = HEADER.size
+    series = []
+    for _ in range(nseries):
+        source, mppt, serial = SERIES.unpack_from(data, off)
+        series.append("%s/%d" % (serial.rstrip(b"\0").decode() or "src%d" % source, mppt))
+        off += SERIES.size
+    received = time.time()
+
+    print("series,time,power_w,dc_voltage_v,dc_current_a,temperature_c")
+    for b in range(off, len(data) - block_size + 1, block_size):
+        for s, t, v in decode_block(data[b:b + block_size], interval):
+            if t < since:
+                continue
+            when = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(received - (now_s - t))) if args.wall else t
+            temp = v[3] - 0x10000 if v[3] & 0x8000 else v[3]
+            print("%s,%s,%.1f,%.1f,%.2f,%.1f" % (series[s], when, v[0] / 10, v[1] / 10, v[2] / 100, temp / 10))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Modbus TCP load generator: a Victron GX plus N other clients.
+
+The GX client walks the SunSpec model chain once (like dbus-fronius does on
+discovery), then polls the model 103 and model 123 blocks every --gx-period
+seconds and, with --limit, writes WMaxLimPct/WMaxLim_Ena every
+--limit-period seconds. Each of the --clients extra clients (Home Assistant,
+exporters, ...) reads the model 103 block at --rate Hz.
+
+Prints request counts, errors and latency percentiles per client class.
+
+Usage: load_gen.py [--host=127.0.0.1] [--port=502] [--unit=126]
+                   [--duration=30] [--clients=3] [--rate=2] [--limit]
+"""
+
+import argparse
+import socket
+import struct
+import threading
+import time
+
+SUNSPEC_BASE = 40000
+MODEL_103_START = SUNSPEC_BASE + 70   # Header (ID, L), then 50 registers
+MODEL_123_START = SUNSPEC_BASE + 150
+WMAXLIMPCT = MODEL_123_START + 2 + 5  # WMaxLimPct, WinTms, RvrtTms, WMaxLim_Ena
+DISCOVERY = [(SUNSPEC_BASE, 4), (SUNSPEC_BASE + 2, 68), (MODEL_103_START, 2),
+             (SUNSPEC_BASE + 122, 2), (MODEL_123_START, 2), (SUNSPEC_BASE + 176, 2)]
+
+
+class Client:
+    def __init__(self, args, name):
+        self.args = args
+        self.name = name
+        self.sock = None
+        self.tid = 0
+        self.latencies = []
+        self.errors = 0
+
+    def connect(self):
+        self.sock = socket.create_connection((self.args.host, self.args.port), timeout=self.args.timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    def transact(self, pdu):
+        self.tid = self.tid % 0xFFFF + 1
+        frame = struct.pack(">HHHB", self.tid, 0, len(pdu) + 1, self.args.unit) + pdu
+        t0 = time.perf_counter()
+        try:
+            self.sock.sendall(frame)
+            hdr = self.sock.recv(7, socket.MSG_WAITALL)
+            tid, _, length, _ = struct.unpack(">HHHB", hdr)
+            body = self.sock.recv(length - 1, socket.MSG_WAITALL)
+        except (OSError, struct.error):
+            self.errors += 1
+            self.sock.close()
+            time.sleep(0.5)
+            self.connect()
+            return None
+        self.latencies.append(time.perf_counter() - t0)
+        if tid != self.tid or body[0] & 0x80:
+            self.errors += 1
+            return None
+        return body
+
+    def read(self, start, count):
+        return self.transact(struct.pack(">BHH", 3, start, count))
+
+    def write(self, start, values):
+        return self.transact(struct.pack(">BHHB", 16, start, len(values), 2 * len(values)) +
+                             b"".join(struct.pack(">H", v) for v in values))
+
+
+def run_gx(c, stop):
+    c.connect()
+    for start, count in DISCOVERY:
+        c.read(start, count)
+    next_limit = time.monotonic()
+    pct = 1000
+    while not stop.is_set():
+        t0 = time.monotonic()
+        c.read(MODEL_103_START, 52)
+        c.read(MODEL_123_START, 26)
+        if c.args.limit and t0 >= next_limit:
+            # Step the limit around like ESS does while tracking a setpoint
+            pct = 400 if pct >= 1000 else pct + 200
+            c.write(WMAXLIMPCT, [pct, 0, 0, 1])
+            next_limit = t0 + c.args.limit_period
+        stop.wait(max(0.0, c.args.gx_period - (time.monotonic() - t0)))
+
+
+def run_reader(c, stop):
+    c.connect()
+    period = 1.0 / c.args.rate
+    while not stop.is_set():
+        t0 = time.monotonic()
+        c.read(MODEL_103_START, 52)
+        stop.wait(max(0.0, period - (time.monotonic() - t0)))
+
+
+def percentile(sorted_values, q):
+    if not sorted_values:
+        return 0.0
+    return sorted_values[min(len(sorted_values) - 1, int(q * len(sorted_values)))]
+
+
+def report(name, clients, duration):
+    lat = sorted(x for c in clients for x in c.latencies)
+    errors = sum(c.errors for c in clients)
+    ms = lambda v: v * 1e3
+    print("%-8s %6d req %6.1f/s %4d err  p50 %6.2f  p90 %6.2f  p99 %6.2f  p99.9 %6.2f  max %6.2f ms" % (
+        name, len(lat), len(lat) / duration, errors, ms(percentile(lat, 0.5)), ms(percentile(lat, 0.9)),
+        ms(percentile(lat, 0.99)), ms(percentile(lat, 0.999)), ms(lat[-1]) if lat else 0.0))
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=502)
+    p.add_argument("--unit", type=int, default=126)
+    p.add_argument("--duration", type=float, default=30.0)
+    p.add_argument("--timeout", type=float, default=3.0)
+    p.add_argument("--gx-period", type=float, default=1.0)
+    p.add_argument("--limit", action="store_true", help="GX writes power limits")
+    p.add_argument("--limit-period", type=float, default=5.0)
+    p.add_argument("--clients", type=int, default=3, help="extra clients besides the GX")
+    p.add_argument("--rate", type=float, default=2.0, help="reads/s per extra client")
+    args = p.parse_args()
+
+    stop = threading.Event()
+    gx = Client(args, "gx")
+    readers = [Client(args, "client%d" % i) for i in range(args.clients)]
+    threads = [threading.Thread(target=run_gx, args=(gx, stop), daemon=True)]
+    threads += [threading.Thread(target=run_reader, args=(c, stop), daemon=True) for c in readers]
+    for t in threads:
+        t.start()
+    time.sleep(args.duration)
+    stop.set()
+    for t in threads:
+        t.join(args.timeout + 1)
+
+    report("gx", [gx], args.duration)
+    if readers:
+        report("clients", readers, args.duration)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Pipelined-request check for the proxy's Modbus TCP server.
+
+Sends --count FC03 reads of the SunSpec header in a single write (far more
+bytes than a client's receive buffer holds), then expects every response,
+in order, within --timeout seconds. Exits 1 if any is missing or wrong.
+
+Usage: pipeline_check.py [--host=127.0.0.1] [--port=15021] [--unit=126]
+                         [--count=300] [--timeout=5]
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+SUNSPEC_BASE = 40000
+
+
+def recv_exact(sock, n, deadline):
+    data = b""
+    while len(data) < n:
+        sock.settimeout(max(deadline - time.monotonic(), 0.01))
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise OSError("connection closed")
+        data += chunk
+    return data
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=15021)
+    p.add_argument("--unit", type=int, default=126)
+    p.add_argument("--count", type=int, default=300)
+    p.add_argument("--timeout", type=float, default=5.0)
+    args = p.parse_args()
+
+    sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+    burst = b"".join(struct.pack(">HHHBBHH", tid, 0, 6, args.unit, 0x03, SUNSPEC_BASE, 2)
+                     for tid in range(1, args.count + 1))
+    sock.sendall(burst)
+
+    deadline = time.monotonic() + args.timeout
+    answered = 0
+    try:
+        for tid in range(1, args.count + 1):
+            hdr = recv_exact(sock, 7, deadline)
+            rtid, _, length, _ = struct.unpack(">HHHB", hdr)
+            body = recv_exact(sock, length - 1, deadline)
+            if rtid != tid or body[:2] != b"\x03\x04" or body[2:6] != b"SunS":
+                print(f"pipeline_check: FAIL response {tid}: txn {rtid}, {body.hex()}")
+                return 1
+            answered += 1
+    except OSError as e:
+        print(f"pipeline_check: FAIL {answered} of {args.count} responses ({e})")
+        return 1
+    sock.close()
+    print(f"pipeline_check: OK, {answered} pipelined requests answered ({len(burst)} bytes in one write)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
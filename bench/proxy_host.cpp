@@ -0,0 +1,148 @@
+// Runs the sunspec_proxy component on the host, against dtu_sim.py or a real
+// DTU-Pro, with the stock loop() driven the way ESPHome drives it.
+//
+//   proxy_host [--dtu=HOST:PORT ...] [--port=15021] [--unit=126]
+//              [--poll=MS] [--metrics=PORT] [--task] [--seconds=N]
+//              [--history=S] [--gateway=UNIT[,MAX_AGE_MS]] [--status=MS] [--stale=MS]
+//              [--source=MODEL,SERIAL[,DTU] ...]
+//
+// Without --source, the inverters of captures/hms2000-4t_hms800-2t.txt are
+// configured. --task starts the ESP32 polling task (needs -DUSE_ESP32).
+// --history=S keeps per-MPPT history every S seconds (the device default
+// is 60) and every 15 S, for 1440 and 2880 samples like on a device; read
+// it with history_dump.py. --gateway serves the DTUs' registers on UNIT and
+// up (max age 10 s by default). --status sets the status lane interval
+// (60 s by default, 0 = off), --stale the stale_timeout (30 s). Set
+// SHIM_PREFS to a directory to keep the warm-start snapshot between runs.
+
+#include "sunspec_proxy/sunspec_proxy.h"
+#include "sunspec_proxy/hoymiles_models.h"
+#include "esphome/core/hal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::sunspec_proxy;
+
+namespace {
+
+struct SourceArg {
+  std::string model;
+  std::string serial;
+  int dtu;
+  std::string name;  // Outlives the proxy: sources keep pointers to their strings
+};
+
+const char *opt(const char *arg, const char *name) {
+  size_t n = strlen(name);
+  return strncmp(arg, name, n) == 0 && arg[n] == '=' ? arg + n + 1 : nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::pair<std::string, uint16_t>> dtus;
+  std::vector<SourceArg> sources;
+  int port = 15021, unit = 126, poll_ms = 5000, metrics = 0, seconds = 0, history = 0;
+  int gateway_unit = 0, gateway_max_age_ms = 10000, status_ms = 60000, stale_ms = 30000;
+  bool task = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *v;
+    if ((v = opt(argv[i], "--dtu")) != nullptr) {
+      std::string s(v);
+      size_t colon = s.rfind(':');
+      dtus.emplace_back(s.substr(0, colon), colon == std::string::npos ? 502 : atoi(s.c_str() + colon + 1));
+    } else if ((v = opt(argv[i], "--source")) != nullptr) {
+      char model[32] = {0}, serial[16] = {0};
+      int dtu = 0;
+      if (sscanf(v, "%31[^,],%15[^,],%d", model, serial, &dtu) < 2) {
+        fprintf(stderr, "bad --source %s (want MODEL,SERIAL[,DTU])\n", v);
+        return 2;
+      }
+      sources.push_back({model, serial, dtu, ""});
+    } else if ((v = opt(argv[i], "--port")) != nullptr) {
+      port = atoi(v);
+    } else if ((v = opt(argv[i], "--unit")) != nullptr) {
+      unit = atoi(v);
+    } else if ((v = opt(argv[i], "--poll")) != nullptr) {
+      poll_ms = atoi(v);
+    } else if ((v = opt(argv[i], "--metrics")) != nullptr) {
+      metrics = atoi(v);
+    } else if ((v = opt(argv[i], "--seconds")) != nullptr) {
+      seconds = atoi(v);
+    } else if ((v = opt(argv[i], "--history")) != nullptr) {
+      history = atoi(v);
+    } else if ((v = opt(argv[i], "--gateway")) != nullptr) {
+      sscanf(v, "%d,%d", &gateway_unit, &gateway_max_age_ms);
+    } else if ((v = opt(argv[i], "--status")) != nullptr) {
+      status_ms = atoi(v);
+    } else if ((v = opt(argv[i], "--stale")) != nullptr) {
+      stale_ms = atoi(v);
+    } else if (strcmp(argv[i], "--task") == 0) {
+      task = true;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (dtus.empty()) dtus.emplace_back("127.0.0.1", 15020);
+  if (sources.empty()) {
+    sources.push_back({"HMS-2000-4T", "1520a025566b", 0, ""});
+    sources.push_back({"HMS-800-2T", "1410a0112233", 0, ""});
+  }
+
+  static SunSpecProxy proxy;
+  for (auto &d : dtus) proxy.add_dtu(d.first, d.second, 1);
+  proxy.set_tcp_port(port);
+  proxy.set_unit_id(unit);
+  proxy.set_poll_interval_ms(poll_ms);
+  proxy.set_status_interval_ms(status_ms);
+  proxy.set_stale_timeout_ms(stale_ms);
+  proxy.set_phases(3);
+  proxy.set_rated_voltage(230);
+  proxy.set_manufacturer("Fronius");
+  proxy.set_model_name("Hoymiles Bench");
+  proxy.set_serial_number("BENCH0001");
+  if (metrics > 0) proxy.set_metrics_port(metrics);
+  if (gateway_unit > 0) proxy.set_gateway(gateway_unit, gateway_max_age_ms);
+  if (history > 0) proxy.set_history(history, history * 1440, history * 15, history * 15 * 2880);
+
+  for (size_t i = 0; i < sources.size(); i++) {
+    const HoymilesModelSpec *spec = lookup_hoymiles_model(sources[i].model.c_str());
+    if (spec == nullptr) {
+      fprintf(stderr, "unknown model %s\n", sources[i].model.c_str());
+      return 2;
+    }
+    sources[i].name = std::string("Inv ") + (char) ('A' + i);
+    // Port = position on its DTU, one MPPT slot per DTU channel
+    uint8_t port = 0;
+    for (size_t j = 0; j < i; j++) port += sources[j].dtu == sources[i].dtu;
+    proxy.add_rtu_source(port, spec->phases, spec->rated_power_w, (i % 3) + 1, spec->panel_inputs,
+                         sources[i].name.c_str(), sources[i].model.c_str(), sources[i].serial.c_str(),
+                         sources[i].dtu);
+  }
+
+#ifdef USE_ESP32
+  if (task) proxy.set_dtu_task_core(1);
+#else
+  if (task) fprintf(stderr, "--task needs a -DUSE_ESP32 build, polling from loop()\n");
+#endif
+
+  proxy.setup();
+  uint32_t start = millis();
+  while (seconds == 0 || millis() - start < (uint32_t) seconds * 1000) {
+    proxy.loop();
+    // Pace like an idle ESPHome loop, just faster so loop costs stay visible
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // Like an OTA reboot: lets the warm-start snapshot be written
+  proxy.on_safe_shutdown();
+  return 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# End-to-end run: DTU simulator -> proxy_host -> GX + N clients.
+# Knobs (environment): SECONDS_RUN, CLIENTS, RATE, RTT, JITTER, SIM_ARGS,
+# PROXY_ARGS, LOAD_ARGS, DUMP.
+set -e
+cd "$(dirname "$0")"
+
+SECONDS_RUN=${SECONDS_RUN:-30}
+DUMP=${DUMP:-captures/hms2000-4t_hms800-2t.txt}
+
+python3 dtu_sim.py --port=15020 --dump="$DUMP" --step=5 --rtt="${RTT:-80}" --jitter="${JITTER:-40}" \
+  --serial $SIM_ARGS > dtu_sim.log 2>&1 &
+SIM=$!
+trap 'kill $SIM $PROXY 2>/dev/null || true' EXIT INT TERM
+sleep 0.5
+
+./proxy_host --dtu=127.0.0.1:15020 --port=15021 --poll=1000 --metrics=19100 \
+  --seconds=$((SECONDS_RUN + 3)) $PROXY_ARGS > proxy_host.log 2>&1 &
+PROXY=$!
+sleep 2
+
+python3 load_gen.py --port=15021 --duration="$SECONDS_RUN" --clients="${CLIENTS:-3}" --rate="${RATE:-2}" \
+  --limit $LOAD_ARGS
+
+if command -v curl > /dev/null; then
+  curl -s http://127.0.0.1:19100/metrics | grep -E '^sunspec_proxy_(loop_duration|modbus_service|dtu_request_rtt)_seconds_(sum|count)'
+fi
+wait $PROXY || true
+grep -cE '\[[EW]\]' proxy_host.log | sed 's/^/proxy warnings+errors: /'
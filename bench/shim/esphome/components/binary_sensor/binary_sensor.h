@@ -0,0 +1,13 @@
+#pragma once
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor {
+ public:
+  void publish_state(bool v) { state = v; }
+  bool state{false};
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
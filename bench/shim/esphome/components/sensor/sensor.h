@@ -0,0 +1,18 @@
+#pragma once
+
+namespace esphome {
+namespace sensor {
+
+// Records the last state and how often it was published
+class Sensor {
+ public:
+  void publish_state(float v) {
+    state = v;
+    publishes++;
+  }
+  float state{0};
+  unsigned publishes{0};
+};
+
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+namespace esphome {
+namespace text_sensor {
+
+class TextSensor {
+ public:
+  void publish_state(const std::string &v) { state = v; }
+  std::string state;
+};
+
+}  // namespace text_sensor
+}  // namespace esphome
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+
+namespace setup_priority {
+const float DATA = 600.0f;
+const float AFTER_WIFI = 250.0f;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return setup_priority::DATA; }
+  virtual void on_safe_shutdown() {}
+  virtual void on_shutdown() {}
+};
+
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace esphome {
+
+inline uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+  for (char c : str) {
+    hash *= 16777619UL;
+    hash ^= (uint8_t) c;
+  }
+  return hash;
+}
+
+// The device draws from the hardware RNG; any spread will do here
+inline uint32_t random_uint32() { return ((uint32_t) rand() << 16) ^ (uint32_t) rand(); }
+
+// No PSRAM on the host: always internal memory
+template<class T> class ExternalRAMAllocator {
+ public:
+  enum Flags { NONE = 0, REFUSE_INTERNAL = 1 << 0, ALLOW_FAILURE = 1 << 1 };
+  explicit ExternalRAMAllocator(Flags flags = NONE) : flags_(flags) {}
+  T *allocate(size_t n) { return (flags_ & REFUSE_INTERNAL) ? nullptr : static_cast<T *>(malloc(n * sizeof(T))); }
+  void deallocate(T *p, size_t) { free(p); }
+
+ private:
+  Flags flags_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in for ESPHome logging: printf to stdout. The level is read
+// from SHIM_LOG_LEVEL (0 = off, 1 = E, 2 = W, 3 = I, 4 = D, 5 = V; default 3)
+// and can be changed at runtime through shim_log_level().
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace esphome {
+
+inline int &shim_log_level() {
+  static int level = getenv("SHIM_LOG_LEVEL") ? atoi(getenv("SHIM_LOG_LEVEL")) : 3;
+  return level;
+}
+
+}  // namespace esphome
+
+#define SHIM_LOG_(lvl, letter, tag, ...) \
+  do { \
+    if (esphome::shim_log_level() >= (lvl)) { \
+      printf("[" letter "][%s] ", tag); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+    } \
+  } while (0)
+
+#define ESP_LOGE(tag, ...) SHIM_LOG_(1, "E", tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) SHIM_LOG_(2, "W", tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) SHIM_LOG_(3, "I", tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) SHIM_LOG_(3, "C", tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) SHIM_LOG_(4, "D", tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) SHIM_LOG_(5, "V", tag, __VA_ARGS__)
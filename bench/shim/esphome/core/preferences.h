@@ -0,0 +1,85 @@
+#pragma once
+
+// ESPHome preferences backed by files in $SHIM_PREFS (one per key), or by
+// memory when it isn't set, so warm starts can be tried across restarts
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() = default;
+  explicit ESPPreferenceObject(uint32_t key) : key_(key), valid_(true) {}
+
+  template<typename T> bool save(const T *src) {
+    if (!valid_) return false;
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(src);
+    std::vector<uint8_t> data(p, p + sizeof(T));
+    std::string path = path_();
+    if (path.empty()) {
+      memory_()[key_] = data;
+      return true;
+    }
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == nullptr) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return ok;
+  }
+
+  template<typename T> bool load(T *dest) {
+    if (!valid_) return false;
+    std::vector<uint8_t> data;
+    std::string path = path_();
+    if (path.empty()) {
+      auto it = memory_().find(key_);
+      if (it == memory_().end()) return false;
+      data = it->second;
+    } else {
+      FILE *f = fopen(path.c_str(), "rb");
+      if (f == nullptr) return false;
+      data.resize(sizeof(T) + 1);
+      data.resize(fread(data.data(), 1, data.size(), f));
+      fclose(f);
+    }
+    if (data.size() != sizeof(T)) return false;  // Layout changed
+    memcpy(dest, data.data(), sizeof(T));
+    return true;
+  }
+
+ private:
+  std::string path_() const {
+    const char *dir = getenv("SHIM_PREFS");
+    if (dir == nullptr || *dir == 0) return "";
+    char name[16];
+    snprintf(name, sizeof(name), "/%08x.bin", key_);
+    return std::string(dir) + name;
+  }
+  static std::map<uint32_t, std::vector<uint8_t>> &memory_() {
+    static std::map<uint32_t, std::vector<uint8_t>> m;
+    return m;
+  }
+
+  uint32_t key_{0};
+  bool valid_{false};
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type, bool in_flash) {
+    return ESPPreferenceObject(type);
+  }
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type) { return ESPPreferenceObject(type); }
+  bool sync() { return true; }
+};
+
+inline ESPPreferences *global_preferences = new ESPPreferences();
+
+}  // namespace esphome
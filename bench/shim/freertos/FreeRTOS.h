@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+#define pdPASS 1
+#define tskIDLE_PRIORITY 0
+#define pdMS_TO_TICKS(x) ((TickType_t) (x))
@@ -0,0 +1,17 @@
+#pragma once
+
+// Tasks map to detached std::threads; the core id is ignored
+
+#include <chrono>
+#include <thread>
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *, uint32_t, void *arg, int, TaskHandle_t *,
+                                          int) {
+  std::thread(fn, arg).detach();
+  return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
@@ -0,0 +1,52 @@
+#pragma once
+
+// Host stand-in for lwIP's asynchronous DNS: literals resolve immediately,
+// names on a detached thread that invokes the callback like lwIP's tcpip
+// thread would.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+#define LWIP_DNS_ADDRTYPE_IPV4 0
+
+struct ip4_addr {
+  uint32_t addr;
+};
+typedef struct ip4_addr ip4_addr_t;
+typedef struct {
+  ip4_addr_t u_addr_ip4;
+} ip_addr_t;
+#define ip_2_ip4(ip) (&(ip)->u_addr_ip4)
+#define ip4_addr_get_u32(a) ((a)->addr)
+#define IP_IS_V4(ip) 1
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *arg);
+
+inline err_t dns_gethostbyname_addrtype(const char *host, ip_addr_t *addr, dns_found_callback cb, void *arg,
+                                        uint8_t) {
+  in_addr a;
+  if (inet_aton(host, &a)) {
+    addr->u_addr_ip4.addr = a.s_addr;
+    return ERR_OK;
+  }
+  std::string h(host);
+  std::thread([h, cb, arg]() {
+    hostent *he = gethostbyname(h.c_str());
+    if (he == nullptr) {
+      cb(h.c_str(), nullptr, arg);
+      return;
+    }
+    ip_addr_t r;
+    memcpy(&r.u_addr_ip4.addr, he->h_addr, 4);
+    cb(h.c_str(), &r, arg);
+  }).detach();
+  return ERR_INPROGRESS;
+}
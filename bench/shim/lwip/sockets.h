@@ -0,0 +1,13 @@
+#pragma once
+
+// lwIP's BSD socket API is close enough to POSIX to use the host's directly
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstring>
+
+inline char *inet_ntoa_r(struct in_addr a, char *buf, int len) { return (char *) inet_ntop(AF_INET, &a, buf, len); }
@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for lwIP's tcpip_callback(): runs the function at once. The
+// shim's DNS needs no tcpip thread to be called from.
+
+#include "lwip/dns.h"
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+inline err_t tcpip_callback(tcpip_callback_fn function, void *ctx) {
+  function(ctx);
+  return ERR_OK;
+}
@@ -1,5 +1,8 @@
+import logging
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
+from esphome import automation
 from esphome.components import sensor, text_sensor, binary_sensor
 from esphome.const import (
     CONF_ID,
@@ -23,6 +26,8 @@ from esphome.const import (
     ENTITY_CATEGORY_DIAGNOSTIC,
 )
 
+_LOGGER = logging.getLogger(__name__)
+
 DEPENDENCIES = []
 AUTO_LOAD = ["sensor", "text_sensor", "binary_sensor"]
 
@@ -32,13 +37,48 @@ CONF_UNIT_ID = "unit_id"
 CONF_DTU_HOST = "dtu_host"         # DTU-Pro IP address or hostname
 CONF_DTU_PORT = "dtu_port"         # DTU-Pro Modbus TCP port (default 502)
 CONF_DTU_ADDRESS = "dtu_address"   # DTU Modbus unit ID (default 101)
+CONF_DTUS = "dtus"                 # Several DTU-Pros aggregated into one device
+CONF_HOST = "host"
+CONF_ADDRESS = "address"
+CONF_DTU = "dtu"                   # Index into dtus the inverter is paired with
+CONF_DTU_CHANNELS = "dtu_channels" # Channels to read (default: from the inverter models)
+CONF_CHANNELS = "channels"
 CONF_PHASES = "phases"
 CONF_RATED_VOLTAGE_V = "rated_voltage_v"
 CONF_MANUFACTURER = "manufacturer"
 CONF_MODEL_NAME = "model_name"
 CONF_SERIAL_NUMBER = "serial_number"
 CONF_POLL_INTERVAL_MS = "poll_interval_ms"
+CONF_IDLE_POLL_INTERVAL = "idle_poll_interval"      # Poll interval while no inverter produces (0 = off)
+CONF_FAST_POLL_INTERVAL = "fast_poll_interval"      # Poll interval while limiting / power moving
+CONF_FAST_POLL_POWER_STEP = "fast_poll_power_step"  # Power change per poll (of rated) that speeds up polling
+CONF_STATUS_INTERVAL = "status_interval"            # Alarm/link status and limit readback, between polls (0 = off)
+CONF_ALIGN_POLLS_TO_CLIENT = "align_polls_to_client"  # Time polls to land just before the GX reads
 CONF_TCP_TIMEOUT_MS = "tcp_timeout_ms"
+CONF_STALE_TIMEOUT = "stale_timeout"            # Data older than this (at least 2 polls) counts as offline
+CONF_DTU_PIPELINE_DEPTH = "dtu_pipeline_depth"  # Max DTU requests in flight
+CONF_MAX_TCP_CLIENTS = "max_tcp_clients"        # Modbus TCP client slots
+CONF_TCP_IDLE_TIMEOUT = "tcp_idle_timeout"      # Close clients silent for this long
+CONF_DTU_TASK_CORE = "dtu_task_core"            # Poll the DTU from a pinned FreeRTOS task (ESP32)
+CONF_METRICS_PORT = "metrics_port"              # Serve Prometheus metrics at http://<device>:<port>/metrics
+CONF_TRACE_RECORDS = "trace_records"            # Binary trace ring size (16 bytes per record)
+CONF_WARM_START_INTERVAL = "warm_start_interval"  # Min time between snapshot writes to flash (0 = off)
+CONF_HISTORY = "history"                        # Per-MPPT history, served at GET /history (needs metrics_port)
+CONF_FINE_INTERVAL = "fine_interval"
+CONF_FINE_RETENTION = "fine_retention"
+CONF_COARSE_INTERVAL = "coarse_interval"
+CONF_COARSE_RETENTION = "coarse_retention"
+CONF_GATEWAY = "gateway"                        # Serve the DTUs' own registers on extra unit IDs
+CONF_MAX_AGE = "max_age"
+CONF_POWER_LIMIT_BROADCAST = "power_limit_broadcast"  # Use the DTU's all-inverter limit registers
+CONF_SENSOR_HEARTBEAT = "sensor_heartbeat"      # Republish unchanged sensors this often
+CONF_SENSOR_PUBLISH_SLICE = "sensor_publish_slice"  # Sensors evaluated per loop iteration
+CONF_SENSOR_DEADBANDS = "sensor_deadbands"      # Per-class publish thresholds
+CONF_ABSOLUTE = "absolute"
+CONF_RELATIVE = "relative"
+
+# Deadband classes, in the order of SensorClass in sunspec_proxy.h
+DEADBAND_CLASSES = ["power", "voltage", "current", "energy", "frequency", "temperature", "diagnostic"]
 CONF_RTU_SOURCES = "rtu_sources"  # Keep name for backward compat, but now represents inverters
 
 # Per-source configuration keys
@@ -78,6 +118,7 @@ CONF_SENSOR_TCP_REQUESTS = "tcp_requests"
 CONF_SENSOR_TCP_ERRORS = "tcp_errors"
 CONF_SENSOR_VICTRON_CONNECTED = "victron_connected"
 CONF_SENSOR_POWER_LIMIT = "power_limit"
+CONF_SENSOR_POWER_LIMIT_LATENCY = "power_limit_latency"
 CONF_SENSOR_DTU_SERIAL = "dtu_serial"
 CONF_SENSOR_DTU_ONLINE = "dtu_online"
 CONF_SENSOR_DTU_POLL_SUCCESS = "dtu_poll_success"
@@ -85,6 +126,7 @@ CONF_SENSOR_DTU_POLL_FAIL = "dtu_poll_fail"
 
 sunspec_proxy_ns = cg.esphome_ns.namespace("sunspec_proxy")
 SunSpecProxy = sunspec_proxy_ns.class_("SunSpecProxy", cg.Component)
+DumpTraceAction = sunspec_proxy_ns.class_("DumpTraceAction", automation.Action)
 
 # Known Hoymiles inverter models with their characteristics
 # Sources: hoymiles.com product pages, verified 2026-02
@@ -173,6 +215,7 @@ BRIDGE_SENSORS_SCHEMA = cv.Schema(
         cv.Optional(CONF_SENSOR_TCP_ERRORS, default=True): cv.boolean,
         cv.Optional(CONF_SENSOR_VICTRON_CONNECTED, default=True): cv.boolean,
         cv.Optional(CONF_SENSOR_POWER_LIMIT, default=True): cv.boolean,
+        cv.Optional(CONF_SENSOR_POWER_LIMIT_LATENCY, default=True): cv.boolean,
         cv.Optional(CONF_SENSOR_DTU_SERIAL, default=True): cv.boolean,
         cv.Optional(CONF_SENSOR_DTU_ONLINE, default=True): cv.boolean,
         cv.Optional(CONF_SENSOR_DTU_POLL_SUCCESS, default=True): cv.boolean,
@@ -187,6 +230,7 @@ RTU_SOURCE_SCHEMA = cv.Schema(
     {
         cv.Optional(CONF_RTU_ADDRESS): cv.int_range(min=0, max=255),  # Legacy or port number
         cv.Optional(CONF_PORT): cv.int_range(min=0, max=15),  # DTU port number (preferred)
+        cv.Optional(CONF_DTU, default=0): cv.int_range(min=0, max=3),
         cv.Required(CONF_INVERTER_MODEL): cv.one_of(*HOYMILES_MODELS.keys(), upper=True),
         cv.Optional(CONF_INVERTER_SERIAL, default=""): cv.string,
         cv.Optional(CONF_NAME, default=""): cv.string,
@@ -198,29 +242,151 @@ RTU_SOURCE_SCHEMA = cv.Schema(
     }
 )
 
-# Main component configuration schema
-CONFIG_SCHEMA = cv.Schema(
+DEADBAND_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_ABSOLUTE): cv.positive_float,
+        cv.Optional(CONF_RELATIVE): cv.percentage,
+    }
+)
+
+def _validate_history(config):
+    fine = config[CONF_FINE_INTERVAL].total_seconds
+    coarse = config[CONF_COARSE_INTERVAL].total_seconds
+    if coarse <= fine or coarse % fine != 0:
+        raise cv.Invalid(f"{CONF_COARSE_INTERVAL} must be a multiple of {CONF_FINE_INTERVAL}")
+    for interval, retention in (
+        (CONF_FINE_INTERVAL, CONF_FINE_RETENTION),
+        (CONF_COARSE_INTERVAL, CONF_COARSE_RETENTION),
+    ):
+        if config[retention].total_seconds < config[interval].total_seconds:
+            raise cv.Invalid(f"{retention} must be at least {interval}")
+    return config
+
+
+# Ring sizes follow from interval and retention: about 24 kB per MPPT with
+# the defaults, so more than a few MPPTs want PSRAM
+HISTORY_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_FINE_INTERVAL, default="1min"): cv.All(
+                cv.positive_time_period_seconds, cv.Range(min=cv.TimePeriod(seconds=10))
+            ),
+            cv.Optional(CONF_FINE_RETENTION, default="24h"): cv.positive_time_period_seconds,
+            cv.Optional(CONF_COARSE_INTERVAL, default="15min"): cv.positive_time_period_seconds,
+            cv.Optional(CONF_COARSE_RETENTION, default="30d"): cv.All(
+                cv.positive_time_period_seconds, cv.Range(max=cv.TimePeriod(days=365))
+            ),
+        }
+    ),
+    _validate_history,
+)
+
+# DTU n answers on unit_id + n. Reads older than max_age wait for a poll
+# round (brought forward, but no closer than fast_poll_interval)
+GATEWAY_SCHEMA = cv.Schema(
     {
-        cv.GenerateID(): cv.declare_id(SunSpecProxy),
-        cv.Required(CONF_DTU_HOST): cv.string,
-        cv.Optional(CONF_DTU_PORT, default=502): cv.port,
-        cv.Optional(CONF_DTU_ADDRESS, default=101): cv.int_range(min=1, max=254),
-        cv.Optional(CONF_TCP_PORT, default=502): cv.port,
-        cv.Optional(CONF_UNIT_ID, default=126): cv.int_range(min=1, max=247),
-        cv.Optional(CONF_PHASES, default=3): cv.int_range(min=1, max=3),
-        cv.Optional(CONF_RATED_VOLTAGE_V, default=230): cv.int_range(min=1),
-        cv.Optional(CONF_MANUFACTURER, default="Fronius"): cv.string,
-        cv.Optional(CONF_MODEL_NAME, default="Hoymiles Bridge"): cv.string,
-        cv.Optional(CONF_SERIAL_NUMBER, default="HM-BRIDGE-001"): cv.string,
-        cv.Required(CONF_RTU_SOURCES): cv.All(
-            cv.ensure_list(RTU_SOURCE_SCHEMA), cv.Length(min=1, max=8)
+        cv.Optional(CONF_UNIT_ID, default=101): cv.int_range(min=1, max=247),
+        cv.Optional(CONF_MAX_AGE, default="10s"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=1))
         ),
-        cv.Optional(CONF_POLL_INTERVAL_MS, default=5000): cv.int_range(min=1000),
-        cv.Optional(CONF_TCP_TIMEOUT_MS, default=3000): cv.int_range(min=100),
-        cv.Optional(CONF_AGGREGATE_SENSORS, default={}): AGGREGATE_SENSORS_SCHEMA,
-        cv.Optional(CONF_BRIDGE_SENSORS, default={}): BRIDGE_SENSORS_SCHEMA,
     }
-).extend(cv.COMPONENT_SCHEMA)
+)
+
+DTU_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_HOST): cv.string,
+        cv.Optional(CONF_PORT, default=502): cv.port,
+        cv.Optional(CONF_ADDRESS, default=101): cv.int_range(min=1, max=254),
+        cv.Optional(CONF_CHANNELS): cv.int_range(min=1, max=792),
+    }
+)
+
+
+def _validate_history_export(config):
+    if CONF_HISTORY in config and CONF_METRICS_PORT not in config:
+        raise cv.Invalid(f"{CONF_HISTORY} is exported on the metrics port, set {CONF_METRICS_PORT}")
+    return config
+
+
+def _validate_gateway(config):
+    if CONF_GATEWAY not in config:
+        return config
+    num_dtus = len(config[CONF_DTUS]) if CONF_DTUS in config else 1
+    first = config[CONF_GATEWAY][CONF_UNIT_ID]
+    last = first + num_dtus - 1
+    if last > 247:
+        raise cv.Invalid(f"{CONF_GATEWAY}: unit IDs {first}-{last} go past 247")
+    if first <= config[CONF_UNIT_ID] <= last:
+        raise cv.Invalid(f"{CONF_GATEWAY}: unit IDs {first}-{last} include the SunSpec {CONF_UNIT_ID}")
+    return config
+
+
+def _validate_dtu_indices(config):
+    num_dtus = len(config[CONF_DTUS]) if CONF_DTUS in config else 1
+    for idx, src in enumerate(config[CONF_RTU_SOURCES]):
+        if src[CONF_DTU] >= num_dtus:
+            raise cv.Invalid(
+                f"rtu_sources[{idx}]: dtu {src[CONF_DTU]} is not configured ({num_dtus} DTU(s))"
+            )
+    return config
+
+
+# Main component configuration schema
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SunSpecProxy),
+            cv.Optional(CONF_DTU_HOST): cv.string,
+            cv.Optional(CONF_DTU_PORT, default=502): cv.port,
+            cv.Optional(CONF_DTU_ADDRESS, default=101): cv.int_range(min=1, max=254),
+            cv.Optional(CONF_DTU_CHANNELS): cv.int_range(min=1, max=792),
+            cv.Optional(CONF_DTUS): cv.All(cv.ensure_list(DTU_SCHEMA), cv.Length(min=1, max=4)),
+            cv.Optional(CONF_TCP_PORT, default=502): cv.port,
+            cv.Optional(CONF_UNIT_ID, default=126): cv.int_range(min=1, max=247),
+            cv.Optional(CONF_PHASES, default=3): cv.int_range(min=1, max=3),
+            cv.Optional(CONF_RATED_VOLTAGE_V, default=230): cv.int_range(min=1),
+            cv.Optional(CONF_MANUFACTURER, default="Fronius"): cv.string,
+            cv.Optional(CONF_MODEL_NAME, default="Hoymiles Bridge"): cv.string,
+            cv.Optional(CONF_SERIAL_NUMBER, default="HM-BRIDGE-001"): cv.string,
+            cv.Required(CONF_RTU_SOURCES): cv.All(
+                cv.ensure_list(RTU_SOURCE_SCHEMA), cv.Length(min=1, max=99)
+            ),
+            cv.Optional(CONF_POLL_INTERVAL_MS, default=5000): cv.int_range(min=1000),
+            cv.Optional(CONF_IDLE_POLL_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_FAST_POLL_INTERVAL, default="1s"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(min=cv.TimePeriod(milliseconds=500)),
+            ),
+            cv.Optional(CONF_FAST_POLL_POWER_STEP, default="5%"): cv.percentage,
+            cv.Optional(CONF_STATUS_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_ALIGN_POLLS_TO_CLIENT, default=True): cv.boolean,
+            cv.Optional(CONF_TCP_TIMEOUT_MS, default=3000): cv.int_range(min=100),
+            cv.Optional(CONF_STALE_TIMEOUT, default="30s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_DTU_PIPELINE_DEPTH, default=2): cv.int_range(min=1, max=8),
+            cv.Optional(CONF_MAX_TCP_CLIENTS, default=4): cv.int_range(min=1, max=16),
+            cv.Optional(CONF_TCP_IDLE_TIMEOUT, default="120s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_DTU_TASK_CORE): cv.All(cv.only_on_esp32, cv.int_range(min=0, max=1)),
+            cv.Optional(CONF_METRICS_PORT): cv.port,
+            cv.Optional(CONF_TRACE_RECORDS, default=256): cv.one_of(64, 128, 256, 512, 1024, int=True),
+            cv.Optional(CONF_WARM_START_INTERVAL, default="10min"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_HISTORY): HISTORY_SCHEMA,
+            cv.Optional(CONF_GATEWAY): GATEWAY_SCHEMA,
+            cv.Optional(CONF_POWER_LIMIT_BROADCAST, default=True): cv.boolean,
+            cv.Optional(CONF_SENSOR_HEARTBEAT, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_SENSOR_PUBLISH_SLICE, default=8): cv.int_range(min=1, max=64),
+            cv.Optional(CONF_SENSOR_DEADBANDS, default={}): cv.Schema(
+                {cv.Optional(cls): DEADBAND_SCHEMA for cls in DEADBAND_CLASSES}
+            ),
+            cv.Optional(CONF_AGGREGATE_SENSORS, default={}): AGGREGATE_SENSORS_SCHEMA,
+            cv.Optional(CONF_BRIDGE_SENSORS, default={}): BRIDGE_SENSORS_SCHEMA,
+        }
+    ).extend(cv.COMPONENT_SCHEMA),
+    cv.has_exactly_one_key(CONF_DTU_HOST, CONF_DTUS),
+    cv.has_at_most_one_key(CONF_DTU_CHANNELS, CONF_DTUS),
+    _validate_dtu_indices,
+    _validate_history_export,
+    _validate_gateway,
+)
 
 
 def get_model_specs(model_name):
@@ -230,6 +396,17 @@ def get_model_specs(model_name):
 # Counter for generating unique IDs
 _sensor_counter = 0
 
+# Per-source RAM on a 32-bit target, for the compile-time report: RtuSource
+# with its MPPT slots (the strings live in flash), the online/status sensor
+# pointers, the SN index, channel counts and the command queue entries. With
+# every table sized for 8 × 8, the struct also held 89 bytes of strings and
+# each source reserved 89 sensor pointers.
+def _source_ram_bytes(mppts, legacy=False):
+    rtu_source = 368 if legacy else 88 + 24 * mppts
+    sensor_ptrs = 89 * 4 if legacy else 2 * 4
+    return rtu_source + sensor_ptrs + 16 + 2 + 12
+
+
 def _make_sensor_id():
     global _sensor_counter
     _sensor_counter += 1
@@ -309,9 +486,18 @@ async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
-    cg.add(var.set_dtu_host(config[CONF_DTU_HOST]))
-    cg.add(var.set_dtu_port(config[CONF_DTU_PORT]))
-    cg.add(var.set_dtu_address(config[CONF_DTU_ADDRESS]))
+    if CONF_DTUS in config:
+        for dtu in config[CONF_DTUS]:
+            cg.add(var.add_dtu(dtu[CONF_HOST], dtu[CONF_PORT], dtu[CONF_ADDRESS], dtu.get(CONF_CHANNELS, 0)))
+    else:
+        cg.add(
+            var.add_dtu(
+                config[CONF_DTU_HOST],
+                config[CONF_DTU_PORT],
+                config[CONF_DTU_ADDRESS],
+                config.get(CONF_DTU_CHANNELS, 0),
+            )
+        )
     cg.add(var.set_tcp_port(config[CONF_TCP_PORT]))
     cg.add(var.set_unit_id(config[CONF_UNIT_ID]))
     cg.add(var.set_phases(config[CONF_PHASES]))
@@ -320,7 +506,80 @@ async def to_code(config):
     cg.add(var.set_model_name(config[CONF_MODEL_NAME]))
     cg.add(var.set_serial_number(config[CONF_SERIAL_NUMBER]))
     cg.add(var.set_poll_interval_ms(config[CONF_POLL_INTERVAL_MS]))
+    cg.add(var.set_idle_poll_interval_ms(config[CONF_IDLE_POLL_INTERVAL]))
+    cg.add(var.set_fast_poll_interval_ms(config[CONF_FAST_POLL_INTERVAL]))
+    cg.add(var.set_fast_poll_power_step(config[CONF_FAST_POLL_POWER_STEP]))
+    cg.add(var.set_status_interval_ms(config[CONF_STATUS_INTERVAL]))
+    cg.add(var.set_align_polls_to_client(config[CONF_ALIGN_POLLS_TO_CLIENT]))
     cg.add(var.set_tcp_timeout_ms(config[CONF_TCP_TIMEOUT_MS]))
+    cg.add(var.set_stale_timeout_ms(config[CONF_STALE_TIMEOUT]))
+    cg.add(var.set_dtu_pipeline_depth(config[CONF_DTU_PIPELINE_DEPTH]))
+    cg.add(var.set_max_tcp_clients(config[CONF_MAX_TCP_CLIENTS]))
+    cg.add(var.set_tcp_idle_timeout_ms(config[CONF_TCP_IDLE_TIMEOUT]))
+    if CONF_DTU_TASK_CORE in config:
+        cg.add(var.set_dtu_task_core(config[CONF_DTU_TASK_CORE]))
+    if CONF_METRICS_PORT in config:
+        cg.add(var.set_metrics_port(config[CONF_METRICS_PORT]))
+    if CONF_GATEWAY in config:
+        gw = config[CONF_GATEWAY]
+        cg.add(var.set_gateway(gw[CONF_UNIT_ID], gw[CONF_MAX_AGE]))
+    cg.add(var.set_power_limit_broadcast(config[CONF_POWER_LIMIT_BROADCAST]))
+    cg.add(var.set_warm_start_interval_ms(config[CONF_WARM_START_INTERVAL]))
+    if CONF_HISTORY in config:
+        hist = config[CONF_HISTORY]
+        cg.add(
+            var.set_history(
+                int(hist[CONF_FINE_INTERVAL].total_seconds),
+                int(hist[CONF_FINE_RETENTION].total_seconds),
+                int(hist[CONF_COARSE_INTERVAL].total_seconds),
+                int(hist[CONF_COARSE_RETENTION].total_seconds),
+            )
+        )
+    cg.add(var.set_sensor_heartbeat_ms(config[CONF_SENSOR_HEARTBEAT]))
+    cg.add(var.set_sensor_publish_slice(config[CONF_SENSOR_PUBLISH_SLICE]))
+    for cls_idx, cls in enumerate(DEADBAND_CLASSES):
+        if cls in config[CONF_SENSOR_DEADBANDS]:
+            db = config[CONF_SENSOR_DEADBANDS][cls]
+            if CONF_ABSOLUTE in db:
+                cg.add(var.set_sensor_deadband_absolute(cls_idx, db[CONF_ABSOLUTE]))
+            if CONF_RELATIVE in db:
+                cg.add(var.set_sensor_deadband_relative(cls_idx, db[CONF_RELATIVE]))
+
+    # SunSpec Model 160 gets one module per MPPT input; its size is part of
+    # the compile-time register map layout
+    mppt_modules = sum(
+        src.get(CONF_MPPT_INPUTS, get_model_specs(src[CONF_INVERTER_MODEL])["mppt"])
+        for src in config[CONF_RTU_SOURCES]
+    )
+    cg.add_define("SUNSPEC_PROXY_MPPT_MODULES", max(1, mppt_modules))
+
+    # Source tables are sized to the config: MPPT slots for the widest
+    # inverter (its own inputs or the DTU channels of its model)
+    num_sources = len(config[CONF_RTU_SOURCES])
+    mppts = max(
+        max(src.get(CONF_MPPT_INPUTS, 1), get_model_specs(src[CONF_INVERTER_MODEL])["mppt"])
+        for src in config[CONF_RTU_SOURCES]
+    )
+    cg.add_define("SUNSPEC_PROXY_SOURCES", num_sources)
+    cg.add_define("SUNSPEC_PROXY_MPPTS_PER_SOURCE", mppts)
+    after = num_sources * _source_ram_bytes(mppts)
+    if num_sources <= 8:
+        before = 8 * _source_ram_bytes(8, legacy=True)
+        # The DTU task keeps a working set and three snapshot slots on the heap
+        task_saved = 4 * (8 * 368 - num_sources * (88 + 24 * mppts)) if CONF_DTU_TASK_CORE in config else 0
+        _LOGGER.info(
+            "sunspec_proxy: %d sources x %d MPPT slots, source tables %d bytes instead of %d "
+            "(%d bytes static RAM saved%s)",
+            num_sources, mppts, after, before, before - after,
+            f", {task_saved} more on the DTU task heap" if task_saved > 0 else "",
+        )
+    else:
+        # More sources than the old fixed tables could hold: nothing to compare
+        _LOGGER.info(
+            "sunspec_proxy: %d sources x %d MPPT slots, source tables %d bytes",
+            num_sources, mppts, after,
+        )
+    cg.add_define("SUNSPEC_PROXY_TRACE_RECORDS", config[CONF_TRACE_RECORDS])
 
     # Process RTU sources (inverter ports on the DTU)
     for idx, src in enumerate(config[CONF_RTU_SOURCES]):
@@ -356,6 +615,7 @@ async def to_code(config):
                 name,
                 model_name,
                 serial,
+                src[CONF_DTU],
             )
         )
 
@@ -518,6 +778,10 @@ async def to_code(config):
         sens = await _create_sensor("Power Limit", UNIT_PERCENT, 1, None, None, "mdi:speedometer")
         cg.add(var.set_power_limit_sensor(sens))
 
+    if bridge_config.get(CONF_SENSOR_POWER_LIMIT_LATENCY, True):
+        sens = await _create_sensor("Power Limit Latency", "ms", 0, None, None, "mdi:timer-outline", ENTITY_CATEGORY_DIAGNOSTIC)
+        cg.add(var.set_power_limit_latency_sensor(sens))
+
     # DTU diagnostic sensors
     if bridge_config.get(CONF_SENSOR_DTU_SERIAL, True):
         tsens = await _create_text_sensor("DTU Serial", "mdi:identifier", ENTITY_CATEGORY_DIAGNOSTIC)
@@ -534,3 +798,14 @@ async def to_code(config):
     if bridge_config.get(CONF_SENSOR_DTU_POLL_FAIL, True):
         sens = await _create_sensor("DTU Poll Failures", None, 0, None, None, "mdi:alert-circle", ENTITY_CATEGORY_DIAGNOSTIC)
         cg.add(var.set_dtu_poll_fail_sensor(sens))
+
+
+@automation.register_action(
+    "sunspec_proxy.dump_trace",
+    DumpTraceAction,
+    automation.maybe_simple_id({cv.Required(CONF_ID): cv.use_id(SunSpecProxy)}),
+)
+async def dump_trace_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "sunspec_proxy.h"
+
+namespace esphome {
+namespace sunspec_proxy {
+
+// sunspec_proxy.dump_trace: decode the trace ring into the log
+template<typename... Ts> class DumpTraceAction : public Action<Ts...>, public Parented<SunSpecProxy> {
+ public:
+  void play(Ts... x) override { this->parent_->dump_trace(); }
+};
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
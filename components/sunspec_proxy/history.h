@@ -0,0 +1,336 @@
+#pragma once
+
+/**
+ * Per-MPPT time-series history with two downsampling tiers
+ *
+ * Every poll feeds the current power, DC voltage, DC current and
+ * temperature of each MPPT (in the DTU's fixed-point units) into a
+ * per-series accumulator. Each fine interval (1 min by default) the average
+ * becomes one sample of the fine tier, and the fine samples are averaged
+ * again into the coarse tier (15 min by default). Each tier has a ring of
+ * 128-byte blocks per series. A block holds one gap-free run of samples: the
+ * first sample is stored in full, each later one as a header byte with a
+ * 2-bit size class per field followed by the field deltas:
+ *
+ *   class 0  unchanged      class 1  int8 delta      class 2  int16 delta
+ *
+ * (all deltas are modulo 2^16). A night sample is one byte, a typical day
+ * sample five or six. Intervals without a reading (DTU offline, channel
+ * missing) are a two-byte skip marker, header 0xFF and the number of
+ * intervals; a gap longer than 255 intervals ends the block instead.
+ *
+ * Blocks are exported exactly as stored (see GET /history in the README),
+ * so a collector can backfill a gap with one request and decode it itself.
+ *
+ * The store is fed by one writer, the DTU side of the poll, and is read by
+ * the /history handler in the main loop. Completed and open blocks are only
+ * written inside a seqlock: a reader copies a block and retries if a write
+ * overlapped.
+ */
+
+#include "esphome/core/helpers.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+// One history sample: the fields in the DTU's units. The temperature keeps
+// its int16 bit pattern, since deltas are taken modulo 2^16 anyway.
+enum HistoryField : uint8_t {
+  HIST_POWER_DW = 0,       // 0.1 W
+  HIST_DC_VOLTAGE_DV = 1,  // 0.1 V
+  HIST_DC_CURRENT_CA = 2,  // 0.01 A
+  HIST_TEMPERATURE_DC = 3, // 0.1 °C, signed
+  HIST_FIELDS = 4,
+};
+
+struct HistorySample {
+  uint16_t v[HIST_FIELDS];
+};
+
+static const uint16_t HISTORY_BLOCK_SIZE = 128;
+static const uint8_t HISTORY_TIERS = 2;  // 0 = fine, 1 = coarse
+// Sizing assumption for the ring lengths: the average encoded sample,
+// header byte included. A noisy day needs more and shortens the retention.
+static const uint8_t HISTORY_TYPICAL_SAMPLE_BYTES = 5;
+
+struct HistoryBlock {
+  uint32_t start_s;             // Uptime (s) of the first sample, a multiple of the interval
+  uint16_t count;               // Samples, 0 = never written
+  uint8_t series;               // Series (Model 160 module order)
+  uint8_t bytes;                // Payload bytes used
+  HistorySample first;          // First sample, in full
+  uint8_t payload[HISTORY_BLOCK_SIZE - 16];  // Later samples, delta-encoded
+};
+static_assert(sizeof(HistoryBlock) == HISTORY_BLOCK_SIZE, "HistoryBlock layout");
+
+// Header byte of a skip marker (class 3 in every field), followed by the
+// number of intervals without a reading
+static const uint8_t HISTORY_SKIP = 0xFF;
+static const uint8_t HISTORY_MAX_SKIP = 255;
+
+// Appends `cur` as a delta of `prev` at `out`; returns the bytes written
+// (at most 1 + 2 * HIST_FIELDS)
+inline uint8_t history_encode_delta(const HistorySample &prev, const HistorySample &cur, uint8_t *out) {
+  uint8_t n = 1;
+  uint8_t classes = 0;
+  for (int f = 0; f < HIST_FIELDS; f++) {
+    int16_t d = (int16_t) (uint16_t) (cur.v[f] - prev.v[f]);
+    if (d == 0) continue;
+    if (d >= INT8_MIN && d <= INT8_MAX) {
+      classes |= 1 << (f * 2);
+      out[n++] = (uint8_t) d;
+    } else {
+      classes |= 2 << (f * 2);
+      out[n++] = (uint8_t) d;
+      out[n++] = (uint8_t) ((uint16_t) d >> 8);
+    }
+  }
+  out[0] = classes;
+  return n;
+}
+
+// Time of the last sample of a block (walks the payload for skip markers)
+inline uint32_t history_block_end_s(const HistoryBlock &b, uint32_t interval_s) {
+  uint32_t t = b.start_s;
+  for (uint8_t i = 0; i < b.bytes && i < sizeof(b.payload);) {
+    uint8_t h = b.payload[i++];
+    if (h == HISTORY_SKIP) {
+      t += b.payload[i++] * interval_s;
+      continue;
+    }
+    t += interval_s;
+    for (int f = 0; f < HIST_FIELDS; f++) i += (h >> (f * 2)) & 3;
+  }
+  return t;
+}
+
+// GET /history response (little-endian): this header, one entry per
+// series, then the blocks of series 0 oldest first, series 1, ...
+struct HistoryExportHeader {
+  char magic[4];                // "SPHI"
+  uint8_t version;              // 1
+  uint8_t tier;
+  uint8_t series;
+  uint8_t reserved;
+  uint32_t interval_s;
+  uint32_t now_s;               // Uptime when the response started
+  uint32_t since_s;             // Blocks ending before this were left out
+  uint16_t block_size;          // HISTORY_BLOCK_SIZE
+  uint16_t reserved2;
+};
+static_assert(sizeof(HistoryExportHeader) == 24, "HistoryExportHeader layout");
+
+struct HistoryExportSeries {
+  uint8_t source;               // rtu_sources index
+  uint8_t mppt;                 // MPPT input, from 1
+  char serial[14];              // Inverter serial, NUL-padded
+};
+static_assert(sizeof(HistoryExportSeries) == 16, "HistoryExportSeries layout");
+
+class HistoryStore {
+ public:
+  struct TierConfig {
+    uint32_t interval_s;
+    uint32_t retention_s;
+  };
+
+  // Allocates the rings, from PSRAM where there is some. False if the
+  // memory isn't there; the store then stays empty and add() does nothing.
+  bool init(uint8_t series, const TierConfig (&tiers)[HISTORY_TIERS]) {
+    uint32_t total = 0;
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+      uint32_t samples = tiers[t].retention_s / tiers[t].interval_s;
+      uint32_t per_block = 1 + sizeof(HistoryBlock::payload) / HISTORY_TYPICAL_SAMPLE_BYTES;
+      // +1: the open block
+      tiers_[t].blocks = (samples + per_block - 1) / per_block + 1;
+      tiers_[t].interval_s = tiers[t].interval_s;
+      total += tiers_[t].blocks;
+    }
+    total *= series;
+    ExternalRAMAllocator<HistoryBlock> allocator(ExternalRAMAllocator<HistoryBlock>::ALLOW_FAILURE);
+    blocks_ = allocator.allocate(total);
+    if (blocks_ == nullptr) return false;
+    memset(blocks_, 0, total * sizeof(HistoryBlock));
+    series_ = series;
+    rings_ = new Ring[series * HISTORY_TIERS]();
+    accumulators_ = new Accumulator[series * HISTORY_TIERS]();
+    HistoryBlock *next = blocks_;
+    for (uint8_t s = 0; s < series; s++) {
+      for (int t = 0; t < HISTORY_TIERS; t++) {
+        ring_(s, t).blocks = next;
+        next += tiers_[t].blocks;
+      }
+    }
+    bytes_ = total * sizeof(HistoryBlock);
+    return true;
+  }
+
+  bool enabled() const { return series_ > 0; }
+  uint8_t series() const { return series_; }
+  uint32_t interval_s(int tier) const { return tiers_[tier].interval_s; }
+  uint32_t ring_blocks(int tier) const { return tiers_[tier].blocks; }
+  uint32_t bytes() const { return bytes_; }
+
+  // Uptime in seconds, extended past the millis() wrap. Called by the
+  // writer with every poll; uptime_s() gives readers the same clock.
+  uint32_t tick(uint32_t now_ms) {
+    uptime_ms_ += now_ms - last_ms_;
+    last_ms_ = now_ms;
+    uint32_t s = (uint32_t) (uptime_ms_ / 1000);
+    clock_s_.store(s, std::memory_order_relaxed);
+    clock_ms_.store(now_ms, std::memory_order_relaxed);
+    return s;
+  }
+  uint32_t uptime_s(uint32_t now_ms) const {
+    return clock_s_.load(std::memory_order_relaxed) + (now_ms - clock_ms_.load(std::memory_order_relaxed)) / 1000;
+  }
+
+  // One poll's reading of a series
+  void add(uint8_t series, uint32_t now_s, const HistorySample &s) {
+    if (series >= series_) return;
+    feed_(series, 0, now_s, s);
+  }
+
+  // Blocks of a series are numbered from 0 since boot; [first, end) are
+  // still in the ring, end - 1 is the open block
+  void block_range(uint8_t series, int tier, uint32_t *first, uint32_t *end) const {
+    uint32_t s1, written, held;
+    do {
+      s1 = seq_.load(std::memory_order_acquire);
+      const Ring &r = ring_(series, tier);
+      written = r.written;
+      held = r.held;
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((s1 & 1) || seq_.load(std::memory_order_relaxed) != s1);
+    *first = written - held;
+    *end = written;
+  }
+
+  // Copies block `n` of a series; false if it has been overwritten since
+  bool read_block(uint8_t series, int tier, uint32_t n, HistoryBlock *out) const {
+    const Ring &r = ring_(series, tier);
+    for (;;) {
+      uint32_t s1 = seq_.load(std::memory_order_acquire);
+      if (s1 & 1) continue;
+      bool held = n < r.written && r.written - n <= r.held;
+      if (held) memcpy(out, &r.blocks[n % tiers_[tier].blocks], sizeof(HistoryBlock));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == s1) return held;
+    }
+  }
+
+ protected:
+  struct Ring {
+    HistoryBlock *blocks;
+    uint32_t written;       // Blocks started since boot
+    uint32_t held;          // Of those, still in the ring
+    bool open;              // The newest block takes more samples
+    HistorySample last;     // Newest sample, the base of the next delta
+    uint32_t next_s;        // Time the next sample of the open block is due
+  };
+  // Sums over the current interval
+  struct Accumulator {
+    uint32_t bucket_s;
+    uint32_t n;
+    uint32_t sum[HIST_FIELDS - 1];
+    int32_t sum_temperature;
+  };
+  struct TierState {
+    uint32_t interval_s{60};
+    uint32_t blocks{0};
+  };
+
+  Ring &ring_(uint8_t s, int t) { return rings_[s * HISTORY_TIERS + t]; }
+  const Ring &ring_(uint8_t s, int t) const { return rings_[s * HISTORY_TIERS + t]; }
+  Accumulator &accumulator_(uint8_t s, int t) { return accumulators_[s * HISTORY_TIERS + t]; }
+
+  // Adds a reading to tier t; a reading from a later interval first closes
+  // the current one, whose average goes into the ring (and on to tier t+1)
+  void feed_(uint8_t series, int t, uint32_t now_s, const HistorySample &s) {
+    Accumulator &a = accumulator_(series, t);
+    uint32_t bucket = now_s - now_s % tiers_[t].interval_s;
+    if (a.n > 0 && bucket != a.bucket_s) flush_(series, t, a);
+    if (a.n == 0) a.bucket_s = bucket;
+    for (int f = 0; f < HIST_FIELDS - 1; f++) a.sum[f] += s.v[f];
+    a.sum_temperature += (int16_t) s.v[HIST_TEMPERATURE_DC];
+    a.n++;
+  }
+
+  void flush_(uint8_t series, int t, Accumulator &a) {
+    if (a.n == 0) return;
+    HistorySample avg;
+    for (int f = 0; f < HIST_FIELDS - 1; f++) avg.v[f] = (a.sum[f] + a.n / 2) / a.n;
+    int32_t half = a.sum_temperature >= 0 ? (int32_t) a.n / 2 : -(int32_t) a.n / 2;
+    avg.v[HIST_TEMPERATURE_DC] = (uint16_t) (int16_t) ((a.sum_temperature + half) / (int32_t) a.n);
+    uint32_t bucket = a.bucket_s;
+    a = Accumulator{};
+    append_(series, t, bucket, avg);
+    if (t + 1 < HISTORY_TIERS) feed_(series, t + 1, bucket, avg);
+  }
+
+  void append_(uint8_t series, int t, uint32_t time_s, const HistorySample &s) {
+    Ring &r = ring_(series, t);
+    uint32_t interval = tiers_[t].interval_s;
+    uint8_t delta[2 + 1 + 2 * HIST_FIELDS];
+    uint8_t n = 0;
+    HistoryBlock *b = r.open ? &r.blocks[(r.written - 1) % tiers_[t].blocks] : nullptr;
+    if (b != nullptr) {
+      // A run continues over a few missed intervals (an idle poll interval
+      // close to the fine interval misses one now and then), and while the
+      // sample fits
+      uint32_t missed = time_s > r.next_s ? (time_s - r.next_s) / interval : 0;
+      if (time_s < r.next_s || missed > HISTORY_MAX_SKIP) {
+        b = nullptr;
+      } else {
+        if (missed > 0) {
+          delta[n++] = HISTORY_SKIP;
+          delta[n++] = missed;
+        }
+        n += history_encode_delta(r.last, s, &delta[n]);
+        if (b->bytes + n > sizeof(b->payload)) b = nullptr;
+      }
+    }
+
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (b == nullptr) {
+      b = &r.blocks[r.written % tiers_[t].blocks];
+      b->start_s = time_s;
+      b->count = 1;
+      b->series = series;
+      b->bytes = 0;
+      b->first = s;
+      r.written++;
+      if (r.held < tiers_[t].blocks) r.held++;
+      r.open = true;
+    } else {
+      memcpy(&b->payload[b->bytes], delta, n);
+      b->bytes += n;
+      b->count++;
+    }
+    r.last = s;
+    r.next_s = time_s + interval;
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  TierState tiers_[HISTORY_TIERS];
+  HistoryBlock *blocks_{nullptr};
+  Ring *rings_{nullptr};
+  Accumulator *accumulators_{nullptr};
+  uint8_t series_{0};
+  uint32_t bytes_{0};
+  std::atomic<uint32_t> seq_{0};  // Odd while a block is being written
+
+  // Writer's clock, see tick()
+  uint64_t uptime_ms_{0};
+  uint32_t last_ms_{0};
+  std::atomic<uint32_t> clock_s_{0};
+  std::atomic<uint32_t> clock_ms_{0};
+};
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
@@ -0,0 +1,109 @@
+#pragma once
+
+/**
+ * Fixed-bucket latency histograms and traffic counters
+ *
+ * Cheap enough to leave on permanently: recording is a short bucket scan
+ * plus a few relaxed atomic adds, and nothing is allocated. Every metric has
+ * a single writer (the main loop or the DTU task); the /metrics handler only
+ * reads, so counts are at worst one sample behind.
+ *
+ * Output is the Prometheus text exposition format. Latencies are recorded in
+ * microseconds and exported in seconds, as Prometheus expects.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+// Upper bucket bounds (µs), shared by all histograms so they compare at a
+// glance: 100 µs for a register-image read up to 5 s for a stuck DTU
+static const uint32_t LATENCY_BUCKETS_US[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000,
+};
+static const int LATENCY_BUCKET_COUNT = sizeof(LATENCY_BUCKETS_US) / sizeof(LATENCY_BUCKETS_US[0]);
+
+class LatencyHistogram {
+ public:
+  void record_us(uint32_t us) {
+    int b = 0;
+    while (b < LATENCY_BUCKET_COUNT && us > LATENCY_BUCKETS_US[b]) b++;
+    counts_[b].fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(us, std::memory_order_relaxed);
+  }
+  void record_ms(uint32_t ms) { record_us(ms >= UINT32_MAX / 1000 ? UINT32_MAX : ms * 1000); }
+
+  // Append the _bucket/_sum/_count samples. labels is either empty or a
+  // label list without braces, e.g. "dtu=\"0\"".
+  void append_to(std::string &out, const char *name, const char *labels) const {
+    char buf[256];  // _sum and _count lines, each with a full 63-character label list
+    const char *sep = labels[0] ? "," : "";
+    uint32_t cumulative = 0;
+    for (int b = 0; b <= LATENCY_BUCKET_COUNT; b++) {
+      cumulative += counts_[b].load(std::memory_order_relaxed);
+      if (b < LATENCY_BUCKET_COUNT) {
+        snprintf(buf, sizeof(buf), "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep,
+                 LATENCY_BUCKETS_US[b] / 1e6, (unsigned long) cumulative);
+      } else {
+        snprintf(buf, sizeof(buf), "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep,
+                 (unsigned long) cumulative);
+      }
+      out += buf;
+    }
+    const char *open = labels[0] ? "{" : "";
+    const char *close = labels[0] ? "}" : "";
+    snprintf(buf, sizeof(buf), "%s_sum%s%s%s %.6f\n%s_count%s%s%s %lu\n", name, open, labels, close,
+             sum_us_.load(std::memory_order_relaxed) / 1e6, name, open, labels, close,
+             (unsigned long) cumulative);
+    out += buf;
+  }
+
+ private:
+  std::atomic<uint32_t> counts_[LATENCY_BUCKET_COUNT + 1]{};  // Last = +Inf
+  std::atomic<uint64_t> sum_us_{0};
+};
+
+// Bytes and Modbus frames in each direction of one connection type
+struct TrafficCounters {
+  std::atomic<uint32_t> rx_bytes{0};
+  std::atomic<uint32_t> tx_bytes{0};
+  std::atomic<uint32_t> rx_frames{0};
+  std::atomic<uint32_t> tx_frames{0};
+
+  void add_rx(uint32_t bytes) { rx_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+  void add_tx(uint32_t bytes) { tx_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+  void frame_rx() { rx_frames.fetch_add(1, std::memory_order_relaxed); }
+  void frame_tx() { tx_frames.fetch_add(1, std::memory_order_relaxed); }
+};
+
+// "# HELP" / "# TYPE" lines of a metric family
+inline void append_metric_header(std::string &out, const char *name, const char *type, const char *help) {
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+// One sample; labels as for LatencyHistogram::append_to()
+inline void append_metric(std::string &out, const char *name, const char *labels, double value) {
+  char buf[128];
+  if (labels[0]) {
+    snprintf(buf, sizeof(buf), "%s{%s} %.10g\n", name, labels, value);
+  } else {
+    snprintf(buf, sizeof(buf), "%s %.10g\n", name, value);
+  }
+  out += buf;
+}
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
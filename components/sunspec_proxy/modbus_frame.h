@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * Modbus TCP framing helpers
+ *
+ * Modbus TCP runs over a byte stream, so a single recv() may return part of
+ * an ADU, exactly one ADU, or several ADUs back to back. MbapStreamDecoder
+ * accumulates received bytes and hands out complete ADUs using the length
+ * field of the MBAP header:
+ *
+ *   [0:1] transaction id   [2:3] protocol id (0)   [4:5] length   [6] unit id
+ *   [7..] PDU (function code + data), length = 1 (unit id) + PDU bytes
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+static const uint16_t MBAP_HEADER_LEN = 7;   // Up to and including the unit id
+static const uint16_t MBAP_MAX_ADU = 260;    // 7-byte header + 253-byte PDU
+
+template<size_t N> class MbapStreamDecoder {
+  static_assert(N >= 2 * MBAP_MAX_ADU, "decoder must hold at least two full ADUs");
+
+ public:
+  // Free space for the next recv(); compacts consumed bytes first
+  uint8_t *write_ptr() {
+    if (head_ > 0) {
+      memmove(buf_, &buf_[head_], tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+    }
+    return &buf_[tail_];
+  }
+  // Space write_ptr() makes room for, counting the bytes already consumed:
+  // recv(fd, write_ptr(), write_space()) may evaluate either one first
+  size_t write_space() const { return N - (tail_ - head_); }
+  void commit(size_t n) { tail_ += n; }
+
+  // Returns the length of the next complete ADU and points *frame at it, or 0
+  // if more bytes are needed. The frame stays valid until the next write_ptr().
+  // A header that can't be valid (protocol id != 0, length out of range) is
+  // skipped one byte at a time until the stream lines up with a frame again.
+  int next_frame(const uint8_t **frame) {
+    while (tail_ - head_ >= MBAP_HEADER_LEN + 1) {
+      const uint8_t *p = &buf_[head_];
+      uint16_t proto = ((uint16_t) p[2] << 8) | p[3];
+      uint16_t len = ((uint16_t) p[4] << 8) | p[5];
+      if (proto != 0 || len < 2 || len > MBAP_MAX_ADU - 6) {
+        head_++;
+        resync_bytes_++;
+        continue;
+      }
+      int frame_len = 6 + len;
+      if (tail_ - head_ < (size_t) frame_len) return 0;
+      *frame = p;
+      head_ += frame_len;
+      return frame_len;
+    }
+    return 0;
+  }
+
+  void reset() { head_ = tail_ = 0; }
+  size_t pending() const { return tail_ - head_; }
+  uint32_t resync_bytes() const { return resync_bytes_; }
+
+ protected:
+  uint8_t buf_[N];
+  size_t head_{0};
+  size_t tail_{0};
+  uint32_t resync_bytes_{0};  // Bytes discarded while resynchronising
+};
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
@@ -0,0 +1,274 @@
+#pragma once
+
+/**
+ * SunSpec model descriptors and the register map layout they produce
+ *
+ * Each model is a struct of constexpr point offsets (relative to the model's
+ * data, after the ID/L header), its length, the scale factors the proxy
+ * serves and the span clients may write. SunSpecLayout chains the models
+ * after the "SunS" marker and works out every header offset, the map size
+ * and the writable mask at compile time, so the served layout can't drift
+ * from the code that fills it.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+// A scale-factor point and the fixed exponent served in it
+struct ScaleFactor {
+  uint16_t offset;
+  int8_t value;
+};
+
+// Multiplier that encodes a real-world value for a point with scale factor sf
+constexpr float sf_multiplier(int8_t sf) {
+  float m = 1.0f;
+  for (int8_t i = sf; i < 0; i++) m *= 10.0f;
+  for (int8_t i = sf; i > 0; i--) m /= 10.0f;
+  return m;
+}
+
+constexpr int64_t pow10_int(int n) { return n <= 0 ? 1 : 10 * pow10_int(n - 1); }
+
+// Re-express a fixed-point value (value × 10^FROM, e.g. FROM = -1 for the
+// DTU's 0.1 V) at exponent TO, the point's scale factor. Rounds half away
+// from zero; no floating point on the poll path.
+template<int FROM, int TO> constexpr int64_t sf_rescale(int64_t v) {
+  return FROM >= TO ? v * pow10_int(FROM - TO)
+                    : (v >= 0 ? (v + pow10_int(TO - FROM) / 2) / pow10_int(TO - FROM)
+                              : -((-v + pow10_int(TO - FROM) / 2) / pow10_int(TO - FROM)));
+}
+
+// Saturating register encodings; 0xFFFF (uint16) and 0x8000 (int16) are the
+// SunSpec "not implemented" values, so the clamp stops one short of them
+constexpr uint16_t sunspec_uint16(int64_t v) { return v < 0 ? 0 : (v > 0xFFFE ? 0xFFFE : (uint16_t) v); }
+constexpr uint16_t sunspec_int16(int64_t v) {
+  return (uint16_t) (int16_t) (v < -32767 ? -32767 : (v > 32767 ? 32767 : v));
+}
+
+static_assert(sf_rescale<-1, 0>(13064) == 1306 && sf_rescale<-1, 0>(13065) == 1307, "sf_rescale rounding");
+static_assert(sf_rescale<-1, -2>(2305) == 23050, "sf_rescale widening");
+
+// Model 1: Common
+struct SunSpecCommon {
+  static constexpr uint16_t ID = 1;
+  static constexpr uint16_t LENGTH = 66;
+  static constexpr uint16_t Mn = 0;   // Manufacturer (string, 16 regs)
+  static constexpr uint16_t Md = 16;  // Model (string, 16 regs)
+  static constexpr uint16_t Opt = 32; // Options (string, 8 regs)
+  static constexpr uint16_t Vr = 40;  // Version (string, 8 regs)
+  static constexpr uint16_t SN = 48;  // Serial number (string, 16 regs)
+  static constexpr uint16_t DA = 64;  // Device address
+  static constexpr uint16_t Pad = 65;
+  static constexpr uint16_t WRITABLE_FIRST = 0;
+  static constexpr uint16_t WRITABLE_COUNT = 0;
+};
+
+// Model 101/103: Inverter (integer + scale factor). The single- and
+// three-phase models share this layout.
+struct SunSpecInverter {
+  static constexpr uint16_t ID = 103;
+  static constexpr uint16_t ID_SINGLE_PHASE = 101;
+  static constexpr uint16_t LENGTH = 50;
+  static constexpr uint16_t A = 0;        // AC Total Current
+  static constexpr uint16_t AphA = 1;     // Phase A current
+  static constexpr uint16_t AphB = 2;     // Phase B current
+  static constexpr uint16_t AphC = 3;     // Phase C current
+  static constexpr uint16_t A_SF = 4;     // Current scale factor
+  static constexpr uint16_t PPVphAB = 5;  // Phase AB voltage
+  static constexpr uint16_t PPVphBC = 6;  // Phase BC voltage
+  static constexpr uint16_t PPVphCA = 7;  // Phase CA voltage
+  static constexpr uint16_t PhVphA = 8;   // Phase A voltage
+  static constexpr uint16_t PhVphB = 9;   // Phase B voltage
+  static constexpr uint16_t PhVphC = 10;  // Phase C voltage
+  static constexpr uint16_t V_SF = 11;    // Voltage scale factor
+  static constexpr uint16_t W = 12;       // AC Power
+  static constexpr uint16_t W_SF = 13;    // Power scale factor
+  static constexpr uint16_t Hz = 14;      // Frequency
+  static constexpr uint16_t Hz_SF = 15;   // Frequency scale factor
+  static constexpr uint16_t VA = 16;      // Apparent power
+  static constexpr uint16_t VA_SF = 17;   // Apparent power SF
+  static constexpr uint16_t VAr = 18;     // Reactive power
+  static constexpr uint16_t VAr_SF = 19;  // Reactive power SF
+  static constexpr uint16_t PF = 20;      // Power factor
+  static constexpr uint16_t PF_SF = 21;   // Power factor SF
+  static constexpr uint16_t WH = 22;      // Lifetime energy (acc32, 2 regs)
+  static constexpr uint16_t WH_SF = 24;   // Energy SF
+  static constexpr uint16_t DCA = 25;     // DC current
+  static constexpr uint16_t DCA_SF = 26;  // DC current SF
+  static constexpr uint16_t DCV = 27;     // DC voltage
+  static constexpr uint16_t DCV_SF = 28;  // DC voltage SF
+  static constexpr uint16_t DCW = 29;     // DC power
+  static constexpr uint16_t DCW_SF = 30;  // DC power SF
+  static constexpr uint16_t TmpCab = 31;  // Cabinet temp
+  static constexpr uint16_t TmpSnk = 32;  // Heatsink temp
+  static constexpr uint16_t TmpTrns = 33; // Transformer temp
+  static constexpr uint16_t TmpOt = 34;   // Other temp
+  static constexpr uint16_t Tmp_SF = 35;  // Temperature SF
+  static constexpr uint16_t St = 36;      // Operating state
+  static constexpr uint16_t StVnd = 37;   // Vendor state
+  static constexpr uint16_t Evt1 = 38;    // Event bitfield 1 (32-bit)
+  static constexpr uint16_t Evt2 = 40;    // Event bitfield 2 (32-bit)
+  static constexpr uint16_t EvtVnd1 = 42; // Vendor event 1
+  static constexpr uint16_t EvtVnd2 = 44; // Vendor event 2
+  static constexpr uint16_t EvtVnd3 = 46; // Vendor event 3
+  static constexpr uint16_t EvtVnd4 = 48; // Vendor event 4
+
+  // St values the proxy serves, and its vendor states
+  static constexpr uint16_t ST_SLEEPING = 2, ST_MPPT = 4, ST_STANDBY = 8;
+  static constexpr uint16_t STVND_RESTORED = 1;  // Warm-start snapshot, no DTU data since boot
+  static constexpr uint16_t STVND_STALE = 2;     // Every source's data expired (see stale_timeout)
+
+  // Exponents of the served values
+  static constexpr int8_t SF_A = -2, SF_V = -1, SF_W = 0, SF_Hz = -2, SF_VA = 0, SF_VAr = 0, SF_PF = -2,
+                          SF_WH = 0, SF_DCA = -2, SF_DCV = -1, SF_DCW = 0, SF_Tmp = -1;
+  static constexpr ScaleFactor SCALE_FACTORS[] = {
+      {A_SF, SF_A},     {V_SF, SF_V},     {W_SF, SF_W},     {Hz_SF, SF_Hz},   {VA_SF, SF_VA},   {VAr_SF, SF_VAr},
+      {PF_SF, SF_PF},   {WH_SF, SF_WH},   {DCA_SF, SF_DCA}, {DCV_SF, SF_DCV}, {DCW_SF, SF_DCW}, {Tmp_SF, SF_Tmp},
+  };
+  static constexpr uint16_t WRITABLE_FIRST = 0;
+  static constexpr uint16_t WRITABLE_COUNT = 0;
+};
+
+// Model 120: Nameplate Ratings
+struct SunSpecNameplate {
+  static constexpr uint16_t ID = 120;
+  static constexpr uint16_t LENGTH = 26;
+  static constexpr uint16_t DERTyp = 0;   // 4 = PV
+  static constexpr uint16_t WRtg = 1;
+  static constexpr uint16_t WRtg_SF = 2;
+  static constexpr uint16_t VARtg = 3;
+  static constexpr uint16_t VARtg_SF = 4;
+  static constexpr uint16_t ARtg = 10;
+  static constexpr uint16_t ARtg_SF = 11;
+  static constexpr int8_t SF_WRtg = 0, SF_VARtg = 0, SF_ARtg = -1;
+  static constexpr ScaleFactor SCALE_FACTORS[] = {{WRtg_SF, SF_WRtg}, {VARtg_SF, SF_VARtg}, {ARtg_SF, SF_ARtg}};
+  static constexpr uint16_t WRITABLE_FIRST = 0;
+  static constexpr uint16_t WRITABLE_COUNT = 0;
+};
+
+// Model 123: Immediate Controls. The whole block accepts writes; the points
+// below are the ones the proxy acts on.
+struct SunSpecControls {
+  static constexpr uint16_t ID = 123;
+  static constexpr uint16_t LENGTH = 24;
+  static constexpr uint16_t Conn = 2;           // 1 = connected
+  static constexpr uint16_t WMaxLimPct_SF = 3;
+  static constexpr uint16_t WMaxLimPct = 5;     // Power limit, % of WRtg
+  static constexpr uint16_t WMaxLim_Ena = 8;    // 1 = limit enabled
+  static constexpr int8_t SF_WMaxLimPct = -1;
+  static constexpr ScaleFactor SCALE_FACTORS[] = {{WMaxLimPct_SF, SF_WMaxLimPct}};
+  static constexpr uint16_t WRITABLE_FIRST = 0;
+  static constexpr uint16_t WRITABLE_COUNT = LENGTH;
+};
+
+// Model 160: Multiple MPPT Inverter Extension, one module per DTU channel
+template<uint16_t MODULES> struct SunSpecMppt {
+  static_assert(MODULES >= 1, "Model 160 needs at least one module");
+  static constexpr uint16_t ID = 160;
+  static constexpr uint16_t FIXED_LENGTH = 8;
+  static constexpr uint16_t MODULE_LENGTH = 20;
+  static constexpr uint16_t COUNT = MODULES;
+  static constexpr uint16_t LENGTH = FIXED_LENGTH + MODULES * MODULE_LENGTH;
+  static constexpr uint16_t DCA_SF = 0;
+  static constexpr uint16_t DCV_SF = 1;
+  static constexpr uint16_t DCW_SF = 2;
+  static constexpr uint16_t DCWH_SF = 3;
+  static constexpr uint16_t Evt = 4;            // Global events (bitfield32)
+  static constexpr uint16_t N = 6;              // Number of modules
+  static constexpr uint16_t TmsPer = 7;         // Timestamp period
+  // Points of a module, relative to module(m)
+  static constexpr uint16_t ModID = 0;          // Input ID
+  static constexpr uint16_t IDStr = 1;          // Input ID string (8 regs)
+  static constexpr uint16_t DCA = 9;
+  static constexpr uint16_t DCV = 10;
+  static constexpr uint16_t DCW = 11;
+  static constexpr uint16_t DCWH = 12;          // Lifetime energy (acc32, 2 regs)
+  static constexpr uint16_t Tms = 14;           // Timestamp (uint32)
+  static constexpr uint16_t Tmp = 16;           // Temperature, °C
+  static constexpr uint16_t DCSt = 17;          // Operating state
+  static constexpr uint16_t DCEvt = 18;         // Module events (bitfield32)
+  static constexpr uint16_t DCSt_OFF = 1, DCSt_SLEEPING = 2, DCSt_MPPT = 4;
+
+  static constexpr uint16_t module(uint16_t m) { return FIXED_LENGTH + m * MODULE_LENGTH; }
+
+  static constexpr int8_t SF_DCA = -2, SF_DCV = -1, SF_DCW = 0, SF_DCWH = 0;
+  static constexpr ScaleFactor SCALE_FACTORS[] = {
+      {DCA_SF, SF_DCA}, {DCV_SF, SF_DCV}, {DCW_SF, SF_DCW}, {DCWH_SF, SF_DCWH}};
+  static constexpr uint16_t WRITABLE_FIRST = 0;
+  static constexpr uint16_t WRITABLE_COUNT = 0;
+};
+
+// Header offset of model i in a chain (registers from the "SunS" marker);
+// i == sizeof...(Models) gives the end marker
+template<typename... Models> constexpr uint16_t sunspec_header_offset(size_t i) {
+  const uint16_t lengths[] = {Models::LENGTH...};
+  uint16_t off = 2;
+  for (size_t k = 0; k < i && k < sizeof...(Models); k++) off += 2 + lengths[k];
+  return off;
+}
+
+template<typename M, typename... Models> constexpr size_t sunspec_model_index() {
+  const bool same[] = {std::is_same<M, Models>::value...};
+  for (size_t k = 0; k < sizeof...(Models); k++) {
+    if (same[k]) return k;
+  }
+  return sizeof...(Models);
+}
+
+// One bit per register
+template<uint16_t N> struct RegisterMask {
+  uint32_t bits[(N + 31) / 32];
+  constexpr bool test(uint16_t r) const { return r < N && ((bits[r / 32] >> (r % 32)) & 1); }
+  // True if all of [off, off + count) are set
+  constexpr bool test_range(uint16_t off, uint16_t count) const {
+    for (uint16_t r = off; r < off + count; r++) {
+      if (!test(r)) return false;
+    }
+    return count > 0;
+  }
+};
+
+template<typename... Models> struct SunSpecLayout {
+  static constexpr uint16_t END = sunspec_header_offset<Models...>(sizeof...(Models));
+  static constexpr uint16_t TOTAL = END + 2;  // End marker: 0xFFFF, 0
+
+  template<typename M> static constexpr uint16_t header() {
+    static_assert(sunspec_model_index<M, Models...>() < sizeof...(Models), "model not in this layout");
+    return sunspec_header_offset<Models...>(sunspec_model_index<M, Models...>());
+  }
+  template<typename M> static constexpr uint16_t data() { return header<M>() + 2; }
+
+  static constexpr RegisterMask<TOTAL> writable_mask() {
+    RegisterMask<TOTAL> mask{};
+    const uint16_t first[] = {Models::WRITABLE_FIRST...};
+    const uint16_t count[] = {Models::WRITABLE_COUNT...};
+    for (size_t k = 0; k < sizeof...(Models); k++) {
+      uint16_t base = sunspec_header_offset<Models...>(k) + 2 + first[k];
+      for (uint16_t r = base; r < base + count[k]; r++) mask.bits[r / 32] |= 1u << (r % 32);
+    }
+    return mask;
+  }
+};
+
+// Model 160 module count: one per DTU channel of the configured inverters,
+// set by the code generator
+#ifndef SUNSPEC_PROXY_MPPT_MODULES
+#define SUNSPEC_PROXY_MPPT_MODULES 8
+#endif
+
+using SunSpecMpptModel = SunSpecMppt<SUNSPEC_PROXY_MPPT_MODULES>;
+using SunSpecMap = SunSpecLayout<SunSpecCommon, SunSpecInverter, SunSpecNameplate, SunSpecControls, SunSpecMpptModel>;
+
+static constexpr RegisterMask<SunSpecMap::TOTAL> SUNSPEC_WRITABLE = SunSpecMap::writable_mask();
+
+// Clients (and the GX's saved settings) address the first models directly
+static_assert(SunSpecMap::header<SunSpecInverter>() == 70, "Model 101/103 must stay at 40070");
+static_assert(SunSpecMap::header<SunSpecControls>() == 150, "Model 123 must stay at 40150");
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
@@ -1,15 +1,28 @@
 #include "sunspec_proxy.h"
+#include "hoymiles_models.h"
 #include "esphome/core/log.h"
 #include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include <algorithm>
 #include <cerrno>
 #include <fcntl.h>
 #include <cmath>
 
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/tcpip.h>
+#endif
+
 namespace esphome {
 namespace sunspec_proxy {
 
 static const char *const TAG = "sunspec_proxy";
 
+using Inv = SunSpecInverter;
+using Ctl = SunSpecControls;
+using Mppt = SunSpecMpptModel;
+
 // Helper: write string into uint16 register array (SunSpec string encoding: big-endian char pairs)
 static void write_string_regs(uint16_t *regs, const char *str, int max_regs) {
   memset(regs, 0, max_regs * 2);
@@ -26,39 +39,63 @@ static void write_string_regs(uint16_t *regs, const char *str, int max_regs) {
 static uint16_t be16(const uint8_t *p) { return ((uint16_t)p[0] << 8) | p[1]; }
 static void put_be16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
 
-// Apply SunSpec scale factor to a raw int16 value
-static float apply_sf(int16_t raw, int16_t sf) {
-  if (raw == (int16_t)0x8000) return NAN; // not implemented
-  return (float)raw * powf(10.0f, (float)sf);
-}
-static float apply_sf_u16(uint16_t raw, int16_t sf) {
-  if (raw == 0xFFFF) return NAN; // not implemented
-  return (float)raw * powf(10.0f, (float)sf);
+// Integer square root, rounded to nearest
+static uint32_t isqrt32(uint32_t v) {
+  uint32_t root = 0;
+  for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+    if (v >= root + bit) {
+      v -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+  return v > root ? root + 1 : root;
 }
 
-// SunSpec operating state to human string
-static const char *sunspec_state_str(uint16_t st) {
-  switch (st) {
-    case 1: return "Off";
-    case 2: return "Sleeping";
-    case 3: return "Starting";
-    case 4: return "MPPT";
-    case 5: return "Throttled";
-    case 6: return "Shutting Down";
-    case 7: return "Fault";
-    case 8: return "Standby";
-    default: return "Unknown";
+// Parse a Hoymiles serial ("1520a025566b") into the 48-bit key the DTU
+// reports in its SN registers. Returns 0 if it isn't 1-12 hex digits.
+static uint64_t parse_sn_key(const char *sn) {
+  uint64_t key = 0;
+  int digits = 0;
+  for (; *sn; sn++, digits++) {
+    char c = *sn;
+    int v;
+    if (c >= '0' && c <= '9') v = c - '0';
+    else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+    else return 0;
+    if (digits >= 12) return 0;
+    key = (key << 4) | v;
   }
+  return key;
+}
+
+// Zero what flows (current, power) in a Model 103 block served without
+// live data; voltages, energy and temperature keep their last values
+static void clear_flow_registers(uint16_t *inv) {
+  for (uint16_t p : {Inv::A, Inv::AphA, Inv::AphB, Inv::AphC, Inv::W, Inv::VA, Inv::VAr, Inv::DCA, Inv::DCW}) inv[p] = 0;
 }
 
 // ============================================================
 // Configuration
 // ============================================================
 
+void SunSpecProxy::add_dtu(const std::string &host, uint16_t port, uint8_t address, uint16_t channels) {
+  if (num_dtus_ >= MAX_DTU_LINKS) return;
+  auto &l = dtu_links_[num_dtus_];
+  l.host = host;
+  l.port = port;
+  l.address = address;
+  l.index = num_dtus_;
+  l.channels_override = channels > HM_MAX_CHANNELS ? HM_MAX_CHANNELS : channels;
+  num_dtus_++;
+}
+
 void SunSpecProxy::add_rtu_source(uint8_t port_number, uint8_t phases, uint16_t rated_power_w,
                                    uint8_t connected_phase, uint8_t mppt_inputs,
-                                   const std::string &name, const std::string &model,
-                                   const std::string &serial) {
+                                   const char *name, const char *model,
+                                   const char *serial, uint8_t dtu_index) {
   if (num_sources_ >= MAX_RTU_SOURCES) return;
   auto &s = sources_[num_sources_];
   memset(&s, 0, sizeof(RtuSource));
@@ -67,9 +104,12 @@ void SunSpecProxy::add_rtu_source(uint8_t port_number, uint8_t phases, uint16_t
   s.connected_phase = (phases == 1) ? connected_phase : 0; // 0 = all phases (3-phase)
   s.rated_power_w = rated_power_w;
   s.mppt_inputs = mppt_inputs;
-  strncpy(s.name, name.c_str(), 31); s.name[31] = 0;
-  strncpy(s.model, model.c_str(), 23); s.model[23] = 0;
-  strncpy(s.serial_number, serial.c_str(), 32); s.serial_number[32] = 0;
+  // Code generator literals: kept as pointers, not copied into RAM
+  s.name = name;
+  s.model = model;
+  s.serial_number = serial;
+  s.sn_key = parse_sn_key(s.serial_number);
+  s.dtu = dtu_index;
   s.data_valid = false;
   s.mppt_count = 0;
   for (int m = 0; m < MAX_MPPT_PER_INVERTER; m++) {
@@ -83,8 +123,9 @@ void SunSpecProxy::add_rtu_source(uint8_t port_number, uint8_t phases, uint16_t
     ESP_LOGI(TAG, "Added RTU source #%d: '%s' (%s) port=%d, 3-phase, %dW, %d MPPT",
              num_sources_ - 1, s.name, s.model, port_number, rated_power_w, mppt_inputs);
   }
-  if (serial.length() > 0) {
+  if (serial[0] != 0) {
     ESP_LOGI(TAG, "  Serial: %s", s.serial_number);
+    if (s.sn_key == 0) ESP_LOGW(TAG, "  Serial '%s' is not a 12-digit hex SN, it will never match", s.serial_number);
   }
 }
 
@@ -95,7 +136,10 @@ void SunSpecProxy::add_rtu_source(uint8_t port_number, uint8_t phases, uint16_t
 void SunSpecProxy::setup() {
   ESP_LOGI(TAG, "============================================");
   ESP_LOGI(TAG, "  SunSpec Proxy v2.0 — Hoymiles TCP Mode");
-  ESP_LOGI(TAG, "  DTU: %s:%d (unit_id=%d)", dtu_host_.c_str(), dtu_port_, dtu_address_);
+  for (int d = 0; d < num_dtus_; d++) {
+    ESP_LOGI(TAG, "  DTU%d: %s:%d (unit_id=%d)", d, dtu_links_[d].host.c_str(), dtu_links_[d].port,
+             dtu_links_[d].address);
+  }
   ESP_LOGI(TAG, "  Serving as unit_id %d on TCP :%d",
            agg_config_.unit_id, tcp_port_);
   ESP_LOGI(TAG, "  Manufacturer: %s", agg_config_.manufacturer);
@@ -103,7 +147,6 @@ void SunSpecProxy::setup() {
   ESP_LOGI(TAG, "  Serial: %s", agg_config_.serial_number);
   ESP_LOGI(TAG, "============================================");
 
-  for (int i = 0; i < MAX_TCP_CLIENTS; i++) client_fds_[i] = -1;
 
   // Compute aggregated rated power/current from sources
   agg_config_.rated_power_w = 0;
@@ -113,117 +156,169 @@ void SunSpecProxy::setup() {
     if (agg_config_.rated_voltage_v > 0) {
       agg_config_.rated_current_a += (float)sources_[i].rated_power_w / agg_config_.rated_voltage_v;
     }
-    ESP_LOGI(TAG, "  Source #%d: '%s' port=%d, %dW",
-             i, sources_[i].name, sources_[i].port_number, sources_[i].rated_power_w);
+    if (sources_[i].dtu >= num_dtus_) {
+      ESP_LOGW(TAG, "  Source #%d: DTU%d is not configured, using DTU0", i, sources_[i].dtu);
+      sources_[i].dtu = 0;
+    }
+    dtu_links_[sources_[i].dtu].num_sources++;
+    ESP_LOGI(TAG, "  Source #%d: '%s' DTU%d port=%d, %dW",
+             i, sources_[i].name, sources_[i].dtu, sources_[i].port_number, sources_[i].rated_power_w);
   }
   ESP_LOGI(TAG, "  Total rated: %dW, %.1fA @ %dV",
            agg_config_.rated_power_w, agg_config_.rated_current_a, agg_config_.rated_voltage_v);
 
   build_static_registers_();
+  if (warm_start_interval_ms_ > 0) restore_warm_start_();
+  build_sn_index_();
+  for (int d = 0; d < num_dtus_; d++) {
+    build_dtu_read_plan_(dtu_links_[d]);
+    build_dtu_status_plan_(dtu_links_[d]);
+    setup_dtu_address_(dtu_links_[d]);
+  }
+  if (history_config_[0].interval_s > 0) setup_history_();
+  if (gateway_unit_id_ != 0) {
+    for (int d = 0; d < num_dtus_; d++) dtu_links_[d].gateway = new GatewayRange[GATEWAY_RANGES];
+    ESP_LOGI(TAG, "Gateway: DTU registers on unit_id %d-%d, max age %lums", gateway_unit_id_,
+             gateway_unit_id_ + num_dtus_ - 1, (unsigned long) gateway_max_age_ms_);
+  }
+  build_sensor_bindings_();
   setup_tcp_server_();
+  if (metrics_port_ > 0) setup_metrics_server_();
+
+#ifdef USE_ESP32
+  if (dtu_task_core_ >= 0 && !start_dtu_task_()) {
+    ESP_LOGW(TAG, "DTU: Could not start polling task, polling from loop()");
+  }
+#endif
 }
 
 void SunSpecProxy::loop() {
+  uint32_t loop_start_us = micros();
+  if (gateway_unit_id_ != 0) answer_gateway_reads_(millis());
   handle_tcp_clients_();
-  poll_dtu_data_();
+  if (dtu_task_running_) {
+    consume_dtu_snapshot_();
+  } else {
+    poll_dtu_data_();
+  }
 
-  // Periodic sensor publishing
+  // Numeric sensors: publish-on-change, spread over loop iterations
   uint32_t now = millis();
+  run_sensor_publisher_(now);
+
+  // Online/status sensors are cheap and time-based
   if (now - last_sensor_publish_ms_ >= SENSOR_PUBLISH_INTERVAL_MS) {
     last_sensor_publish_ms_ = now;
-    for (int i = 0; i < num_sources_; i++) {
-      publish_source_sensors_(i);
-      // Publish per-MPPT sensors if they exist
-      for (int m = 0; m < sources_[i].mppt_count; m++) {
-        publish_mppt_sensors_(i, m);
-      }
-    }
-    publish_aggregate_sensors_();
-    publish_tcp_sensors_();
+    publish_status_sensors_();
   }
+
+  if (warm_start_interval_ms_ > 0) save_warm_start_(now, false);
+
+  handle_metrics_clients_();
+  loop_time_.record_us(micros() - loop_start_us);
+}
+
+void SunSpecProxy::on_safe_shutdown() {
+  // OTA and API reboots: keep the energy up to the last poll
+  if (warm_start_interval_ms_ == 0) return;
+  save_warm_start_(millis(), true);
+  global_preferences->sync();
 }
 
 // ============================================================
 // Static Register Map Construction
 // ============================================================
 
+// Model header, data filled with the "not implemented" value and the model's
+// fixed scale factors
+template<typename M> static uint16_t *init_model(uint16_t *regs, uint16_t id, uint16_t fill) {
+  constexpr uint16_t off = SunSpecMap::header<M>();
+  regs[off] = id;
+  regs[off + 1] = M::LENGTH;
+  uint16_t *data = &regs[off + 2];
+  for (int i = 0; i < M::LENGTH; i++) data[i] = fill;
+  return data;
+}
+
+template<typename M> static void init_scale_factors(uint16_t *data) {
+  for (const auto &sf : M::SCALE_FACTORS) data[sf.offset] = (uint16_t)(int16_t) sf.value;
+}
+
 void SunSpecProxy::build_static_registers_() {
-  for (int i = 0; i < TOTAL_REGS; i++) register_map_[i] = 0xFFFF;
+  uint16_t *regs = images_[0].regs;
+  for (int i = 0; i < TOTAL_REGS; i++) regs[i] = 0xFFFF;
 
   // --- SunS header ---
-  register_map_[OFF_SUNS] = 0x5375;
-  register_map_[OFF_SUNS + 1] = 0x6e53;
+  regs[OFF_SUNS] = 0x5375;
+  regs[OFF_SUNS + 1] = 0x6e53;
 
   // --- Model 1: Common Block ---
-  register_map_[OFF_MODEL1] = 1;
-  register_map_[OFF_MODEL1 + 1] = MODEL_1_SIZE;
-
-  uint16_t *m1 = &register_map_[OFF_MODEL1 + 2];
-  for (int i = 0; i < MODEL_1_SIZE; i++) m1[i] = 0x0000;
-  write_string_regs(&m1[0], agg_config_.manufacturer, 16);
-  write_string_regs(&m1[16], agg_config_.model_name, 16);
-  write_string_regs(&m1[40], "1.1.0", 8);
-  write_string_regs(&m1[48], agg_config_.serial_number, 16);
-  m1[64] = agg_config_.unit_id;
-  m1[65] = 0x8000;
+  uint16_t *m1 = init_model<SunSpecCommon>(regs, SunSpecCommon::ID, 0x0000);
+  write_string_regs(&m1[SunSpecCommon::Mn], agg_config_.manufacturer, 16);
+  write_string_regs(&m1[SunSpecCommon::Md], agg_config_.model_name, 16);
+  write_string_regs(&m1[SunSpecCommon::Vr], "1.1.0", 8);
+  write_string_regs(&m1[SunSpecCommon::SN], agg_config_.serial_number, 16);
+  m1[SunSpecCommon::DA] = agg_config_.unit_id;
+  m1[SunSpecCommon::Pad] = 0x8000;
 
   // --- Model 101/103: Inverter ---
-  uint16_t model_id = (agg_config_.phases == 3) ? 103 : 101;
-  register_map_[OFF_INV] = model_id;
-  register_map_[OFF_INV + 1] = MODEL_103_SIZE;
-
-  uint16_t *inv = &register_map_[OFF_INV + 2];
-  for (int i = 0; i < MODEL_103_SIZE; i++) inv[i] = 0xFFFF;
-
-  inv[INV_A_SF]   = (uint16_t)(int16_t)-2;
-  inv[INV_V_SF]   = (uint16_t)(int16_t)-1;
-  inv[INV_W_SF]   = (uint16_t)(int16_t) 0;
-  inv[INV_Hz_SF]  = (uint16_t)(int16_t)-2;
-  inv[INV_VA_SF]  = (uint16_t)(int16_t) 0;
-  inv[INV_VAr_SF] = (uint16_t)(int16_t) 0;
-  inv[INV_PF_SF]  = (uint16_t)(int16_t)-2;
-  inv[INV_WH_SF]  = (uint16_t)(int16_t) 0;
-  inv[INV_DCA_SF] = (uint16_t)(int16_t)-2;
-  inv[INV_DCV_SF] = (uint16_t)(int16_t)-1;
-  inv[INV_DCW_SF] = (uint16_t)(int16_t) 0;
-  inv[INV_Tmp_SF] = (uint16_t)(int16_t)-1;
-
-  inv[INV_St] = 2; // OFF
-  inv[INV_Evt1] = 0; inv[INV_Evt1 + 1] = 0;
-  inv[INV_Evt2] = 0; inv[INV_Evt2 + 1] = 0;
-  inv[INV_EvtVnd1] = 0; inv[INV_EvtVnd1 + 1] = 0;
-  inv[INV_EvtVnd2] = 0; inv[INV_EvtVnd2 + 1] = 0;
-  inv[INV_EvtVnd3] = 0; inv[INV_EvtVnd3 + 1] = 0;
-  inv[INV_EvtVnd4] = 0; inv[INV_EvtVnd4 + 1] = 0;
+  uint16_t model_id = (agg_config_.phases == 3) ? Inv::ID : Inv::ID_SINGLE_PHASE;
+  uint16_t *inv = init_model<Inv>(regs, model_id, 0xFFFF);
+  init_scale_factors<Inv>(inv);
+
+  inv[Inv::St] = 2; // OFF
+  for (uint16_t evt : {Inv::Evt1, Inv::Evt2, Inv::EvtVnd1, Inv::EvtVnd2, Inv::EvtVnd3, Inv::EvtVnd4}) {
+    inv[evt] = 0;
+    inv[evt + 1] = 0;
+  }
 
   // --- Model 120: Nameplate Ratings ---
-  register_map_[OFF_M120] = 120;
-  register_map_[OFF_M120 + 1] = MODEL_120_SIZE;
-  uint16_t *m120 = &register_map_[OFF_M120 + 2];
-  for (int i = 0; i < MODEL_120_SIZE; i++) m120[i] = 0xFFFF;
-  m120[0] = 4;
-  m120[1] = agg_config_.rated_power_w;
-  m120[2] = 0;
-  m120[3] = agg_config_.rated_power_w;
-  m120[4] = 0;
-  m120[10] = (uint16_t)(agg_config_.rated_current_a * 10);
-  m120[11] = (uint16_t)(int16_t)-1;
+  uint16_t *m120 = init_model<SunSpecNameplate>(regs, SunSpecNameplate::ID, 0xFFFF);
+  init_scale_factors<SunSpecNameplate>(m120);
+  m120[SunSpecNameplate::DERTyp] = 4;
+  m120[SunSpecNameplate::WRtg] = agg_config_.rated_power_w;
+  m120[SunSpecNameplate::VARtg] = agg_config_.rated_power_w;
+  m120[SunSpecNameplate::ARtg] =
+      (uint16_t)(agg_config_.rated_current_a * sf_multiplier(SunSpecNameplate::SF_ARtg));
 
   // --- Model 123: Immediate Controls ---
-  register_map_[OFF_M123] = 123;
-  register_map_[OFF_M123 + 1] = MODEL_123_SIZE;
-  uint16_t *m123 = &register_map_[OFF_M123 + 2];
-  for (int i = 0; i < MODEL_123_SIZE; i++) m123[i] = 0xFFFF;
-  m123[2] = 1;                          // Conn = connected
-  m123[3] = (uint16_t)(int16_t)-1;      // WMaxLimPct_SF
-  m123[5] = 1000;                       // WMaxLimPct = 100.0%
-  m123[8] = 0;                          // WMaxLim_Ena = disabled
+  uint16_t *m123 = init_model<Ctl>(regs, Ctl::ID, 0xFFFF);
+  init_scale_factors<Ctl>(m123);
+  m123[Ctl::Conn] = 1;                  // Connected
+  m123[Ctl::WMaxLimPct] = 1000;         // 100.0%
+  m123[Ctl::WMaxLim_Ena] = 0;           // Disabled
+
+  // --- Model 160: Multiple MPPT, one module per DTU channel ---
+  uint16_t *m160 = init_model<Mppt>(regs, Mppt::ID, 0xFFFF);
+  init_scale_factors<Mppt>(m160);
+  m160[Mppt::Evt] = 0;
+  m160[Mppt::Evt + 1] = 0;
+  uint16_t modules = 0;
+  for (int i = 0; i < num_sources_; i++) {
+    for (int m = 0; m < sources_[i].mppt_inputs && modules < Mppt::COUNT; m++, modules++) {
+      uint16_t *mod = &m160[Mppt::module(modules)];
+      char id[17];
+      snprintf(id, sizeof(id), "%s PV%d", sources_[i].name, m + 1);
+      mod[Mppt::ModID] = modules + 1;
+      write_string_regs(&mod[Mppt::IDStr], id, 8);
+      mod[Mppt::DCEvt] = 0;
+      mod[Mppt::DCEvt + 1] = 0;
+    }
+  }
+  m160[Mppt::N] = modules;
 
   // --- End marker ---
-  register_map_[OFF_END] = 0xFFFF;
-  register_map_[OFF_END + 1] = 0;
+  regs[OFF_END] = 0xFFFF;
+  regs[OFF_END + 1] = 0;
 
-  ESP_LOGI(TAG, "Register map built: %d registers, Model %d", TOTAL_REGS, model_id);
+  sync_wire_range_(images_[0], 0, TOTAL_REGS);
+  images_[1] = images_[0];
+  memcpy(dtu_result_.inv_block, inv, sizeof(dtu_result_.inv_block));
+  memcpy(dtu_result_.mppt_block, m160, sizeof(dtu_result_.mppt_block));
+  active_image_.store(0, std::memory_order_release);
+
+  ESP_LOGI(TAG, "Register map built: %d registers, Model %d, Model 160 with %d/%d modules", TOTAL_REGS, model_id,
+           modules, Mppt::COUNT);
 }
 
 // ============================================================
@@ -231,262 +326,615 @@ void SunSpecProxy::build_static_registers_() {
 // ============================================================
 
 void SunSpecProxy::aggregate_and_update_registers_() {
-  uint16_t *inv = &register_map_[OFF_INV + 2];
+  // Build the next inverter block in the staging result; publish_dtu_result_()
+  // hands it to the main loop, which swaps it into the register image
+  DtuPollResult &r = dtu_result_;
+  uint16_t *inv = r.inv_block;
+  r.dirty_sources = dirty_sources_;
+  dirty_sources_.reset();
+  if (r.dirty_sources.none()) {
+    // No inverter changed: the blocks still stand, only the poll times
+    // (and, in task mode, the sources) go out
+    publish_dtu_result_();
+    return;
+  }
 
-  // Per-phase accumulators (real-world units)
-  float phase_power[3] = {0, 0, 0};       // W per phase
-  float phase_current[3] = {0, 0, 0};     // A per phase
-  float phase_voltage_sum[3] = {0, 0, 0}; // V sum for averaging
+  // Per-phase accumulators, in the DTU's fixed-point units
+  uint32_t phase_power_dw[3] = {0, 0, 0};
+  uint32_t phase_current_ca[3] = {0, 0, 0};
+  uint32_t phase_voltage_sum_dv[3] = {0, 0, 0};
   int phase_voltage_count[3] = {0, 0, 0};
 
-  float total_power = 0, total_current = 0;
-  float sum_freq = 0, total_va = 0, total_var = 0;
-  uint32_t total_energy_wh = 0;
-  float max_temp = NAN;
-  float total_dc_power = 0;
+  uint32_t total_power_dw = 0, total_current_ca = 0;
+  uint32_t sum_freq_chz = 0;
+  int32_t total_va = 0, total_var = 0;
+  uint64_t total_energy_wh = 0;
+  int16_t max_temp_dc = TEMP_UNKNOWN;
+  uint32_t total_dc_power_dw = 0;
   int valid_count = 0;
   bool any_producing = false;
 
-  // FIXED: Use decoded float values from sources instead of reading raw_regs as SunSpec
   for (int i = 0; i < num_sources_; i++) {
-    auto &s = sources_[i];
+    auto &s = dtu_src_[i];
+    // Lifetime energy counts for inverters missing from this round too:
+    // their last total still stands
+    total_energy_wh += s.energy_wh;
     if (!s.data_valid) continue;
     valid_count++;
 
-    // Use the already-decoded values from the Hoymiles data
-    total_power += s.power_w;
-    total_current += s.current_a;
-    if (s.power_w > 0) any_producing = true;
-    sum_freq += s.frequency_hz;
-
-    // Total energy in Wh from kWh
-    total_energy_wh += (uint32_t)(s.energy_kwh * 1000.0f);
-
-    // Temperature
-    if (std::isnan(max_temp) || s.temperature_c > max_temp)
-      max_temp = s.temperature_c;
+    total_power_dw += s.power_dw;
+    total_current_ca += s.current_ca;
+    if (s.power_dw > 0) any_producing = true;
+    sum_freq_chz += s.frequency_chz;
+    if (s.temperature_dc > max_temp_dc) max_temp_dc = s.temperature_dc;
 
     // Phase distribution
     if (s.phases == 3) {
-      // 3-phase: distribute evenly (we only have total values from Hoymiles)
+      // 3-phase: distribute evenly (we only have total values from Hoymiles);
+      // the remainders go to L1/L2 so the phases still add up to the total
       for (int p = 0; p < 3; p++) {
-        phase_current[p] += s.current_a / 3.0f;
-        phase_voltage_sum[p] += s.voltage_v;
+        phase_power_dw[p] += (s.power_dw + 2 - p) / 3;
+        phase_current_ca[p] += (s.current_ca + 2 - p) / 3;
+        phase_voltage_sum_dv[p] += s.voltage_dv;
         phase_voltage_count[p]++;
       }
     } else {
       // Single-phase: add to connected_phase
       int ph = s.connected_phase - 1;  // 0-indexed (0=L1, 1=L2, 2=L3)
       if (ph < 0 || ph > 2) ph = 0;
-      phase_current[ph] += s.current_a;
-      phase_voltage_sum[ph] += s.voltage_v;
+      phase_power_dw[ph] += s.power_dw;
+      phase_current_ca[ph] += s.current_ca;
+      phase_voltage_sum_dv[ph] += s.voltage_dv;
       phase_voltage_count[ph]++;
     }
 
     // DC power (approximate from PV power)
-    total_dc_power += s.pv_power_w;
+    total_dc_power_dw += s.pv_power_dw;
 
-    s.producing = (s.power_w > 0);
-    update_source_status_(i);
+    s.producing = (s.power_dw > 0);
   }
 
+  // Never serve less than before, not even after an inverter was removed
+  // from the configuration (see restore_warm_start_())
+  if (total_energy_wh < energy_floor_wh_) total_energy_wh = energy_floor_wh_;
+  energy_floor_wh_ = total_energy_wh;
+
   if (valid_count == 0) {
-    inv[INV_St] = 2;
-    agg_power_w_ = 0; agg_current_a_ = 0; agg_voltage_v_ = 0; agg_frequency_hz_ = 0;
+    // All data stale or missing (see expire_stale_sources_())
+    clear_flow_registers(inv);
+    inv[Inv::St] = Inv::ST_STANDBY;
+    inv[Inv::StVnd] = Inv::STVND_STALE;
+    r.agg_power_dw = 0; r.agg_current_ca = 0; r.agg_voltage_dv = 0; r.agg_frequency_chz = 0;
+    build_mppt_block_();
+    publish_dtu_result_();
     ESP_LOGW(TAG, "Aggregation: no valid sources");
     return;
   }
 
   // Compute averaged voltages per phase
-  float avg_v[3];
+  uint32_t avg_dv[3];
   for (int p = 0; p < 3; p++) {
-    avg_v[p] = phase_voltage_count[p] > 0 ? phase_voltage_sum[p] / phase_voltage_count[p] : 0;
+    int n = phase_voltage_count[p];
+    avg_dv[p] = n > 0 ? (phase_voltage_sum_dv[p] + n / 2) / n : 0;
   }
-
-  // Store aggregate decoded values
-  agg_power_w_ = total_power;
-  agg_current_a_ = total_current;
-  agg_voltage_v_ = avg_v[0]; // report L1 as primary
-  agg_frequency_hz_ = sum_freq / valid_count;
-  agg_energy_kwh_ = (float)total_energy_wh / 1000.0f;
-
-  // Write to register map
-  // Our SFs: A=-2, V=-1, W=0, Hz=-2, VA=0, VAr=0, PF=-2, WH=0, Tmp=-1
-
-  // Total AC power
-  inv[INV_W] = (uint16_t)(int16_t)(int)total_power;
-
-  // Total and per-phase current (SF=-2 → register = A * 100)
-  inv[INV_A]    = (uint16_t)(total_current * 100.0f);
-  inv[INV_AphA] = (uint16_t)(phase_current[0] * 100.0f);
-  inv[INV_AphB] = (uint16_t)(phase_current[1] * 100.0f);
-  inv[INV_AphC] = (uint16_t)(phase_current[2] * 100.0f);
-
-  // Per-phase voltage (SF=-1 → register = V * 10)
-  inv[INV_PhVphA] = (uint16_t)(avg_v[0] * 10.0f);
-  inv[INV_PhVphB] = (uint16_t)(avg_v[1] * 10.0f);
-  inv[INV_PhVphC] = (uint16_t)(avg_v[2] * 10.0f);
-
-  // Line-to-line voltages (SF=-1)
+  uint32_t freq_chz = (sum_freq_chz + valid_count / 2) / valid_count;
+
+  // Store aggregate values
+  r.agg_power_dw = total_power_dw;
+  r.agg_current_ca = total_current_ca;
+  r.agg_voltage_dv = avg_dv[0]; // report L1 as primary
+  r.agg_frequency_chz = freq_chz;
+  r.agg_energy_wh = total_energy_wh;
+
+  // Write to register map, rescaled from the DTU's units (W and V ×10, A and
+  // Hz ×100, °C ×10) to the scale factors Model 103 serves
+  inv[Inv::W] = sunspec_int16(sf_rescale<-1, Inv::SF_W>(total_power_dw));
+
+  // Total and per-phase current
+  inv[Inv::A]    = sunspec_uint16(sf_rescale<-2, Inv::SF_A>(total_current_ca));
+  inv[Inv::AphA] = sunspec_uint16(sf_rescale<-2, Inv::SF_A>(phase_current_ca[0]));
+  inv[Inv::AphB] = sunspec_uint16(sf_rescale<-2, Inv::SF_A>(phase_current_ca[1]));
+  inv[Inv::AphC] = sunspec_uint16(sf_rescale<-2, Inv::SF_A>(phase_current_ca[2]));
+
+  // Per-phase voltage
+  inv[Inv::PhVphA] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(avg_dv[0]));
+  inv[Inv::PhVphB] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(avg_dv[1]));
+  inv[Inv::PhVphC] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(avg_dv[2]));
+
+  // Line-to-line voltages
   if (agg_config_.phases == 3) {
-    // Proper L-L from L-N: Vab = sqrt(Va² + Vb² - 2*Va*Vb*cos(120°))
-    // For balanced system: Vll ≈ Vln * sqrt(3)
-    // Use actual phase voltages for better accuracy
-    float vab = sqrtf(avg_v[0]*avg_v[0] + avg_v[1]*avg_v[1] + avg_v[0]*avg_v[1]); // cos(120°) = -0.5
-    float vbc = sqrtf(avg_v[1]*avg_v[1] + avg_v[2]*avg_v[2] + avg_v[1]*avg_v[2]);
-    float vca = sqrtf(avg_v[2]*avg_v[2] + avg_v[0]*avg_v[0] + avg_v[2]*avg_v[0]);
-    inv[INV_PPVphAB] = (uint16_t)(vab * 10.0f);
-    inv[INV_PPVphBC] = (uint16_t)(vbc * 10.0f);
-    inv[INV_PPVphCA] = (uint16_t)(vca * 10.0f);
+    // Proper L-L from L-N: Vab = sqrt(Va² + Vb² - 2*Va*Vb*cos(120°)), cos(120°) = -0.5
+    // (in 0.1 V the squares stay below 2^32 up to ~2.1 kV)
+    auto ll_dv = [](uint32_t a, uint32_t b) { return isqrt32(a * a + b * b + a * b); };
+    inv[Inv::PPVphAB] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(ll_dv(avg_dv[0], avg_dv[1])));
+    inv[Inv::PPVphBC] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(ll_dv(avg_dv[1], avg_dv[2])));
+    inv[Inv::PPVphCA] = sunspec_uint16(sf_rescale<-1, Inv::SF_V>(ll_dv(avg_dv[2], avg_dv[0])));
   }
 
-  // Frequency (SF=-2 → Hz * 100)
-  inv[INV_Hz] = (uint16_t)((sum_freq / valid_count) * 100.0f);
+  // Frequency
+  inv[Inv::Hz] = sunspec_uint16(sf_rescale<-2, Inv::SF_Hz>(freq_chz));
 
   // VA / VAr (SF=0)
-  inv[INV_VA] = (uint16_t)(int16_t)(int)total_va;
-  inv[INV_VAr] = (uint16_t)(int16_t)(int)total_var;
+  inv[Inv::VA] = sunspec_int16(total_va);
+  inv[Inv::VAr] = sunspec_int16(total_var);
 
-  // Power factor (SF=-2 → PF * 100)
+  // Power factor
   if (total_va > 0) {
-    float pf = total_power / total_va;
-    if (pf > 1.0f) pf = 1.0f;
-    inv[INV_PF] = (uint16_t)(int16_t)(int)(pf * 100.0f);
+    constexpr int64_t PF_UNITY = pow10_int(-Inv::SF_PF);
+    int64_t pf = sf_rescale<-1, Inv::SF_PF>(total_power_dw) / total_va;
+    inv[Inv::PF] = sunspec_int16(pf > PF_UNITY ? PF_UNITY : pf);
   }
 
-  // Energy (SF=0, acc32 Wh)
-  inv[INV_WH]     = (uint16_t)(total_energy_wh >> 16);
-  inv[INV_WH + 1] = (uint16_t)(total_energy_wh & 0xFFFF);
+  // Energy (SF=0, acc32 Wh; wraps like any SunSpec accumulator)
+  uint32_t wh = (uint32_t) sf_rescale<0, Inv::SF_WH>(total_energy_wh);
+  inv[Inv::WH]     = (uint16_t)(wh >> 16);
+  inv[Inv::WH + 1] = (uint16_t)(wh & 0xFFFF);
 
-  // Temperature (SF=-1 → °C * 10)
-  if (!std::isnan(max_temp)) {
-    inv[INV_TmpCab] = (uint16_t)(int16_t)(int)(max_temp * 10.0f);
+  // Temperature
+  if (max_temp_dc != TEMP_UNKNOWN) {
+    inv[Inv::TmpCab] = sunspec_int16(sf_rescale<-1, Inv::SF_Tmp>(max_temp_dc));
   }
 
   // DC power (SF=0)
-  if (total_dc_power > 0) {
-    inv[INV_DCW] = (uint16_t)(int16_t)(int)total_dc_power;
+  if (total_dc_power_dw > 0) {
+    inv[Inv::DCW] = sunspec_int16(sf_rescale<-1, Inv::SF_DCW>(total_dc_power_dw));
   }
 
   // Operating state
-  inv[INV_St] = any_producing ? 4 : 2;
-
-  ESP_LOGI(TAG, "AGG: P=%.0fW (L1:%.0f L2:%.0f L3:%.0f) I=%.2fA V=%.1f/%.1f/%.1fV f=%.2fHz E=%.1fkWh [%d/%d, %s]",
-           total_power, phase_power[0], phase_power[1], phase_power[2],
-           total_current, avg_v[0], avg_v[1], avg_v[2],
-           sum_freq / valid_count,
-           (float)total_energy_wh / 1000.0f,
+  inv[Inv::St] = any_producing ? Inv::ST_MPPT : Inv::ST_SLEEPING;
+  inv[Inv::StVnd] = 0;
+
+  // Publish the new blocks to clients
+  build_mppt_block_();
+  publish_dtu_result_();
+
+  trace_.record(TraceEvent::AGGREGATE, valid_count, any_producing, total_power_dw, (uint32_t) total_energy_wh);
+  ESP_LOGV(TAG, "AGG: P=%.0fW (L1:%.0f L2:%.0f L3:%.0f) I=%.2fA V=%.1f/%.1f/%.1fV f=%.2fHz E=%.1fkWh [%d/%d, %s]",
+           total_power_dw / 10.0f, phase_power_dw[0] / 10.0f, phase_power_dw[1] / 10.0f, phase_power_dw[2] / 10.0f,
+           total_current_ca / 100.0f, avg_dv[0] / 10.0f, avg_dv[1] / 10.0f, avg_dv[2] / 10.0f,
+           freq_chz / 100.0f,
+           total_energy_wh / 1000.0,
            valid_count, num_sources_,
            any_producing ? "MPPT" : "Sleep");
 }
 
+void SunSpecProxy::build_mppt_block_() {
+  // Model 160 modules in the order build_static_registers_() assigned them;
+  // channels without data read as "not implemented". Only the modules of
+  // changed inverters are re-encoded.
+  uint16_t *m160 = dtu_result_.mppt_block;
+  uint16_t modules = 0;
+  for (int i = 0; i < num_sources_; i++) {
+    const auto &s = dtu_src_[i];
+    if (!dtu_result_.dirty_sources.test(i)) {
+      modules += s.mppt_inputs;
+      continue;
+    }
+    for (int m = 0; m < s.mppt_inputs && modules < Mppt::COUNT; m++, modules++) {
+      uint16_t *mod = &m160[Mppt::module(modules)];
+      const MpptData &d = s.mppt[m];
+      if (!s.data_valid || !d.data_valid) {
+        for (uint16_t p : {Mppt::DCA, Mppt::DCV, Mppt::DCW, Mppt::Tmp, Mppt::DCSt}) mod[p] = 0xFFFF;
+        continue;
+      }
+      mod[Mppt::DCA] = sunspec_uint16(sf_rescale<-2, Mppt::SF_DCA>(d.dc_current_ca));
+      mod[Mppt::DCV] = sunspec_uint16(sf_rescale<-1, Mppt::SF_DCV>(d.dc_voltage_dv));
+      mod[Mppt::DCW] = sunspec_uint16(sf_rescale<-1, Mppt::SF_DCW>(d.power_dw));
+      uint32_t wh = (uint32_t) sf_rescale<0, Mppt::SF_DCWH>(d.total_energy_wh);
+      mod[Mppt::DCWH] = (uint16_t)(wh >> 16);
+      mod[Mppt::DCWH + 1] = (uint16_t)(wh & 0xFFFF);
+      mod[Mppt::Tmp] = sunspec_int16(sf_rescale<-1, 0>(d.temperature_dc));
+      mod[Mppt::DCSt] = d.status == 3 ? Mppt::DCSt_MPPT : Mppt::DCSt_SLEEPING;
+    }
+  }
+}
+
+// ============================================================
+// Poll Result Hand-off
+// ============================================================
+
+void SunSpecProxy::publish_dtu_result_() {
+  if (!dtu_task_running_) {
+    apply_dtu_result_(dtu_result_);
+    for (int i = 0; i < num_sources_; i++) update_source_status_(i);
+    return;
+  }
+
+  // Task mode: never touch the register image or sensors from here. The whole
+  // poll output goes into the triple buffer; the main loop takes the newest.
+  DtuSnapshot &snap = dtu_snapshots_->write_slot();
+  snap.result = dtu_result_;
+  memcpy(snap.sources, dtu_src_, sizeof(snap.sources));
+  dtu_snapshots_->publish();
+}
+
+void SunSpecProxy::apply_dtu_result_(const DtuPollResult &r) {
+  // Build the next inverter and MPPT blocks in the back image; clients keep
+  // reading the front image until commit_register_update_() swaps them in
+  // one step. Without a change nothing is swapped, so the register
+  // generation only moves when a served value did.
+  const RegisterImage &front = front_image_();
+  if (r.dirty_sources.any() &&
+      (memcmp(&front.regs[SunSpecMap::data<Inv>()], r.inv_block, sizeof(r.inv_block)) != 0 ||
+       memcmp(&front.regs[SunSpecMap::data<Mppt>()], r.mppt_block, sizeof(r.mppt_block)) != 0)) {
+    RegisterImage &back = begin_register_update_();
+    memcpy(&back.regs[SunSpecMap::data<Inv>()], r.inv_block, sizeof(r.inv_block));
+    memcpy(&back.regs[SunSpecMap::data<Mppt>()], r.mppt_block, sizeof(r.mppt_block));
+    commit_register_update_();
+  }
+
+  agg_power_dw_ = r.agg_power_dw;
+  agg_current_ca_ = r.agg_current_ca;
+  agg_voltage_dv_ = r.agg_voltage_dv;
+  agg_frequency_chz_ = r.agg_frequency_chz;
+  agg_energy_wh_ = r.agg_energy_wh;
+
+  if (warm_start_stale_) {
+    warm_start_stale_ = false;
+    ESP_LOGI(TAG, "Warm start: live DTU data replaces the restored snapshot");
+  }
+}
+
+// ============================================================
+// Warm Start
+// ============================================================
+
+// Until the first poll completes (DNS, connect and a full read, often 10+ s
+// after Wi-Fi is up) clients would see an empty Model 103 with zero
+// lifetime energy, which makes VRM's counters jump. So the last state is
+// restored from flash and served as STANDBY, vendor state RESTORED, with
+// nothing flowing. The lifetime energy, per inverter and in total, becomes
+// a floor that live data can raise but never lower.
+void SunSpecProxy::restore_warm_start_() {
+  warm_start_pref_ = global_preferences->make_preference<WarmStart>(fnv1_hash("sunspec_proxy_warm_start"), true);
+  WarmStart ws;
+  if (!warm_start_pref_.load(&ws)) {
+    ESP_LOGI(TAG, "Warm start: no snapshot saved yet");
+    return;
+  }
+  warm_start_saved_ = ws;
+
+  // Per-inverter energy only for inverters that are still configured
+  int matched = 0;
+  for (int i = 0; i < num_sources_; i++) {
+    for (int j = 0; j < WARM_START_SOURCES; j++) {
+      if (ws.source_sn[j] != 0 && ws.source_sn[j] == sources_[i].sn_key) {
+        sources_[i].energy_wh = ws.source_energy_wh[j];
+        matched++;
+        break;
+      }
+    }
+  }
+  energy_floor_wh_ = ws.energy_wh;
+  agg_energy_wh_ = ws.energy_wh;
+  dtu_result_.agg_energy_wh = ws.energy_wh;
+
+  // The staging block gets the energy too, so a first poll without any
+  // inverter data doesn't serve 0 Wh either
+  uint32_t wh = (uint32_t) ws.energy_wh;
+  dtu_result_.inv_block[Inv::WH] = (uint16_t)(wh >> 16);
+  dtu_result_.inv_block[Inv::WH + 1] = (uint16_t)(wh & 0xFFFF);
+
+  uint16_t *inv = ws.inv_block;
+  clear_flow_registers(inv);
+  inv[Inv::St] = Inv::ST_STANDBY;
+  inv[Inv::StVnd] = Inv::STVND_RESTORED;
+
+  RegisterImage &back = begin_register_update_();
+  memcpy(&back.regs[SunSpecMap::data<Inv>()], inv, sizeof(ws.inv_block));
+  memcpy(&back.regs[SunSpecMap::data<Ctl>()], ws.controls, sizeof(ws.controls));
+  sync_wire_range_(back, SunSpecMap::data<Ctl>(), Ctl::LENGTH);
+  commit_register_update_();
+  warm_start_stale_ = true;
+
+  // The inverters keep the limit themselves; it is only restored so the GX
+  // reads back what it last wrote, and so polling stays fast while it holds
+  uint16_t pct = ws.controls[Ctl::WMaxLimPct];
+  bool ena = ws.controls[Ctl::WMaxLim_Ena] == 1;
+  limit_active_.store(ena && pct < 1000, std::memory_order_relaxed);
+
+  ESP_LOGI(TAG, "Warm start: restored E=%.1fkWh (%d/%d inverters), limit %.1f%% %s", ws.energy_wh / 1000.0,
+           matched, num_sources_, pct / 10.0f, ena ? "enabled" : "disabled");
+}
+
+// Throttled to one flash write per warm_start_interval_ms_, and skipped
+// when neither the energy nor the controls moved (no writes at night)
+void SunSpecProxy::save_warm_start_(uint32_t now, bool force) {
+  if (warm_start_stale_ || agg_energy_wh_ == 0) return;  // Nothing newer than what's saved
+  // The first save comes with the first live data after boot
+  if (!force && warm_start_saved_ms_ != 0 && now - warm_start_saved_ms_ < warm_start_interval_ms_) return;
+  warm_start_saved_ms_ = now;
+
+  WarmStart ws{};
+  const RegisterImage &img = front_image_();
+  memcpy(ws.inv_block, &img.regs[SunSpecMap::data<Inv>()], sizeof(ws.inv_block));
+  memcpy(ws.controls, &img.regs[SunSpecMap::data<Ctl>()], sizeof(ws.controls));
+  for (int i = 0; i < num_sources_; i++) {
+    ws.source_sn[i] = sources_[i].sn_key;
+    ws.source_energy_wh[i] = sources_[i].energy_wh;
+  }
+  ws.energy_wh = agg_energy_wh_;
+
+  const WarmStart &prev = warm_start_saved_;
+  if (ws.energy_wh == prev.energy_wh && memcmp(ws.controls, prev.controls, sizeof(ws.controls)) == 0 &&
+      memcmp(ws.source_sn, prev.source_sn, sizeof(ws.source_sn)) == 0 &&
+      memcmp(ws.source_energy_wh, prev.source_energy_wh, sizeof(ws.source_energy_wh)) == 0) {
+    return;
+  }
+  if (!warm_start_pref_.save(&ws)) {
+    ESP_LOGW(TAG, "Warm start: saving the snapshot failed");
+    return;
+  }
+  warm_start_saved_ = ws;
+  ESP_LOGD(TAG, "Warm start: saved E=%.1fkWh", ws.energy_wh / 1000.0);
+}
+
+void SunSpecProxy::consume_dtu_snapshot_() {
+  const DtuSnapshot *snap = dtu_snapshots_->take();
+  if (snap == nullptr) return;
+  memcpy(sources_, snap->sources, sizeof(sources_));
+  apply_dtu_result_(snap->result);
+  for (int i = 0; i < num_sources_; i++) update_source_status_(i);
+}
+
+#ifdef USE_ESP32
+bool SunSpecProxy::start_dtu_task_() {
+  // The task works on its own copy of the sources so the main loop can
+  // publish sensors from sources_ while a poll is being parsed
+  dtu_snapshots_ = new TripleBuffer<DtuSnapshot>();
+  dtu_src_ = new RtuSource[MAX_RTU_SOURCES];
+  memcpy(dtu_src_, sources_, sizeof(sources_));
+  dtu_task_running_ = true;
+
+  BaseType_t ok = xTaskCreatePinnedToCore(dtu_task_, "sunspec_dtu", DTU_TASK_STACK_SIZE, this,
+                                          tskIDLE_PRIORITY + 5, nullptr, dtu_task_core_);
+  if (ok != pdPASS) {
+    dtu_task_running_ = false;
+    delete[] dtu_src_;
+    dtu_src_ = sources_;
+    delete dtu_snapshots_;
+    dtu_snapshots_ = nullptr;
+    return false;
+  }
+  ESP_LOGI(TAG, "DTU: Polling task started on core %d", dtu_task_core_);
+  return true;
+}
+
+void SunSpecProxy::dtu_task_(void *arg) {
+  auto *self = static_cast<SunSpecProxy *>(arg);
+  while (true) {
+    self->poll_dtu_data_();
+    self->wait_dtu_io_(DTU_TASK_WAIT_MS);
+  }
+}
+
+void SunSpecProxy::wait_dtu_io_(uint32_t max_ms) {
+  // Sleep until a DTU socket has something for its link's current state,
+  // so responses are handled as they arrive instead of once per loop() pass
+  fd_set rfds, wfds;
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  int max_fd = -1;
+  for (int d = 0; d < num_dtus_; d++) {
+    const DtuLink &l = dtu_links_[d];
+    if (l.fd < 0) continue;
+    if (l.state == DtuState::TRANSFER || l.state == DtuState::AWAIT_COMMAND || l.state == DtuState::STATUS ||
+        l.state == DtuState::READBACK) {
+      FD_SET(l.fd, &rfds);
+    } else if (l.state == DtuState::CONNECTING) {
+      FD_SET(l.fd, &wfds);
+    } else {
+      continue;
+    }
+    if (l.fd > max_fd) max_fd = l.fd;
+  }
+  if (max_fd < 0) {
+    vTaskDelay(pdMS_TO_TICKS(max_ms));
+    return;
+  }
+  struct timeval tv = {0, (long)(max_ms * 1000)};
+  select(max_fd + 1, &rfds, &wfds, nullptr, &tv);
+}
+#endif
+
 // ============================================================
 // Sensor Publishing
 // ============================================================
 
 void SunSpecProxy::update_source_status_(int idx) {
   auto &s = sources_[idx];
-  if (!s.data_valid) return;
-
-  uint32_t age_s = (millis() - s.last_poll_ms) / 1000;
-  bool stale = age_s > (poll_interval_ms_ / 1000) * 3;
+  if (s.last_poll_ms == 0) return;  // Never had data
 
   if (src_status_sensors_[idx]) {
     char buf[64];
-    if (stale) {
-      snprintf(buf, sizeof(buf), "Stale (%lus)", age_s);
+    // Same rule as the aggregate and the online sensor: data the DTU side
+    // gave up on (see expire_stale_sources_())
+    if (!s.data_valid) {
+      snprintf(buf, sizeof(buf), "Stale (%lus)", (unsigned long)((millis() - s.last_poll_ms) / 1000));
+    } else if (s.alarm_code != 0) {
+      snprintf(buf, sizeof(buf), "%s, alarm %u", s.producing ? "Producing" : "Idle", s.alarm_code);
     } else if (s.producing) {
-      snprintf(buf, sizeof(buf), "Producing %.0fW", s.power_w);
+      snprintf(buf, sizeof(buf), "Producing %.0fW", s.power_dw / 10.0f);
     } else {
       snprintf(buf, sizeof(buf), "Idle");
     }
-    src_status_sensors_[idx]->publish_state(buf);
+    if (src_status_sensors_[idx]->state != buf) src_status_sensors_[idx]->publish_state(buf);
   }
 }
 
-void SunSpecProxy::publish_source_sensors_(int idx) {
-  auto &s = sources_[idx];
-
-  uint32_t age_s = s.data_valid ? (millis() - s.last_poll_ms) / 1000 : 999;
-  bool online = s.data_valid && age_s < (poll_interval_ms_ / 1000) * 3;
+void SunSpecProxy::add_sensor_binding_(sensor::Sensor *s, SensorField field, uint8_t cls,
+                                       uint8_t inv, uint8_t mppt) {
+  if (s == nullptr) return;
+  SensorBinding b{};
+  b.sensor = s;
+  b.field = field;
+  b.cls = cls;
+  b.inv = inv;
+  b.mppt = mppt;
+  b.last_value = NAN;
+  sensor_bindings_.push_back(b);
+}
 
-  // Core electrical sensors
-  if (src_power_sensors_[idx]) src_power_sensors_[idx]->publish_state(s.data_valid ? s.power_w : NAN);
-  if (src_voltage_sensors_[idx]) src_voltage_sensors_[idx]->publish_state(s.data_valid ? s.voltage_v : NAN);
-  if (src_current_sensors_[idx]) src_current_sensors_[idx]->publish_state(s.data_valid ? s.current_a : NAN);
-  if (src_energy_sensors_[idx]) src_energy_sensors_[idx]->publish_state(s.data_valid ? s.energy_kwh : NAN);
-  if (src_today_energy_sensors_[idx]) src_today_energy_sensors_[idx]->publish_state(s.data_valid ? s.today_energy_wh : NAN);
-  if (src_frequency_sensors_[idx]) src_frequency_sensors_[idx]->publish_state(s.data_valid ? s.frequency_hz : NAN);
-  if (src_temperature_sensors_[idx]) src_temperature_sensors_[idx]->publish_state(s.data_valid ? s.temperature_c : NAN);
+// Per-source and per-MPPT sensors were bound by their setters already
+void SunSpecProxy::build_sensor_bindings_() {
+  add_sensor_binding_(agg_power_sensor_, SensorField::AGG_POWER, SENSOR_CLASS_POWER);
+  add_sensor_binding_(agg_voltage_sensor_, SensorField::AGG_VOLTAGE, SENSOR_CLASS_VOLTAGE);
+  add_sensor_binding_(agg_current_sensor_, SensorField::AGG_CURRENT, SENSOR_CLASS_CURRENT);
+  add_sensor_binding_(agg_energy_sensor_, SensorField::AGG_ENERGY, SENSOR_CLASS_ENERGY);
+  add_sensor_binding_(agg_frequency_sensor_, SensorField::AGG_FREQUENCY, SENSOR_CLASS_FREQUENCY);
+
+  add_sensor_binding_(tcp_clients_sensor_, SensorField::TCP_CLIENTS, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(tcp_requests_sensor_, SensorField::TCP_REQUESTS, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(tcp_errors_sensor_, SensorField::TCP_ERRORS, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(power_limit_sensor_, SensorField::POWER_LIMIT, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(power_limit_latency_sensor_, SensorField::POWER_LIMIT_LATENCY, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(dtu_poll_ok_sensor_, SensorField::DTU_POLL_OK, SENSOR_CLASS_DIAGNOSTIC);
+  add_sensor_binding_(dtu_poll_fail_sensor_, SensorField::DTU_POLL_FAIL, SENSOR_CLASS_DIAGNOSTIC);
+
+  ESP_LOGI(TAG, "Sensor publisher: %d numeric sensors, %d per loop, heartbeat %lus",
+           (int)sensor_bindings_.size(), sensor_publish_slice_, (unsigned long)(sensor_heartbeat_ms_ / 1000));
+}
 
-  // DC (PV) side sensors
-  if (src_pv_voltage_sensors_[idx]) src_pv_voltage_sensors_[idx]->publish_state(s.data_valid ? s.pv_voltage_v : NAN);
-  if (src_pv_current_sensors_[idx]) src_pv_current_sensors_[idx]->publish_state(s.data_valid ? s.pv_current_a : NAN);
-  if (src_pv_power_sensors_[idx]) src_pv_power_sensors_[idx]->publish_state(s.data_valid ? s.pv_power_w : NAN);
+bool SunSpecProxy::sensor_value_(const SensorBinding &b, float *out) const {
+  const RtuSource &s = sources_[b.inv];
+  const MpptData &mp = s.mppt[b.mppt];
+  // Per-MPPT sensors keep their last value while the channel is missing
+  bool mppt_ok = b.mppt < s.mppt_count && mp.data_valid;
+  // Fixed-point values become floats here, at the sensor boundary
+  float v;
+  switch (b.field) {
+    case SensorField::SRC_POWER: v = s.data_valid ? s.power_dw / 10.0f : NAN; break;
+    case SensorField::SRC_VOLTAGE: v = s.data_valid ? s.voltage_dv / 10.0f : NAN; break;
+    case SensorField::SRC_CURRENT: v = s.data_valid ? s.current_ca / 100.0f : NAN; break;
+    case SensorField::SRC_ENERGY: v = s.data_valid ? (float) (s.energy_wh / 1000.0) : NAN; break;
+    case SensorField::SRC_TODAY_ENERGY: v = s.data_valid ? s.today_energy_wh : NAN; break;
+    case SensorField::SRC_FREQUENCY: v = s.data_valid ? s.frequency_chz / 100.0f : NAN; break;
+    case SensorField::SRC_TEMPERATURE: v = s.data_valid && s.temperature_dc != TEMP_UNKNOWN ? s.temperature_dc / 10.0f : NAN; break;
+    case SensorField::SRC_PV_VOLTAGE: v = s.data_valid ? s.pv_voltage_dv / 10.0f : NAN; break;
+    case SensorField::SRC_PV_CURRENT: v = s.data_valid ? s.pv_current_ca / 100.0f : NAN; break;
+    case SensorField::SRC_PV_POWER: v = s.data_valid ? s.pv_power_dw / 10.0f : NAN; break;
+    case SensorField::SRC_ALARM_CODE: v = s.data_valid ? s.alarm_code : 0; break;
+    case SensorField::SRC_ALARM_COUNT: v = s.data_valid ? s.alarm_count : 0; break;
+    case SensorField::SRC_LINK_STATUS: v = s.data_valid ? s.link_status : 0; break;
+    case SensorField::SRC_POLL_OK: v = s.poll_success_count; break;
+    case SensorField::SRC_POLL_FAIL: v = s.poll_fail_count; break;
+    case SensorField::MPPT_DC_VOLTAGE: if (!mppt_ok) return false; v = mp.dc_voltage_dv / 10.0f; break;
+    case SensorField::MPPT_DC_CURRENT: if (!mppt_ok) return false; v = mp.dc_current_ca / 100.0f; break;
+    case SensorField::MPPT_DC_POWER: if (!mppt_ok) return false; v = (uint32_t) mp.dc_voltage_dv * mp.dc_current_ca / 1000.0f; break;
+    case SensorField::MPPT_AC_VOLTAGE: if (!mppt_ok) return false; v = mp.ac_voltage_dv / 10.0f; break;
+    case SensorField::MPPT_FREQUENCY: if (!mppt_ok) return false; v = mp.frequency_chz / 100.0f; break;
+    case SensorField::MPPT_POWER: if (!mppt_ok) return false; v = mp.power_dw / 10.0f; break;
+    case SensorField::MPPT_TODAY_ENERGY: if (!mppt_ok) return false; v = mp.today_energy_wh; break;
+    case SensorField::MPPT_TOTAL_ENERGY: if (!mppt_ok) return false; v = mp.total_energy_wh / 1000.0f; break;
+    case SensorField::MPPT_TEMPERATURE: if (!mppt_ok) return false; v = mp.temperature_dc / 10.0f; break;
+    case SensorField::AGG_POWER: v = agg_power_dw_ / 10.0f; break;
+    case SensorField::AGG_VOLTAGE: v = agg_voltage_dv_ / 10.0f; break;
+    case SensorField::AGG_CURRENT: v = agg_current_ca_ / 100.0f; break;
+    case SensorField::AGG_ENERGY: v = (float) (agg_energy_wh_ / 1000.0); break;
+    case SensorField::AGG_FREQUENCY: v = agg_frequency_chz_ / 100.0f; break;
+    case SensorField::TCP_CLIENTS: {
+      int active = 0;
+      for (auto &c : clients_) {
+        if (c.fd >= 0) active++;
+      }
+      v = active;
+      break;
+    }
+    case SensorField::TCP_REQUESTS: v = tcp_request_count_; break;
+    case SensorField::TCP_ERRORS: v = tcp_error_count_; break;
+    case SensorField::POWER_LIMIT: {
+      const uint16_t *regs = front_image_().regs;
+      uint16_t pct = regs[SunSpecMap::data<Ctl>() + Ctl::WMaxLimPct];
+      uint16_t ena = regs[SunSpecMap::data<Ctl>() + Ctl::WMaxLim_Ena];
+      v = ena == 1 ? pct / 10.0f : 100.0f;
+      break;
+    }
+    case SensorField::POWER_LIMIT_LATENCY: {
+      uint32_t ms = limit_latency_ms_.load(std::memory_order_relaxed);
+      if (ms == 0) return false;  // No limit applied yet
+      v = ms;
+      break;
+    }
+    case SensorField::DTU_POLL_OK: v = dtu_poll_count_.load(); break;
+    case SensorField::DTU_POLL_FAIL: v = dtu_poll_fail_count_.load(); break;
+    default: return false;
+  }
+  *out = v;
+  return true;
+}
 
-  // Status and diagnostics
-  if (src_alarm_code_sensors_[idx]) src_alarm_code_sensors_[idx]->publish_state(s.data_valid ? s.alarm_code : 0);
-  if (src_alarm_count_sensors_[idx]) src_alarm_count_sensors_[idx]->publish_state(s.data_valid ? s.alarm_count : 0);
-  if (src_link_status_sensors_[idx]) src_link_status_sensors_[idx]->publish_state(s.data_valid ? s.link_status : 0);
+void SunSpecProxy::run_sensor_publisher_(uint32_t now) {
+  // A pass over all bindings starts when a new poll was applied or the
+  // publish interval elapsed, and is spread over several loop() iterations,
+  // sensor_publish_slice_ bindings at a time
+  size_t total = sensor_bindings_.size();
+  if (sensor_pass_pos_ >= total) {
+    uint32_t gen = get_register_generation();
+    if (gen == sensor_pass_gen_ && now - sensor_pass_start_ms_ < SENSOR_PUBLISH_INTERVAL_MS) return;
+    sensor_pass_gen_ = gen;
+    sensor_pass_start_ms_ = now;
+    sensor_pass_pos_ = 0;
+  }
 
-  // Statistics
-  if (src_poll_ok_sensors_[idx]) src_poll_ok_sensors_[idx]->publish_state(s.poll_success_count);
-  if (src_poll_fail_sensors_[idx]) src_poll_fail_sensors_[idx]->publish_state(s.poll_fail_count);
-  if (src_online_sensors_[idx]) src_online_sensors_[idx]->publish_state(online);
+  size_t end = sensor_pass_pos_ + sensor_publish_slice_;
+  if (end > total) end = total;
+  for (; sensor_pass_pos_ < end; sensor_pass_pos_++) {
+    SensorBinding &b = sensor_bindings_[sensor_pass_pos_];
+    float v;
+    if (!sensor_value_(b, &v)) continue;
+
+    bool publish;
+    if (!b.published) {
+      publish = true;
+    } else if (sensor_heartbeat_ms_ > 0 && now - b.last_publish_ms >= sensor_heartbeat_ms_) {
+      publish = true;
+    } else if (std::isnan(v) || std::isnan(b.last_value)) {
+      publish = std::isnan(v) != std::isnan(b.last_value);
+    } else {
+      const SensorDeadband &db = sensor_deadbands_[b.cls];
+      float delta = fabsf(v - b.last_value);
+      float thresh = fmaxf(db.absolute, db.relative * fabsf(b.last_value));
+      publish = delta > 0 && delta >= thresh;
+    }
+    if (!publish) continue;
 
-  update_source_status_(idx);
+    b.sensor->publish_state(v);
+    b.last_value = v;
+    b.last_publish_ms = now;
+    b.published = true;
+  }
 }
 
-void SunSpecProxy::publish_aggregate_sensors_() {
-  if (agg_power_sensor_) agg_power_sensor_->publish_state(agg_power_w_);
-  if (agg_voltage_sensor_) agg_voltage_sensor_->publish_state(agg_voltage_v_);
-  if (agg_current_sensor_) agg_current_sensor_->publish_state(agg_current_a_);
-  if (agg_energy_sensor_) agg_energy_sensor_->publish_state(agg_energy_kwh_);
-  if (agg_frequency_sensor_) agg_frequency_sensor_->publish_state(agg_frequency_hz_);
-}
+void SunSpecProxy::publish_status_sensors_() {
+  // Binary sensors dedupe on their own; text sensors are compared first
+  for (int i = 0; i < num_sources_; i++) {
+    auto &s = sources_[i];
+    if (src_online_sensors_[i]) src_online_sensors_[i]->publish_state(s.data_valid);
+    update_source_status_(i);
+  }
 
-void SunSpecProxy::publish_tcp_sensors_() {
-  // Count active TCP clients
   int active = 0;
-  for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-    if (client_fds_[i] >= 0) active++;
+  for (auto &c : clients_) {
+    if (c.fd >= 0) active++;
   }
-
   bool victron_active = active > 0 && (millis() - last_tcp_activity_ms_ < 30000);
-
-  if (tcp_clients_sensor_) tcp_clients_sensor_->publish_state(active);
-  if (tcp_requests_sensor_) tcp_requests_sensor_->publish_state(tcp_request_count_);
-  if (tcp_errors_sensor_) tcp_errors_sensor_->publish_state(tcp_error_count_);
   if (victron_connected_sensor_) victron_connected_sensor_->publish_state(victron_active);
 
   if (victron_status_sensor_) {
+    char buf[64];
     if (!victron_active && active == 0) {
-      victron_status_sensor_->publish_state("No connection");
+      snprintf(buf, sizeof(buf), "No connection");
     } else if (!victron_active) {
-      victron_status_sensor_->publish_state("Connected, idle");
+      snprintf(buf, sizeof(buf), "Connected, idle");
     } else {
-      char buf[64];
-      snprintf(buf, sizeof(buf), "Active (%lu reqs)", tcp_request_count_);
-      victron_status_sensor_->publish_state(buf);
+      snprintf(buf, sizeof(buf), "Active (%lu reqs)", (unsigned long) tcp_request_count_);
     }
+    if (victron_status_sensor_->state != buf) victron_status_sensor_->publish_state(buf);
   }
 
-  // Power limit
-  if (power_limit_sensor_) {
-    uint16_t pct = register_map_[OFF_M123 + 2 + 5]; // WMaxLimPct
-    uint16_t ena = register_map_[OFF_M123 + 2 + 8]; // WMaxLim_Ena
-    power_limit_sensor_->publish_state(ena == 1 ? pct / 10.0f : 100.0f);
-  }
-
-  // DTU diagnostics
-  if (dtu_poll_ok_sensor_) {
-    dtu_poll_ok_sensor_->publish_state(dtu_poll_count_);
-  }
-  if (dtu_poll_fail_sensor_) {
-    dtu_poll_fail_sensor_->publish_state(dtu_poll_fail_count_);
-  }
   if (dtu_online_sensor_) {
-    bool dtu_online = dtu_poll_count_ > 0 && (millis() - last_dtu_poll_ok_ms_) < 30000;
+    bool dtu_online = dtu_poll_count_.load() > 0 &&
+                      millis() - last_dtu_poll_ok_ms_.load() <= stale_limit_ms_.load(std::memory_order_relaxed);
     dtu_online_sensor_->publish_state(dtu_online);
   }
 }
@@ -515,56 +963,166 @@ void SunSpecProxy::setup_tcp_server_() {
     ESP_LOGE(TAG, "TCP bind port %d failed: errno=%d", tcp_port_, errno);
     close(server_fd_); server_fd_ = -1; return;
   }
-  if (listen(server_fd_, 4) < 0) {
+  clients_.resize(max_tcp_clients_);
+  if (listen(server_fd_, max_tcp_clients_) < 0) {
     ESP_LOGE(TAG, "TCP listen failed: errno=%d", errno);
     close(server_fd_); server_fd_ = -1; return;
   }
 
-  ESP_LOGI(TAG, "Modbus TCP listening on port %d (unit_id=%d)", tcp_port_, agg_config_.unit_id);
+  ESP_LOGI(TAG, "Modbus TCP listening on port %d (unit_id=%d, %d client slots)",
+           tcp_port_, agg_config_.unit_id, max_tcp_clients_);
 }
 
 void SunSpecProxy::handle_tcp_clients_() {
   if (server_fd_ < 0) return;
+  uint32_t now = millis();
 
-  struct sockaddr_in ca;
-  socklen_t al = sizeof(ca);
-  int nfd = accept(server_fd_, (struct sockaddr *)&ca, &al);
-  if (nfd >= 0) {
-    fcntl(nfd, F_SETFL, fcntl(nfd, F_GETFL, 0) | O_NONBLOCK);
-    bool placed = false;
-    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-      if (client_fds_[i] < 0) {
-        client_fds_[i] = nfd;
-        placed = true;
-        char ip[16];
-        inet_ntoa_r(ca.sin_addr, ip, sizeof(ip));
-        ESP_LOGI(TAG, "TCP: Client connected from %s (slot %d)", ip, i);
-        break;
+  // One readiness check for the listener and every open slot
+  fd_set rfds, wfds;
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  FD_SET(server_fd_, &rfds);
+  int max_fd = server_fd_;
+  for (auto &c : clients_) {
+    if (c.fd < 0) continue;
+    // Left out only while the buffer is full of requests not served yet
+    if (c.rx.write_space() > 0) FD_SET(c.fd, &rfds);
+    if (c.tx_len > 0) FD_SET(c.fd, &wfds);
+    if (c.fd > max_fd) max_fd = c.fd;
+  }
+  struct timeval tv = {0, 0};
+  int ready = select(max_fd + 1, &rfds, &wfds, nullptr, &tv);
+  if (ready < 0) {
+    ESP_LOGW(TAG, "TCP: Select error: errno=%d", errno);
+    return;
+  }
+
+  if (ready > 0 && FD_ISSET(server_fd_, &rfds)) accept_tcp_client_(now);
+
+  for (size_t i = 0; i < clients_.size(); i++) {
+    auto &c = clients_[i];
+    if (c.fd < 0) continue;
+
+    bool readable = ready > 0 && FD_ISSET(c.fd, &rfds);
+    bool writable = ready > 0 && FD_ISSET(c.fd, &wfds);
+    if (!readable && !writable) {
+      // Evict slots that have gone silent (e.g. a GX that rebooted without FIN)
+      if (tcp_idle_timeout_ms_ > 0 && now - c.last_activity_ms > tcp_idle_timeout_ms_) {
+        ESP_LOGI(TAG, "TCP: Client slot %u idle for %lus, closing", (unsigned) i,
+                 (unsigned long)((now - c.last_activity_ms) / 1000));
+        close_tcp_client_(c);
+        continue;
       }
+      // Nothing new; only requests held back by a full response queue remain
+      if (c.rx.pending() == 0) continue;
     }
-    if (!placed) {
-      ESP_LOGW(TAG, "TCP: No slot available, rejecting connection");
-      close(nfd);
+
+    // Finish any responses the socket couldn't take last time
+    if (writable && !flush_tcp_client_(c)) {
+      ESP_LOGW(TAG, "TCP: Client slot %u send error: errno=%d", (unsigned) i, errno);
+      close_tcp_client_(c);
+      continue;
+    }
+    
+    if (readable) {
+      int n = recv(c.fd, c.rx.write_ptr(), c.rx.write_space(), 0);
+      if (n > 0) {
+        c.rx.commit(n);
+        tcp_traffic_.add_rx(n);
+        c.last_activity_ms = now;
+      } else if (n == 0) {
+        ESP_LOGI(TAG, "TCP: Client slot %u disconnected", (unsigned) i);
+        close_tcp_client_(c);
+        continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        ESP_LOGW(TAG, "TCP: Client slot %u error: errno=%d", (unsigned) i, errno);
+        close_tcp_client_(c);
+        continue;
+      }
+    }
+    
+    // Serve every complete request in the buffer. Requests are left in the
+    // buffer while the response queue is full, so a client that doesn't read
+    // its responses is throttled by TCP instead of losing them.
+    const uint8_t *frame;
+    int frame_len;
+    while (TcpClient::TX_BUFFER_SIZE - c.tx_len >= MBAP_MAX_ADU &&
+           (frame_len = c.rx.next_frame(&frame)) > 0) {
+      uint32_t t0 = micros();
+      tcp_traffic_.frame_rx();
+      process_tcp_request_(c, frame, frame_len);
+      record_service_time_(frame[7], micros() - t0);
+    }
+    
+    if (c.tx_len > 0 && !flush_tcp_client_(c)) {
+      ESP_LOGW(TAG, "TCP: Client slot %u send error: errno=%d", (unsigned) i, errno);
+      close_tcp_client_(c);
     }
   }
+}
 
-  uint8_t buf[260];
-  for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-    if (client_fds_[i] < 0) continue;
-    int n = recv(client_fds_[i], buf, sizeof(buf), 0);
-    if (n > 0) {
-      process_tcp_request_(client_fds_[i], buf, n);
-    } else if (n == 0) {
-      ESP_LOGI(TAG, "TCP: Client slot %d disconnected", i);
-      close(client_fds_[i]); client_fds_[i] = -1;
-    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-      ESP_LOGW(TAG, "TCP: Client slot %d error: errno=%d", i, errno);
-      close(client_fds_[i]); client_fds_[i] = -1;
+void SunSpecProxy::accept_tcp_client_(uint32_t now) {
+  struct sockaddr_in ca;
+  socklen_t al = sizeof(ca);
+  int nfd = accept(server_fd_, (struct sockaddr *)&ca, &al);
+  if (nfd < 0) return;
+  fcntl(nfd, F_SETFL, fcntl(nfd, F_GETFL, 0) | O_NONBLOCK);
+
+  char ip[16];
+  inet_ntoa_r(ca.sin_addr, ip, sizeof(ip));
+
+  // Free slot, or else the least recently active client that has nothing
+  // buffered and has been quiet for a while
+  int slot = -1, lru = -1;
+  for (size_t i = 0; i < clients_.size(); i++) {
+    auto &c = clients_[i];
+    if (c.fd < 0) {
+      slot = i;
+      break;
     }
+    if (c.tx_len > 0 || c.rx.pending() > 0) continue;
+    if (lru < 0 || now - c.last_activity_ms > now - clients_[lru].last_activity_ms) lru = i;
+  }
+  if (slot < 0 && lru >= 0 && now - clients_[lru].last_activity_ms >= TCP_LRU_MIN_IDLE_MS) {
+    ESP_LOGI(TAG, "TCP: Table full, replacing slot %d (idle %lus)", lru,
+             (unsigned long)((now - clients_[lru].last_activity_ms) / 1000));
+    close_tcp_client_(clients_[lru]);
+    slot = lru;
+  }
+  if (slot < 0) {
+    ESP_LOGW(TAG, "TCP: No slot available, rejecting connection from %s", ip);
+    close(nfd);
+    return;
+  }
+
+  auto &c = clients_[slot];
+  c.fd = nfd;
+  c.tx_len = 0;
+  c.rx.reset();
+  c.last_activity_ms = now;
+  ESP_LOGI(TAG, "TCP: Client connected from %s (slot %d)", ip, slot);
+}
+
+bool SunSpecProxy::flush_tcp_client_(TcpClient &c) {
+  int sent = send(c.fd, c.tx, c.tx_len, MSG_DONTWAIT);
+  if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+  if (sent < c.tx_len) memmove(c.tx, &c.tx[sent], c.tx_len - sent);
+  c.tx_len -= sent;
+  tcp_traffic_.add_tx(sent);
+  return true;
+}
+
+void SunSpecProxy::close_tcp_client_(TcpClient &c) {
+  for (auto &p : gateway_pending_) {
+    if (p.fd == c.fd) p.fd = -1;
   }
+  close(c.fd);
+  c.fd = -1;
+  c.tx_len = 0;
+  c.rx.reset();
 }
 
-void SunSpecProxy::process_tcp_request_(int client_fd, uint8_t *buf, int len) {
+void SunSpecProxy::process_tcp_request_(TcpClient &client, const uint8_t *buf, int len) {
   if (len < 8) return;
 
   uint16_t txn_id = be16(&buf[0]);
@@ -572,201 +1130,955 @@ void SunSpecProxy::process_tcp_request_(int client_fd, uint8_t *buf, int len) {
   uint8_t unit_id = buf[6];
   uint8_t fc = buf[7];
 
-  if (proto != 0) return;
+  if (proto != 0) return;  // Not Modbus; there is no frame format to answer in
 
   last_tcp_activity_ms_ = millis();
   tcp_request_count_++;
 
+  if (gateway_unit_id_ != 0 && unit_id >= gateway_unit_id_ && unit_id < gateway_unit_id_ + num_dtus_) {
+    process_gateway_request_(client, buf, len);
+    return;
+  }
+
   if (unit_id != agg_config_.unit_id) {
-    ESP_LOGD(TAG, "TCP: Request for unit_id %d (we are %d), ignoring", unit_id, agg_config_.unit_id);
+    // Answer unit IDs we don't serve at once, like a gateway with nothing
+    // behind it: the GX probes many of them on boot and would otherwise
+    // wait out a timeout on each. Writes to unit 0 are broadcasts, which
+    // Modbus never answers.
+    bool broadcast = unit_id == 0 && (fc == 0x05 || fc == 0x06 || fc == 0x0F || fc == 0x10);
+    foreign_unit_count_++;
+    if (!broadcast) send_tcp_error_(client, txn_id, unit_id, fc, 0x0B);
+    trace_.record(TraceEvent::TCP_REJECT, client.fd, (unit_id << 8) | fc, 0x0B, txn_id);
     return;
   }
 
   switch (fc) {
     case 0x03: { // Read Holding Registers
-      if (len < 12) return;
+      if (len < 12) {
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
+        return;
+      }
       uint16_t start = be16(&buf[8]);
       uint16_t count = be16(&buf[10]);
 
-      ESP_LOGD(TAG, "TCP RX: ReadHolding txn=%d unit=%d reg=%d count=%d",
-               txn_id, unit_id, start, count);
+      trace_.record(TraceEvent::TCP_READ, client.fd, start, count, txn_id);
 
-      if (count > 125) {
-        ESP_LOGW(TAG, "TCP: Read count %d exceeds max 125", count);
-        send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x03);
-        tcp_error_count_++;
+      if (count < 1 || count > 125) {
+        ESP_LOGW(TAG, "TCP: Read count %d outside 1-125", count);
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
         return;
       }
 
-      uint16_t values[125];
-      if (!read_sunspec_registers_(start, count, values)) {
-        ESP_LOGW(TAG, "TCP: Read failed for reg %d count %d (out of range)", start, count);
-        send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x02);
-        tcp_error_count_++;
+      // Outside the map, e.g. the other SunSpec bases (0, 50000) a scanner
+      // tries: illegal address, no log line (every discovery does this)
+      const uint8_t *regs = sunspec_wire_slice_(start, count);
+      if (regs == nullptr) {
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x02);
         return;
       }
 
-      uint8_t resp[1 + 250];
-      resp[0] = count * 2;
-      for (int i = 0; i < count; i++) put_be16(&resp[1 + i * 2], values[i]);
-      send_tcp_response_(client_fd, txn_id, unit_id, fc, resp, 1 + count * 2);
+      // Header + byte count, then the registers straight from the wire image
+      uint8_t hdr[9];
+      put_be16(&hdr[0], txn_id);
+      put_be16(&hdr[2], 0);
+      put_be16(&hdr[4], 3 + count * 2);
+      hdr[6] = unit_id;
+      hdr[7] = fc;
+      hdr[8] = count * 2;
+      send_tcp_frame_(client, hdr, sizeof(hdr), regs, count * 2);
+      note_client_read_(start, count);
 
       ESP_LOGV(TAG, "TCP TX: ReadHolding response %d regs", count);
       break;
     }
     case 0x06: { // Write Single Register
-      if (len < 12) return;
+      if (len < 12) {
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
+        return;
+      }
       uint16_t reg = be16(&buf[8]);
       uint16_t val = be16(&buf[10]);
 
-      ESP_LOGI(TAG, "TCP RX: WriteSingle txn=%d reg=%d val=%d", txn_id, reg, val);
+      trace_.record(TraceEvent::TCP_WRITE, client.fd, reg, 1, txn_id);
 
       if (!write_sunspec_registers_(reg, 1, &val)) {
-        send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x02);
-        tcp_error_count_++;
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x02);
         return;
       }
       uint8_t resp[4]; put_be16(&resp[0], reg); put_be16(&resp[2], val);
-      send_tcp_response_(client_fd, txn_id, unit_id, fc, resp, 4);
+      send_tcp_response_(client, txn_id, unit_id, fc, resp, 4);
       break;
     }
     case 0x10: { // Write Multiple Registers
-      if (len < 13) return;
+      if (len < 13) {
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
+        return;
+      }
       uint16_t reg = be16(&buf[8]);
       uint16_t cnt = be16(&buf[10]);
 
-      ESP_LOGI(TAG, "TCP RX: WriteMultiple txn=%d reg=%d count=%d", txn_id, reg, cnt);
+      trace_.record(TraceEvent::TCP_WRITE, client.fd, reg, cnt, txn_id);
 
-      if (len < 13 + cnt * 2 || cnt > 100) {
-        send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x03);
-        tcp_error_count_++;
+      if (len < 13 + cnt * 2 || cnt < 1 || cnt > 100) {
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
         return;
       }
       uint16_t vals[100];
       for (int i = 0; i < cnt; i++) vals[i] = be16(&buf[13 + i * 2]);
       if (!write_sunspec_registers_(reg, cnt, vals)) {
-        send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x02);
-        tcp_error_count_++;
+        reject_tcp_request_(client, txn_id, unit_id, fc, 0x02);
         return;
       }
       uint8_t resp[4]; put_be16(&resp[0], reg); put_be16(&resp[2], cnt);
-      send_tcp_response_(client_fd, txn_id, unit_id, fc, resp, 4);
+      send_tcp_response_(client, txn_id, unit_id, fc, resp, 4);
       break;
     }
     default:
       ESP_LOGW(TAG, "TCP: Unsupported function code 0x%02X", fc);
-      send_tcp_error_(client_fd, txn_id, unit_id, fc, 0x01);
-      tcp_error_count_++;
+      reject_tcp_request_(client, txn_id, unit_id, fc, 0x01);
   }
 }
 
-void SunSpecProxy::send_tcp_response_(int client_fd, uint16_t txn_id, uint8_t unit_id,
+void SunSpecProxy::reject_tcp_request_(TcpClient &client, uint16_t txn_id, uint8_t unit_id, uint8_t fc,
+                                       uint8_t err) {
+  send_tcp_error_(client, txn_id, unit_id, fc, err);
+  tcp_error_count_++;
+  trace_.record(TraceEvent::TCP_REJECT, client.fd, (unit_id << 8) | fc, err, txn_id);
+}
+
+void SunSpecProxy::send_tcp_response_(TcpClient &client, uint16_t txn_id, uint8_t unit_id,
                                        uint8_t fc, const uint8_t *data, uint16_t data_len) {
-  uint8_t frame[260];
+  // Queue the response; handle_tcp_clients_() flushes the queue once all
+  // buffered requests of this client have been served
+  if (client.tx_len + 8 + data_len > TcpClient::TX_BUFFER_SIZE) {
+    ESP_LOGW(TAG, "TCP: Response queue full, dropping response txn=%d", txn_id);
+    return;
+  }
+  uint8_t *frame = &client.tx[client.tx_len];
   put_be16(&frame[0], txn_id);
   put_be16(&frame[2], 0);
   put_be16(&frame[4], 1 + 1 + data_len);
   frame[6] = unit_id;
   frame[7] = fc;
   memcpy(&frame[8], data, data_len);
-  send(client_fd, frame, 8 + data_len, 0);
+  client.tx_len += 8 + data_len;
+  tcp_traffic_.frame_tx();
+}
+
+void SunSpecProxy::send_tcp_frame_(TcpClient &client, const uint8_t *hdr, uint16_t hdr_len,
+                                    const uint8_t *body, uint16_t body_len) {
+  uint16_t total = hdr_len + body_len;
+  size_t sent = 0;
+
+  // Gather-send header + body directly when nothing is queued ahead of us;
+  // only what the socket doesn't take is copied into the response queue
+  if (client.tx_len == 0) {
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len = hdr_len;
+    iov[1].iov_base = (void *) body;
+    iov[1].iov_len = body_len;
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    ssize_t n = sendmsg(client.fd, &msg, MSG_DONTWAIT);
+    if (n > 0) sent = n;
+    tcp_traffic_.add_tx(sent);
+    if (sent == total) {
+      tcp_traffic_.frame_tx();
+      return;
+    }
+  }
+
+  if (client.tx_len + (total - sent) > TcpClient::TX_BUFFER_SIZE) {
+    ESP_LOGW(TAG, "TCP: Response queue full, dropping response");
+    return;
+  }
+  if (sent < hdr_len) {
+    memcpy(&client.tx[client.tx_len], &hdr[sent], hdr_len - sent);
+    client.tx_len += hdr_len - sent;
+    sent = hdr_len;
+  }
+  memcpy(&client.tx[client.tx_len], &body[sent - hdr_len], total - sent);
+  client.tx_len += total - sent;
+  tcp_traffic_.frame_tx();
 }
 
-void SunSpecProxy::send_tcp_error_(int client_fd, uint16_t txn_id, uint8_t unit_id,
+void SunSpecProxy::send_tcp_error_(TcpClient &client, uint16_t txn_id, uint8_t unit_id,
                                     uint8_t fc, uint8_t err) {
   uint8_t data[1] = {err};
-  send_tcp_response_(client_fd, txn_id, unit_id, fc | 0x80, data, 1);
+  send_tcp_response_(client, txn_id, unit_id, fc | 0x80, data, 1);
+}
+
+void SunSpecProxy::record_service_time_(uint8_t fc, uint32_t us) {
+  switch (fc) {
+    case 0x03: service_time_[0].record_us(us); break;
+    case 0x06: service_time_[1].record_us(us); break;
+    case 0x10: service_time_[2].record_us(us); break;
+    default: break;
+  }
 }
 
 // ============================================================
-// SunSpec Register Access
+// Modbus Gateway (DTU registers on gateway_unit_id_ + DTU index)
 // ============================================================
+//
+// Reads are answered from a small cache of register ranges per DTU. A hit
+// needs a READY range younger than gateway_max_age_ms_; anything else waits
+// in gateway_pending_ for the next poll round, which a miss brings forward.
+// That round copies ranges inside a plan read from its response and reads
+// the others after the plan, on the same connection. However many clients
+// use the gateway, the DTU only ever sees the proxy.
+
+void SunSpecProxy::process_gateway_request_(TcpClient &client, const uint8_t *buf, int len) {
+  uint16_t txn_id = be16(&buf[0]);
+  uint8_t unit_id = buf[6];
+  uint8_t fc = buf[7];
+  DtuLink &l = dtu_links_[unit_id - gateway_unit_id_];
 
-bool SunSpecProxy::read_sunspec_registers_(uint16_t start_reg, uint16_t count, uint16_t *out) {
-  if (start_reg < SUNSPEC_BASE) return false;
-  uint16_t off = start_reg - SUNSPEC_BASE;
-  if (off + count > TOTAL_REGS) return false;
-  memcpy(out, &register_map_[off], count * 2);
-  return true;
-}
+  // Read-only: the inverter controls belong to the SunSpec side
+  if (fc != 0x03) {
+    reject_tcp_request_(client, txn_id, unit_id, fc, 0x01);
+    return;
+  }
+  if (len < 12) {
+    reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
+    return;
+  }
+  uint16_t start = be16(&buf[8]);
+  uint16_t count = be16(&buf[10]);
+  trace_.record(TraceEvent::TCP_READ, client.fd, start, count, txn_id);
+  if (count < 1 || count > 125 || start + count > 0x10000) {
+    reject_tcp_request_(client, txn_id, unit_id, fc, 0x03);
+    return;
+  }
 
-bool SunSpecProxy::write_sunspec_registers_(uint16_t start_reg, uint16_t count, const uint16_t *values) {
-  if (start_reg < SUNSPEC_BASE) return false;
-  uint16_t off = start_reg - SUNSPEC_BASE;
+  uint32_t now = millis();
+  GatewayPending *wait = nullptr;
+  for (auto &p : gateway_pending_) {
+    if (p.fd < 0) {
+      wait = &p;
+      break;
+    }
+  }
+  int idx = find_gateway_range_(l, start, count, now, wait != nullptr);
+  if (idx >= 0) {
+    GatewayRange &r = l.gateway[idx];
+    r.used_ms = now;
+    uint8_t st = r.state.load(std::memory_order_acquire);
+    if (st == GATEWAY_READY && now - r.fetched_ms <= gateway_max_age_ms_) {
+      gateway_hits_++;
+      send_gateway_response_(client, txn_id, unit_id, r, start, count);
+      return;
+    }
+    if (wait != nullptr) {
+      if (st != GATEWAY_WANTED && st != GATEWAY_FETCHING) r.state.store(GATEWAY_WANTED, std::memory_order_release);
+      gateway_wanted_.store(true, std::memory_order_relaxed);
+      gateway_misses_++;
+      *wait = {client.fd, (uint8_t)(&client - clients_.data()), unit_id, l.index, (uint8_t) idx, txn_id, start, count,
+               now};
+      return;
+    }
+  }
+  // Every range or wait slot is taken by reads still in progress
+  gateway_failures_++;
+  reject_tcp_request_(client, txn_id, unit_id, fc, 0x06);
+}
 
-  if (off < OFF_M123 + 2 || off + count > OFF_END) {
-    ESP_LOGW(TAG, "TCP: Write rejected — register %d not in Model 123 writable area", start_reg);
-    return false;
+// The range holding [start, start + count), else (if `allocate`) one
+// repurposed for it: a free one, or the least recently read one nobody
+// waits for. -1 = none.
+int SunSpecProxy::find_gateway_range_(DtuLink &l, uint16_t start, uint16_t count, uint32_t now, bool allocate) {
+  int victim = -1;
+  uint32_t victim_age = 0;
+  for (int i = 0; i < GATEWAY_RANGES; i++) {
+    GatewayRange &r = l.gateway[i];
+    uint8_t st = r.state.load(std::memory_order_acquire);
+    if (st != GATEWAY_FREE && start >= r.start && start + count <= r.start + r.count) return i;
+    if (!allocate || st == GATEWAY_WANTED || st == GATEWAY_FETCHING) continue;
+    bool waited_for = false;
+    for (auto &p : gateway_pending_) {
+      if (p.fd >= 0 && p.link == l.index && p.range == i) waited_for = true;
+    }
+    if (waited_for) continue;
+    uint32_t age = st == GATEWAY_FREE ? UINT32_MAX : now - r.used_ms;
+    if (victim < 0 || age > victim_age) {
+      victim = i;
+      victim_age = age;
+    }
+  }
+  if (victim >= 0) {
+    GatewayRange &r = l.gateway[victim];
+    r.state.store(GATEWAY_FREE, std::memory_order_relaxed);
+    r.start = start;
+    r.count = count;
   }
+  return victim;
+}
 
-  for (uint16_t i = 0; i < count; i++) register_map_[off + i] = values[i];
+void SunSpecProxy::send_gateway_response_(TcpClient &client, uint16_t txn_id, uint8_t unit_id,
+                                          const GatewayRange &r, uint16_t start, uint16_t count) {
+  uint8_t hdr[9];
+  put_be16(&hdr[0], txn_id);
+  put_be16(&hdr[2], 0);
+  put_be16(&hdr[4], 3 + count * 2);
+  hdr[6] = unit_id;
+  hdr[7] = 0x03;
+  hdr[8] = count * 2;
+  uint8_t body[250];
+  const uint16_t *regs = &r.regs[start - r.start];
+  for (uint16_t i = 0; i < count; i++) put_be16(&body[i * 2], regs[i]);
+  send_tcp_frame_(client, hdr, sizeof(hdr), body, count * 2);
+}
 
-  uint16_t lim_off = OFF_M123 + 2 + 5;
-  uint16_t ena_off = OFF_M123 + 2 + 8;
-  bool changed = false;
-  for (uint16_t r = off; r < off + count; r++) {
-    if (r == lim_off || r == ena_off) { changed = true; break; }
+// Answer the reads whose range came in, or failed to, since the last pass.
+// A range that no round takes (every round busy with other ranges) gives up
+// after about two pulled-forward rounds.
+void SunSpecProxy::answer_gateway_reads_(uint32_t now) {
+  uint32_t max_wait = 2 * (poll_fast_interval_ms_ + tcp_timeout_ms_);
+  for (auto &p : gateway_pending_) {
+    if (p.fd < 0) continue;
+    TcpClient &c = clients_[p.client];
+    const GatewayRange &r = dtu_links_[p.link].gateway[p.range];
+    uint8_t st = r.state.load(std::memory_order_acquire);
+    if (st == GATEWAY_READY) {
+      send_gateway_response_(c, p.txn_id, p.unit_id, r, p.start, p.count);
+    } else if (st == GATEWAY_FAILED || now - p.since_ms > max_wait) {
+      gateway_failures_++;
+      reject_tcp_request_(c, p.txn_id, p.unit_id, 0x03, st == GATEWAY_FAILED ? r.exception : 0x0B);
+    } else {
+      continue;
+    }
+    p.fd = -1;
   }
+}
 
-  if (changed) {
-    uint16_t pct = register_map_[lim_off];
-    uint16_t ena = register_map_[ena_off];
-    ESP_LOGI(TAG, "VICTRON: Power limit command — %.1f%%, enabled=%d", pct / 10.0f, ena);
-    forward_power_limit_(pct, ena == 1);
+// DTU side, when a round starts on a link: take the ranges that missed.
+// Those inside one read of the plan are copied from its response, the rest
+// are read after the plan.
+void SunSpecProxy::collect_gateway_fetches_(DtuLink &l) {
+  l.gateway_fetches = 0;
+  if (l.gateway == nullptr) return;
+  for (uint8_t i = 0; i < GATEWAY_RANGES; i++) {
+    GatewayRange &r = l.gateway[i];
+    if (r.state.load(std::memory_order_acquire) != GATEWAY_WANTED) continue;
+    r.plan_chunk = DTU_INFLIGHT_GATEWAY;
+    for (uint8_t c = 0; c < l.read_chunks; c++) {
+      const DtuReadChunk &p = l.read_plan[c];
+      if (r.start >= p.start && r.start + r.count <= p.start + p.count) {
+        r.plan_chunk = c;
+        break;
+      }
+    }
+    if (r.plan_chunk == DTU_INFLIGHT_GATEWAY) l.gateway_fetch[l.gateway_fetches++] = i;
+    r.state.store(GATEWAY_FETCHING, std::memory_order_relaxed);
   }
+}
 
+bool SunSpecProxy::send_gateway_fetch_(DtuLink &l, uint8_t range) {
+  const GatewayRange &r = l.gateway[range];
+  uint16_t txn_id = l.txn_id;
+  if (!send_modbus_tcp_request_(l, 0x03, r.start, r.count)) return false;
+  l.inflight[l.inflight_count++] = {txn_id, DTU_INFLIGHT_GATEWAY, range, millis(), micros()};
+  update_dtu_deadline_(l);
   return true;
 }
 
+void SunSpecProxy::store_gateway_range_(GatewayRange &r, const uint8_t *data) {
+  for (uint16_t i = 0; i < r.count; i++) r.regs[i] = be16(&data[i * 2]);
+  r.fetched_ms = millis();
+  r.state.store(GATEWAY_READY, std::memory_order_release);
+}
+
+// The round on this link ended without these ranges: their readers get
+// exception 0x0B (gateway target failed to respond)
+void SunSpecProxy::fail_gateway_fetches_(DtuLink &l) {
+  if (l.gateway == nullptr) return;
+  for (uint8_t i = 0; i < GATEWAY_RANGES; i++) {
+    GatewayRange &r = l.gateway[i];
+    if (r.state.load(std::memory_order_relaxed) != GATEWAY_FETCHING) continue;
+    r.exception = 0x0B;
+    r.state.store(GATEWAY_FAILED, std::memory_order_release);
+  }
+}
+
+// ============================================================
+// Metrics Endpoint (HTTP GET /metrics, GET /trace, GET /history)
 // ============================================================
-// Power Limit Forwarding
-// ============================================================
 
-bool SunSpecProxy::send_dtu_fc05_(uint16_t address, uint16_t value) {
-  if (!dtu_connected_ && !connect_to_dtu_()) {
-    ESP_LOGW(TAG, "DTU FC05: Not connected");
+void SunSpecProxy::setup_metrics_server_() {
+  metrics_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (metrics_fd_ < 0) {
+    ESP_LOGE(TAG, "Metrics socket create failed: errno=%d", errno);
+    return;
+  }
+
+  int opt = 1;
+  setsockopt(metrics_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  fcntl(metrics_fd_, F_SETFL, fcntl(metrics_fd_, F_GETFL, 0) | O_NONBLOCK);
+
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(metrics_port_);
+
+  if (bind(metrics_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(metrics_fd_, MAX_METRICS_CLIENTS) < 0) {
+    ESP_LOGE(TAG, "Metrics bind/listen on port %d failed: errno=%d", metrics_port_, errno);
+    close(metrics_fd_); metrics_fd_ = -1; return;
+  }
+
+  ESP_LOGI(TAG, "Metrics available at http://<device>:%d/metrics", metrics_port_);
+}
+
+void SunSpecProxy::handle_metrics_clients_() {
+  if (metrics_fd_ < 0) return;
+  uint32_t now = millis();
+
+  // Scrapes are rare: accept at most one connection per loop
+  int nfd = accept(metrics_fd_, nullptr, nullptr);
+  if (nfd >= 0) {
+    MetricsClient *slot = nullptr;
+    for (auto &c : metrics_clients_) {
+      if (c.fd < 0) {
+        slot = &c;
+        break;
+      }
+    }
+    if (slot == nullptr) {
+      close(nfd);
+    } else {
+      fcntl(nfd, F_SETFL, fcntl(nfd, F_GETFL, 0) | O_NONBLOCK);
+      slot->fd = nfd;
+      slot->rx_len = 0;
+      slot->tx.clear();
+      slot->tx_pos = 0;
+      slot->opened_ms = now;
+    }
+  }
+
+  for (auto &c : metrics_clients_) {
+    if (c.fd < 0) continue;
+    if (now - c.opened_ms > METRICS_TIMEOUT_MS) {
+      close_metrics_client_(c);
+      continue;
+    }
+
+    if (c.tx.empty()) {
+      int n = recv(c.fd, &c.rx[c.rx_len], sizeof(c.rx) - 1 - c.rx_len, MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_metrics_client_(c);
+        continue;
+      }
+      if (n < 0) continue;
+      c.rx_len += n;
+      c.rx[c.rx_len] = 0;
+      // Wait for the end of the headers (or a full buffer: only the
+      // request line matters)
+      if (strstr(c.rx, "\r\n\r\n") == nullptr && c.rx_len < sizeof(c.rx) - 1) continue;
+
+      auto is_path = [&c](const char *path) {
+        size_t n = strlen(path);
+        return strncmp(c.rx, path, n) == 0 && (c.rx[n] == ' ' || c.rx[n] == '?');
+      };
+      bool metrics = is_path("GET /metrics");
+      if (history_.enabled() && is_path("GET /history")) {
+        start_history_stream_(c);
+      } else if (!metrics && !is_path("GET /trace")) {
+        c.tx = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      } else {
+        std::string body;
+        if (metrics) {
+          render_metrics_(body);
+        } else {
+          render_trace_(body);
+        }
+        char hdr[128];
+        snprintf(hdr, sizeof(hdr),
+                 "HTTP/1.1 200 OK\r\nContent-Type: text/plain%s\r\n"
+                 "Content-Length: %u\r\nConnection: close\r\n\r\n", metrics ? "; version=0.0.4" : "",
+                 (unsigned) body.size());
+        c.tx = hdr;
+        c.tx += body;
+      }
+    }
+
+    int sent = send(c.fd, c.tx.data() + c.tx_pos, c.tx.size() - c.tx_pos, MSG_DONTWAIT);
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      close_metrics_client_(c);
+      continue;
+    }
+    if (sent > 0) {
+      c.tx_pos += sent;
+      c.opened_ms = now;
+    }
+    if (c.tx_pos >= c.tx.size() && !fill_history_chunk_(c)) close_metrics_client_(c);
+  }
+}
+
+void SunSpecProxy::close_metrics_client_(MetricsClient &c) {
+  close(c.fd);
+  c.fd = -1;
+  c.history_tier = -1;
+  c.tx.clear();
+  c.tx.shrink_to_fit();  // The rendered page is a few kB; don't keep it around
+}
+
+// Label value with '"' and '\' escaped (names are user-configured)
+static void append_label_value(std::string &out, const char *v) {
+  for (; *v; v++) {
+    if (*v == '"' || *v == '\\') out += '\\';
+    out += *v;
+  }
+}
+
+void SunSpecProxy::render_metrics_(std::string &out) {
+  out.reserve(8192);
+  char labels[64];
+
+  append_metric_header(out, "sunspec_proxy_uptime_seconds", "gauge", "Time since boot");
+  append_metric(out, "sunspec_proxy_uptime_seconds", "", millis() / 1000.0);
+
+  // Main loop and Modbus server
+  append_metric_header(out, "sunspec_proxy_loop_duration_seconds", "histogram", "Duration of one loop() pass");
+  loop_time_.append_to(out, "sunspec_proxy_loop_duration_seconds", "");
+
+  append_metric_header(out, "sunspec_proxy_modbus_service_seconds", "histogram",
+                       "Time to serve one Modbus TCP request, by function code");
+  static const char *const fc_labels[] = {"fc=\"3\"", "fc=\"6\"", "fc=\"16\""};
+  for (int i = 0; i < 3; i++) service_time_[i].append_to(out, "sunspec_proxy_modbus_service_seconds", fc_labels[i]);
+
+  int active = 0;
+  for (auto &c : clients_) {
+    if (c.fd >= 0) active++;
+  }
+  append_metric_header(out, "sunspec_proxy_modbus_clients", "gauge", "Connected Modbus TCP clients");
+  append_metric(out, "sunspec_proxy_modbus_clients", "", active);
+  append_metric_header(out, "sunspec_proxy_modbus_requests_total", "counter", "Modbus TCP requests received");
+  append_metric(out, "sunspec_proxy_modbus_requests_total", "", tcp_request_count_);
+  append_metric_header(out, "sunspec_proxy_modbus_errors_total", "counter", "Modbus TCP exception responses sent for our unit ID");
+  append_metric(out, "sunspec_proxy_modbus_errors_total", "", tcp_error_count_);
+  append_metric_header(out, "sunspec_proxy_modbus_foreign_unit_total", "counter",
+                       "Requests for unit IDs other than ours (answered with exception 0x0B)");
+  append_metric(out, "sunspec_proxy_modbus_foreign_unit_total", "", foreign_unit_count_);
+  if (gateway_unit_id_ != 0) {
+    append_metric_header(out, "sunspec_proxy_gateway_reads_total", "counter",
+                         "Reads on the gateway unit IDs, by how they were answered");
+    append_metric(out, "sunspec_proxy_gateway_reads_total", "result=\"hit\"", gateway_hits_);
+    append_metric(out, "sunspec_proxy_gateway_reads_total", "result=\"miss\"", gateway_misses_);
+    append_metric(out, "sunspec_proxy_gateway_reads_total", "result=\"failed\"", gateway_failures_);
+  }
+
+  // Throughput, server side as dir="server", DTU links by dtu index
+  append_metric_header(out, "sunspec_proxy_bytes_total", "counter", "Bytes on Modbus TCP connections");
+  append_metric_header(out, "sunspec_proxy_frames_total", "counter", "Modbus frames on TCP connections");
+  auto traffic = [&](const TrafficCounters &t, const char *peer) {
+    snprintf(labels, sizeof(labels), "%s,dir=\"rx\"", peer);
+    append_metric(out, "sunspec_proxy_bytes_total", labels, t.rx_bytes.load(std::memory_order_relaxed));
+    append_metric(out, "sunspec_proxy_frames_total", labels, t.rx_frames.load(std::memory_order_relaxed));
+    snprintf(labels, sizeof(labels), "%s,dir=\"tx\"", peer);
+    append_metric(out, "sunspec_proxy_bytes_total", labels, t.tx_bytes.load(std::memory_order_relaxed));
+    append_metric(out, "sunspec_proxy_frames_total", labels, t.tx_frames.load(std::memory_order_relaxed));
+  };
+  traffic(tcp_traffic_, "peer=\"server\"");
+  for (int d = 0; d < num_dtus_; d++) {
+    char peer[24];
+    snprintf(peer, sizeof(peer), "peer=\"dtu%d\"", d);
+    traffic(dtu_links_[d].traffic, peer);
+  }
+
+  // DTU links
+  append_metric_header(out, "sunspec_proxy_dtu_request_rtt_seconds", "histogram",
+                       "DTU request round-trip time (read chunks and FC05 writes)");
+  for (int d = 0; d < num_dtus_; d++) {
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    dtu_links_[d].rtt.append_to(out, "sunspec_proxy_dtu_request_rtt_seconds", labels);
+  }
+  append_metric_header(out, "sunspec_proxy_dtu_connect_seconds", "histogram", "Time to establish a DTU connection");
+  for (int d = 0; d < num_dtus_; d++) {
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    dtu_links_[d].connect_time.append_to(out, "sunspec_proxy_dtu_connect_seconds", labels);
+  }
+  append_metric_header(out, "sunspec_proxy_dtu_connected", "gauge", "DTU connection is up");
+  append_metric_header(out, "sunspec_proxy_dtu_exceptions_total", "counter", "Modbus exceptions returned by the DTU");
+  for (int d = 0; d < num_dtus_; d++) {
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    append_metric(out, "sunspec_proxy_dtu_connected", labels,
+                  dtu_links_[d].connected.load(std::memory_order_relaxed) ? 1 : 0);
+    append_metric(out, "sunspec_proxy_dtu_exceptions_total", labels,
+                  dtu_links_[d].exceptions.load(std::memory_order_relaxed));
+  }
+  append_metric_header(out, "sunspec_proxy_dtu_timeouts_total", "counter",
+                       "DTU requests given up on after tcp_timeout_ms");
+  append_metric_header(out, "sunspec_proxy_dtu_late_responses_total", "counter",
+                       "DTU answers to requests already given up on (dropped)");
+  append_metric_header(out, "sunspec_proxy_dtu_reconnects_total", "counter", "DTU connects after a failure");
+  append_metric_header(out, "sunspec_proxy_dtu_backoff_seconds", "gauge",
+                       "Wait before the next DTU connect while disconnected (0 = none)");
+  for (int d = 0; d < num_dtus_; d++) {
+    const DtuLink &l = dtu_links_[d];
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    append_metric(out, "sunspec_proxy_dtu_timeouts_total", labels, l.timeouts.load(std::memory_order_relaxed));
+    append_metric(out, "sunspec_proxy_dtu_late_responses_total", labels,
+                  l.late_responses.load(std::memory_order_relaxed));
+    append_metric(out, "sunspec_proxy_dtu_reconnects_total", labels, l.reconnects.load(std::memory_order_relaxed));
+    append_metric(out, "sunspec_proxy_dtu_backoff_seconds", labels,
+                  l.backoff_ms.load(std::memory_order_relaxed) / 1000.0);
+  }
+  append_metric_header(out, "sunspec_proxy_dtu_status_reads_total", "counter",
+                       "Status lane reads answered (alarms, link status, limit readback)");
+  for (int d = 0; d < num_dtus_; d++) {
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    append_metric(out, "sunspec_proxy_dtu_status_reads_total", labels,
+                  dtu_links_[d].status_reads.load(std::memory_order_relaxed));
+  }
+  append_metric_header(out, "sunspec_proxy_dtu_polls_total", "counter", "Successful DTU polls");
+  append_metric(out, "sunspec_proxy_dtu_polls_total", "", dtu_poll_count_.load());
+  append_metric_header(out, "sunspec_proxy_dtu_poll_failures_total", "counter", "Failed DTU polls and connects");
+  append_metric(out, "sunspec_proxy_dtu_poll_failures_total", "", dtu_poll_fail_count_.load());
+
+  // Power limiting
+  append_metric_header(out, "sunspec_proxy_power_limit_apply_seconds", "histogram",
+                       "Victron limit write to the last DTU write acknowledged");
+  limit_apply_time_.append_to(out, "sunspec_proxy_power_limit_apply_seconds", "");
+  append_metric_header(out, "sunspec_proxy_power_limit_effect_seconds", "histogram",
+                       "Victron limit write to the served power within the limit");
+  limit_effect_time_.append_to(out, "sunspec_proxy_power_limit_effect_seconds", "");
+  append_metric_header(out, "sunspec_proxy_power_limit_effect_timeouts_total", "counter",
+                       "Limits the served power didn't reach within 60 s");
+  append_metric(out, "sunspec_proxy_power_limit_effect_timeouts_total", "",
+                limit_effect_timeouts_.load(std::memory_order_relaxed));
+  append_metric_header(out, "sunspec_proxy_dtu_readbacks_total", "counter",
+                       "Power readbacks after limit writes, per DTU request");
+  for (int d = 0; d < num_dtus_; d++) {
+    snprintf(labels, sizeof(labels), "dtu=\"%d\"", d);
+    append_metric(out, "sunspec_proxy_dtu_readbacks_total", labels,
+                  dtu_links_[d].readbacks.load(std::memory_order_relaxed));
+  }
+  append_metric_header(out, "sunspec_proxy_power_limit_coalesced_total", "counter",
+                       "Limit requests replaced by a newer one before being sent");
+  append_metric(out, "sunspec_proxy_power_limit_coalesced_total", "", limit_coalesced_count_);
+
+  // Per inverter
+  append_metric_header(out, "sunspec_proxy_source_polls_total", "counter", "Polls with valid data, per inverter");
+  append_metric_header(out, "sunspec_proxy_source_power_watts", "gauge", "AC power, per inverter");
+  append_metric_header(out, "sunspec_proxy_source_online", "gauge",
+                       "Inverter has data younger than the stale limit");
+  append_metric_header(out, "sunspec_proxy_source_alarm_code", "gauge", "Last alarm code the DTU reports, per inverter");
+  append_metric_header(out, "sunspec_proxy_source_alarms", "gauge", "Alarm count the DTU reports, per inverter");
+  append_metric_header(out, "sunspec_proxy_source_power_limit_percent", "gauge",
+                       "Power limit read back from the DTU, per inverter");
+  for (int i = 0; i < num_sources_; i++) {
+    const RtuSource &s = sources_[i];
+    std::string l = "source=\"";
+    append_label_value(l, s.name);
+    l += '"';
+    append_metric(out, "sunspec_proxy_source_polls_total", l.c_str(), s.poll_success_count);
+    append_metric(out, "sunspec_proxy_source_power_watts", l.c_str(), s.power_dw / 10.0);
+    append_metric(out, "sunspec_proxy_source_online", l.c_str(), s.data_valid ? 1 : 0);
+    append_metric(out, "sunspec_proxy_source_alarm_code", l.c_str(), s.alarm_code);
+    append_metric(out, "sunspec_proxy_source_alarms", l.c_str(), s.alarm_count);
+    if (s.limit_pct != 0) append_metric(out, "sunspec_proxy_source_power_limit_percent", l.c_str(), s.limit_pct);
+  }
+}
+
+// ============================================================
+// History Export (GET /history, see history.h)
+// ============================================================
+
+void SunSpecProxy::setup_history_() {
+  // The export format numbers series with one byte: a site with more
+  // modules keeps history for the first 255
+  const uint16_t max_series = std::min<uint16_t>(Mppt::COUNT, UINT8_MAX);
+  uint16_t series = 0;
+  for (int i = 0; i < num_sources_; i++) {
+    history_series_base_[i] = series < max_series ? series : max_series;
+    series += sources_[i].mppt_inputs;
+  }
+  if (series > max_series) {
+    ESP_LOGW(TAG, "History: %d MPPT modules, keeping the first %d", series, max_series);
+    series = max_series;
+  }
+  if (!history_.init(series, history_config_)) {
+    ESP_LOGW(TAG, "History: not enough memory for %d series, history disabled", series);
+    return;
+  }
+  ESP_LOGI(TAG, "History: %d series, every %lus for %.1fh and every %lus for %.1fd, %lu kB", series,
+           (unsigned long) history_config_[0].interval_s, history_config_[0].retention_s / 3600.0f,
+           (unsigned long) history_config_[1].interval_s, history_config_[1].retention_s / 86400.0f,
+           (unsigned long) (history_.bytes() / 1024));
+}
+
+// GET /history?tier=0|1&since=<uptime s>: the header chunk goes out with
+// the response headers, fill_history_chunk_() then streams the blocks
+void SunSpecProxy::start_history_stream_(MetricsClient &c) {
+  auto param = [&c](const char *name, uint32_t def) -> uint32_t {
+    const char *line_end = strchr(c.rx, '\r');
+    size_t n = strlen(name);
+    for (const char *p = strchr(c.rx, '?'); p != nullptr && (line_end == nullptr || p < line_end);
+         p = strchr(p + 1, '&')) {
+      if (strncmp(p + 1, name, n) == 0 && p[1 + n] == '=') return strtoul(p + 2 + n, nullptr, 10);
+    }
+    return def;
+  };
+  uint32_t tier = param("tier", 0);
+  c.history_tier = tier < HISTORY_TIERS ? tier : 0;
+  c.history_since_s = param("since", 0);
+  c.history_series = 0;
+  c.history_block = 0;
+
+  HistoryExportHeader h{};
+  memcpy(h.magic, "SPHI", 4);
+  h.version = 1;
+  h.tier = c.history_tier;
+  h.series = history_.series();
+  h.interval_s = history_.interval_s(c.history_tier);
+  h.now_s = history_.uptime_s(millis());
+  h.since_s = c.history_since_s;
+  h.block_size = HISTORY_BLOCK_SIZE;
+
+  std::string body((const char *) &h, sizeof(h));
+  for (int i = 0; i < num_sources_; i++) {
+    for (int m = 0; m < sources_[i].mppt_inputs && history_series_base_[i] + m < history_.series(); m++) {
+      HistoryExportSeries e{};
+      e.source = i;
+      e.mppt = m + 1;
+      strncpy(e.serial, sources_[i].serial_number, sizeof(e.serial) - 1);
+      body.append((const char *) &e, sizeof(e));
+    }
+  }
+  char chunk[16];
+  snprintf(chunk, sizeof(chunk), "%x\r\n", (unsigned) body.size());
+  c.tx = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+         "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+  c.tx += chunk;
+  c.tx += body;
+  c.tx += "\r\n";
+}
+
+// Refills tx with the next chunk of up to HISTORY_CHUNK_BLOCKS blocks
+// once the previous one is sent, then with the terminating chunk. False
+// when there is nothing left to send.
+bool SunSpecProxy::fill_history_chunk_(MetricsClient &c) {
+  if (c.history_tier < 0) return false;
+  int tier = c.history_tier;
+  c.tx.assign("0000\r\n");  // Size patched in below
+  c.tx_pos = 0;
+  int blocks = 0;
+  HistoryBlock b;
+  while (blocks < HISTORY_CHUNK_BLOCKS && c.history_series < history_.series()) {
+    uint32_t first, end;
+    history_.block_range(c.history_series, tier, &first, &end);
+    if (c.history_block < first) c.history_block = first;  // Overwritten while streaming
+    if (c.history_block >= end) {
+      c.history_series++;
+      c.history_block = 0;
+      continue;
+    }
+    if (!history_.read_block(c.history_series, tier, c.history_block++, &b)) continue;
+    if (history_block_end_s(b, history_.interval_s(tier)) < c.history_since_s) continue;
+    c.tx.append((const char *) &b, sizeof(b));
+    blocks++;
+  }
+  if (blocks == 0) {
+    c.tx = "0\r\n\r\n";
+    c.history_tier = -1;
+    return true;
+  }
+  char size[8];
+  snprintf(size, sizeof(size), "%04x", (unsigned) (c.tx.size() - 6));
+  memcpy(&c.tx[0], size, 4);
+  c.tx += "\r\n";
+  return true;
+}
+
+// ============================================================
+// Trace Ring Decoding (see trace.h)
+// ============================================================
+
+int SunSpecProxy::format_trace_record_(const TraceRecord &r, char *buf, size_t len) const {
+  int n = snprintf(buf, len, "%6lu.%03lu ", (unsigned long) (r.ms / 1000), (unsigned long) (r.ms % 1000));
+  if (n < 0 || (size_t) n >= len) return n;
+  buf += n;
+  len -= n;
+  auto source_name = [this](unsigned idx) { return idx < (unsigned) num_sources_ ? sources_[idx].name : "?"; };
+  switch ((TraceEvent) r.event) {
+    case TraceEvent::DTU_READ:
+      return n + snprintf(buf, len, "DTU%u: read %u registers (poll %lu)", r.a, r.b, (unsigned long) r.c);
+    case TraceEvent::DTU_PARSE:
+      return n + snprintf(buf, len, "DTU%u: %u of %lu channels changed", r.a, r.b, (unsigned long) r.c);
+    case TraceEvent::CHANNEL:
+      return n + snprintf(buf, len, "Ch%u -> %s MPPT%u: %.1fW, DC %.1fV, total %.3fkWh", r.b & 0xFFF,
+                          source_name(r.a), r.b >> 12, (r.c & 0xFFFF) / 10.0f, (r.c >> 16) / 10.0f, r.d / 1000.0);
+    case TraceEvent::INVERTER:
+      return n + snprintf(buf, len, "INV %s: %.1fW, total %.3fkWh (%u MPPTs%s)", source_name(r.a), r.c / 10.0f,
+                          r.d / 1000.0, r.b & 0x7FFF, (r.b & 0x8000) ? "" : ", idle");
+    case TraceEvent::AGGREGATE:
+      return n + snprintf(buf, len, "AGG: %.1fW, total %.3fkWh [%u/%d, %s]", r.c / 10.0f, r.d / 1000.0, r.a,
+                          num_sources_, r.b ? "MPPT" : "Sleep");
+    case TraceEvent::TCP_REJECT:
+      return n + snprintf(buf, len, "TCP fd%u: unit %u FC%02X -> exception %02lX (txn %lu)", r.a, r.b >> 8,
+                          r.b & 0xFF, (unsigned long) r.c, (unsigned long) r.d);
+    case TraceEvent::DTU_STATUS:
+      if (r.b == DTU_STATUS_LIMIT) {
+        return n + snprintf(buf, len, "STATUS %s: %s, limit %lu%%", source_name(r.a), r.c ? "on" : "off",
+                            (unsigned long) r.d);
+      }
+      return n + snprintf(buf, len, "STATUS %s: operating %lu, alarm %lu (%lu alarms), link %lu", source_name(r.a),
+                          (unsigned long) (r.c & 0xFFFF), (unsigned long) (r.c >> 16), (unsigned long) (r.d >> 8),
+                          (unsigned long) (r.d & 0xFF));
+    case TraceEvent::TCP_READ:
+    case TraceEvent::TCP_WRITE:
+      return n + snprintf(buf, len, "TCP fd%u: %s %u+%lu (txn %lu)", r.a,
+                          (TraceEvent) r.event == TraceEvent::TCP_READ ? "read" : "write", r.b, (unsigned long) r.c,
+                          (unsigned long) r.d);
+  }
+  return n + snprintf(buf, len, "event %u: %u %u %lu %lu", r.event, r.a, r.b, (unsigned long) r.c,
+                      (unsigned long) r.d);
+}
+
+void SunSpecProxy::render_trace_(std::string &out) {
+  uint32_t next = trace_.next();
+  uint32_t first = next > trace_.SIZE ? next - trace_.SIZE : 0;
+  out.reserve((next - first) * 64 + 64);
+  char line[128];
+  snprintf(line, sizeof(line), "# %lu trace records, oldest first (%lu recorded since boot)\n",
+           (unsigned long) (next - first), (unsigned long) next);
+  out += line;
+  for (uint32_t seq = first; seq != next; seq++) {
+    const TraceRecord &r = trace_.at(seq);
+    if (r.event == 0) continue;
+    int n = format_trace_record_(r, line, sizeof(line));
+    if (n <= 0) continue;
+    out.append(line, std::min<size_t>(n, sizeof(line) - 1));
+    out += '\n';
+  }
+}
+
+void SunSpecProxy::dump_trace() {
+  uint32_t next = trace_.next();
+  uint32_t first = next > trace_.SIZE ? next - trace_.SIZE : 0;
+  ESP_LOGI(TAG, "Trace: %lu records, oldest first (%lu recorded since boot)", (unsigned long) (next - first),
+           (unsigned long) next);
+  char line[128];
+  for (uint32_t seq = first; seq != next; seq++) {
+    const TraceRecord &r = trace_.at(seq);
+    if (r.event == 0) continue;
+    format_trace_record_(r, line, sizeof(line));
+    ESP_LOGI(TAG, "  %s", line);
+  }
+}
+
+// ============================================================
+// SunSpec Register Access
+// ============================================================
+
+const uint8_t *SunSpecProxy::sunspec_wire_slice_(uint16_t start_reg, uint16_t count) const {
+  if (start_reg < SUNSPEC_BASE) return nullptr;
+  uint16_t off = start_reg - SUNSPEC_BASE;
+  if (off + count > TOTAL_REGS) return nullptr;
+  return &front_image_().wire[off * 2];
+}
+
+void SunSpecProxy::sync_wire_range_(RegisterImage &img, uint16_t off, uint16_t count) {
+  for (uint16_t i = off; i < off + count; i++) put_be16(&img.wire[i * 2], img.regs[i]);
+}
+
+SunSpecProxy::RegisterImage &SunSpecProxy::begin_register_update_() {
+  uint8_t front = active_image_.load(std::memory_order_acquire);
+  RegisterImage &back = images_[front ^ 1];
+  back = images_[front];  // Carries over static models and Model 123 writes
+  return back;
+}
+
+void SunSpecProxy::commit_register_update_() {
+  uint8_t back = active_image_.load(std::memory_order_relaxed) ^ 1;
+  sync_wire_range_(images_[back], SunSpecMap::data<Inv>(), Inv::LENGTH);
+  sync_wire_range_(images_[back], SunSpecMap::data<Mppt>(), Mppt::LENGTH);
+  active_image_.store(back, std::memory_order_release);
+  register_generation_.fetch_add(1, std::memory_order_release);
+}
+
+bool SunSpecProxy::write_sunspec_registers_(uint16_t start_reg, uint16_t count, const uint16_t *values) {
+  if (start_reg < SUNSPEC_BASE) return false;
+  uint16_t off = start_reg - SUNSPEC_BASE;
+
+  if (!SUNSPEC_WRITABLE.test_range(off, count)) {
+    ESP_LOGW(TAG, "TCP: Write rejected — registers %d..%d not writable", start_reg, start_reg + count - 1);
     return false;
   }
+
+  // Control writes go into the front image; the next inverter update copies
+  // them into the back image before swapping
+  RegisterImage &img = front_image_();
+  uint16_t *regs = img.regs;
+  for (uint16_t i = 0; i < count; i++) regs[off + i] = values[i];
+  sync_wire_range_(img, off, count);
+
+  constexpr uint16_t lim_off = SunSpecMap::data<Ctl>() + Ctl::WMaxLimPct;
+  constexpr uint16_t ena_off = SunSpecMap::data<Ctl>() + Ctl::WMaxLim_Ena;
+  bool changed = false;
+  for (uint16_t r = off; r < off + count; r++) {
+    if (r == lim_off || r == ena_off) { changed = true; break; }
+  }
+
+  if (changed) {
+    uint16_t pct = regs[lim_off];
+    uint16_t ena = regs[ena_off];
+    ESP_LOGI(TAG, "VICTRON: Power limit command — %.1f%%, enabled=%d", pct / 10.0f, ena);
+    forward_power_limit_(pct, ena == 1);
+  }
+
+  return true;
+}
+
+// ============================================================
+// Power Limit Forwarding
+// ============================================================
+
+bool SunSpecProxy::send_dtu_fc05_(DtuLink &l, uint16_t address, uint16_t value) {
+  if (!l.connected) return false;
   
   // Build Modbus TCP FC 0x05 frame
   // MBAP Header: transaction_id(2) + protocol_id(2,=0) + length(2,=6) + unit_id(1)
   // PDU: function_code(1,=0x05) + register_address(2) + value(2)
   uint8_t frame[12];
-  put_be16(&frame[0], modbus_transaction_id_);
+  put_be16(&frame[0], l.txn_id);
   put_be16(&frame[2], 0);  // Protocol ID = 0
   put_be16(&frame[4], 6);  // Length = 6 (unit_id + function + address + value)
-  frame[6] = dtu_address_;
+  frame[6] = l.address;
   frame[7] = 0x05;  // FC 0x05 (Write Single Coil)
   put_be16(&frame[8], address);
   put_be16(&frame[10], value);
   
-  int sent = send(dtu_fd_, frame, 12, 0);
+  int sent = send(l.fd, frame, 12, 0);
   if (sent != 12) {
-    ESP_LOGW(TAG, "DTU FC05: Send failed (%d bytes, errno=%d)", sent, errno);
-    close_dtu_connection_();
+    ESP_LOGW(TAG, "DTU%d FC05: Send failed (%d bytes, errno=%d)", l.index, sent, errno);
+    close_dtu_connection_(l);
     return false;
   }
   
-  modbus_transaction_id_++;
-  
-  // Read response (should echo back the same frame)
-  uint8_t resp[12];
-  int n = read_modbus_tcp_response_(resp, sizeof(resp));
+  l.txn_id++;
+  l.traffic.add_tx(12);
+  l.traffic.frame_tx();
+  return true;
+}
+
+bool SunSpecProxy::check_dtu_fc05_response_(const uint8_t *resp, int n, const DtuCommand &cmd) {
+  // Response should echo back the request frame
   if (n < 12) {
     ESP_LOGW(TAG, "DTU FC05: Invalid response length: %d", n);
     return false;
   }
   
-  // Validate response
   uint16_t resp_addr = be16(&resp[8]);
   uint16_t resp_val = be16(&resp[10]);
-  if (resp[7] != 0x05 || resp_addr != address || resp_val != value) {
+  if (resp[7] != 0x05 || resp_addr != cmd.address || resp_val != cmd.value) {
     ESP_LOGW(TAG, "DTU FC05: Response mismatch (fc=0x%02X, addr=0x%04X, val=0x%04X)", 
              resp[7], resp_addr, resp_val);
     return false;
   }
   
-  ESP_LOGD(TAG, "DTU FC05: Write 0x%04X = %d OK", address, value);
+  ESP_LOGD(TAG, "DTU FC05: Write 0x%04X = %d OK", cmd.address, cmd.value);
   return true;
 }
 
@@ -788,44 +2100,131 @@ void SunSpecProxy::forward_power_limit_(uint16_t pct_raw, bool enabled) {
   ESP_LOGI(TAG, "VICTRON: Power limit command — %.1f%% → Hoymiles %d%%, enabled=%d", 
            pct_f, hm_limit, enabled);
   
+  // Post to the mailbox instead of sending here. The DTU state machine picks
+  // it up between polls, so the Victron write is acknowledged without waiting
+  // on DTU round-trips, and only the newest limit is ever sent.
+  limit_active_.store(hm_limit < 100, std::memory_order_relaxed);
+  uint32_t req = LIMIT_REQ_PENDING | hm_limit;
+  if (enabled) req |= LIMIT_REQ_ENABLED;
+  limit_request_ms_.store(millis(), std::memory_order_relaxed);
+  uint32_t prev = limit_request_.exchange(req, std::memory_order_acq_rel);
+  if (prev & LIMIT_REQ_PENDING) {
+    limit_coalesced_count_++;
+    ESP_LOGD(TAG, "VICTRON: Superseded pending limit %lu%% (%lu coalesced)",
+             (unsigned long)(prev & 0xFFFF), (unsigned long)limit_coalesced_count_);
+  }
+}
+
+void SunSpecProxy::take_power_limit_request_() {
+  // Only replace the queues while no link has writes on the wire, so that
+  // in-flight responses still match their queue entries
+  for (int d = 0; d < num_dtus_; d++) {
+    DtuState st = dtu_links_[d].state;
+    if (st == DtuState::SEND_COMMAND || st == DtuState::AWAIT_COMMAND) return;
+  }
+  uint32_t req = limit_request_.exchange(0, std::memory_order_acq_rel);
+  if (!(req & LIMIT_REQ_PENDING)) return;
+  
+  dtu_cmd_start_ms_ = limit_request_ms_.load(std::memory_order_relaxed);
+  dtu_cmd_limit_ = req & 0xFFFF;
+  dtu_cmd_enabled_ = (req & LIMIT_REQ_ENABLED) != 0;
+  dtu_cmd_failed_ = false;
+  dtu_cmd_links_pending_ = 0;
+  // A limit below what is produced now can be seen taking effect (see
+  // check_limit_effect_()); raising or lifting one can't, the sun decides
+  uint32_t rated_dw = agg_config_.rated_power_w * 10u;
+  limit_effect_target_dw_ = rated_dw * (dtu_cmd_limit_ + LIMIT_EFFECT_MARGIN_PCT) / 100;
+  limit_effect_pending_ =
+      dtu_cmd_enabled_ && dtu_cmd_limit_ < 100 && dtu_result_.agg_power_dw > limit_effect_target_dw_;
+  for (int d = 0; d < num_dtus_; d++) {
+    DtuLink &l = dtu_links_[d];
+    if (l.num_sources == 0) continue;
+    queue_power_limit_(l, false);
+    dtu_cmd_links_pending_++;
+  }
+}
+
+void SunSpecProxy::queue_power_limit_(DtuLink &l, bool per_port) {
   // Control register map (from testing):
   // 0xC000 = All inverters ON/OFF (FC 0x05, value 0=OFF, 1=ON)
   // 0xC001 = All inverters limit % (FC 0x05, value 2-100)
   // 0xC006 + port*6 = Port N ON/OFF
   // 0xC007 + port*6 = Port N limit %
+  uint16_t hm_limit = dtu_cmd_limit_;
+  bool enabled = dtu_cmd_enabled_;
+  
+  // A newer limit replaces any writes still queued from an older one
+  l.cmd_count = 0;
+  l.cmd_index = 0;
+  l.cmd_failed = false;
+  l.cmd_rejected = false;
   
-  bool success = true;
+  // Every port gets the same value (there is one aggregated Model 123
+  // limit), so the all-inverter registers do it in one or two writes.
+  // A failed broadcast is retried per port, and never used again once the
+  // DTU rejects it.
+  l.cmd_broadcast = !per_port && limit_broadcast_ && l.broadcast_ok && l.num_sources > 1;
+  if (l.cmd_broadcast) {
+    ESP_LOGI(TAG, "  DTU%d all ports: Setting limit to %d%%", l.index, hm_limit);
+    l.cmd_queue[l.cmd_count++] = {0xC001, hm_limit, DTU_CMD_ALL_PORTS};
+    if (enabled && hm_limit < 100) {
+      l.cmd_queue[l.cmd_count++] = {0xC000, 1, DTU_CMD_ALL_PORTS};
+    }
+    return;
+  }
   
-  // Apply to each inverter port
   for (int i = 0; i < num_sources_; i++) {
-    auto &inv = sources_[i];
+    auto &inv = dtu_src_[i];
+    if (inv.dtu != l.index) continue;
     uint8_t port = inv.port_number;
     
-    // Calculate port-specific register addresses
-    uint16_t port_limit_reg = 0xC007 + (port * 6);
-    uint16_t port_on_reg = 0xC006 + (port * 6);
-    
     ESP_LOGI(TAG, "  Port %d (%s): Setting limit to %d%%", port, inv.name, hm_limit);
     
     // Step 1: Write limit percentage
-    if (!send_dtu_fc05_(port_limit_reg, hm_limit)) {
-      ESP_LOGW(TAG, "  Port %d: Failed to set limit", port);
-      success = false;
-      continue;
-    }
+    l.cmd_queue[l.cmd_count++] = {(uint16_t)(0xC007 + (port * 6)), hm_limit, port};
     
     // Step 2: If enabled (not 100%), ensure inverter is ON
     // If disabled (100%), we just set limit to 100% and leave it running
     if (enabled && hm_limit < 100) {
-      if (!send_dtu_fc05_(port_on_reg, 1)) {
-        ESP_LOGW(TAG, "  Port %d: Failed to enable", port);
-        success = false;
-      }
+      l.cmd_queue[l.cmd_count++] = {(uint16_t)(0xC006 + (port * 6)), 1, port};
     }
   }
+}
+
+void SunSpecProxy::finish_dtu_commands_(DtuLink &l) {
+  // A round the writes cut into carries on where it stopped
+  l.state = l.round_suspended ? DtuState::TRANSFER : DtuState::IDLE;
+  l.round_suspended = false;
+  // Writes left over after an error are retried from IDLE (after a
+  // reconnect if needed) until the queue is drained or replaced
+  if (l.cmd_index < l.cmd_count) return;
   
-  if (success) {
-    ESP_LOGI(TAG, "VICTRON: Power limit forwarded successfully to %d ports", num_sources_);
+  if (l.cmd_failed && l.cmd_broadcast && l.connected) {
+    if (l.cmd_rejected) {
+      // The DTU doesn't have the all-inverter registers: don't try them again
+      ESP_LOGW(TAG, "DTU%d: Broadcast limit rejected, switching to per-port writes", l.index);
+      l.broadcast_ok = false;
+    } else {
+      // A timeout says nothing about the registers: only this limit goes per port
+      ESP_LOGW(TAG, "DTU%d: Broadcast limit failed, retrying it per port", l.index);
+    }
+    queue_power_limit_(l, true);
+    return;
+  }
+  if (l.cmd_failed) {
+    dtu_cmd_failed_ = true;
+  } else {
+    l.readback_pending = true;
+    l.readback_at_ms = millis();
+  }
+  if (dtu_cmd_links_pending_ == 0 || --dtu_cmd_links_pending_ > 0) return;
+  
+  if (!dtu_cmd_failed_) {
+    uint32_t latency = millis() - dtu_cmd_start_ms_;
+    limit_latency_ms_.store(latency, std::memory_order_relaxed);
+    limit_apply_time_.record_ms(latency);
+    ESP_LOGI(TAG, "VICTRON: Power limit forwarded successfully to %d ports in %lums%s", num_sources_,
+             (unsigned long)latency, l.cmd_broadcast ? " (broadcast)" : "");
   } else {
     ESP_LOGW(TAG, "VICTRON: Power limit forwarding had errors");
   }
@@ -835,475 +2234,1288 @@ void SunSpecProxy::forward_power_limit_(uint16_t pct_raw, bool enabled) {
 // Modbus TCP Client (DTU-Pro Polling)
 // ============================================================
 
-bool SunSpecProxy::connect_to_dtu_() {
-  if (dtu_fd_ >= 0) return true;  // Already connected
+bool SunSpecProxy::start_dtu_connect_(DtuLink &l) {
+  if (l.fd >= 0) return true;  // Already connected or connecting
   
   uint32_t now = millis();
-  if (now - last_dtu_connect_attempt_ < 5000) return false;  // Throttle reconnects
-  last_dtu_connect_attempt_ = now;
+  // Wait out the backoff, except right after a background DNS lookup finished
+  bool dns_done = l.dns_state.load(std::memory_order_acquire) == DTU_DNS_DONE;
+  if ((int32_t)(now - l.reconnect_at_ms) < 0 && !dns_done) return false;
   
-  ESP_LOGI(TAG, "DTU: Connecting to %s:%d...", dtu_host_.c_str(), dtu_port_);
+  // Address comes from the DNS cache; while a lookup is running we just
+  // try again on the next attempt
+  if (!resolve_dtu_host_(l, now)) return false;
+  if (l.connect_failures > 0) l.reconnects.fetch_add(1, std::memory_order_relaxed);
   
-  // Resolve hostname
-  struct hostent *host = gethostbyname(dtu_host_.c_str());
-  if (!host) {
-    ESP_LOGW(TAG, "DTU: DNS lookup failed for %s", dtu_host_.c_str());
-    dtu_poll_fail_count_++;
-    return false;
-  }
+  char ip[16];
+  inet_ntoa_r(l.addr.sin_addr, ip, sizeof(ip));
+  ESP_LOGI(TAG, "DTU%d: Connecting to %s:%d (%s)...", l.index, l.host.c_str(), l.port, ip);
   
   // Create socket
-  dtu_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (dtu_fd_ < 0) {
-    ESP_LOGE(TAG, "DTU: Socket create failed: errno=%d", errno);
+  l.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (l.fd < 0) {
+    ESP_LOGE(TAG, "DTU%d: Socket create failed: errno=%d", l.index, errno);
+    close_dtu_connection_(l);
     dtu_poll_fail_count_++;
     return false;
   }
+  l.backoff_ms.store(0, std::memory_order_relaxed);
   
   // Set non-blocking
-  fcntl(dtu_fd_, F_SETFL, fcntl(dtu_fd_, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(l.fd, F_SETFL, fcntl(l.fd, F_GETFL, 0) | O_NONBLOCK);
   
-  // Connect
-  struct sockaddr_in addr{};
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(dtu_port_);
-  memcpy(&addr.sin_addr, host->h_addr, host->h_length);
+  // The connection is kept open between polls. Keepalive probes notice a
+  // DTU that vanished (power cut, Wi-Fi drop) while the link is quiet, so
+  // the next round finds the socket failed (ETIMEDOUT) and reconnects at
+  // once instead of waiting for a read to time out on a half-open
+  // connection; NODELAY because every request is a single small frame.
+  int one = 1;
+  int idle = DTU_KEEPALIVE_IDLE_S, intvl = DTU_KEEPALIVE_INTERVAL_S, cnt = DTU_KEEPALIVE_COUNT;
+  setsockopt(l.fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+  setsockopt(l.fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+  setsockopt(l.fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+  setsockopt(l.fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+  setsockopt(l.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
   
-  int res = connect(dtu_fd_, (struct sockaddr *)&addr, sizeof(addr));
+  // Connect (completion is checked by check_dtu_connect_() on later loops)
+  int res = connect(l.fd, (struct sockaddr *)&l.addr, sizeof(l.addr));
   if (res < 0 && errno != EINPROGRESS) {
-    ESP_LOGW(TAG, "DTU: Connect failed: errno=%d", errno);
-    close(dtu_fd_);
-    dtu_fd_ = -1;
+    ESP_LOGW(TAG, "DTU%d: Connect failed: errno=%d", l.index, errno);
+    close_dtu_connection_(l);
     dtu_poll_fail_count_++;
+    expire_dtu_address_(l);
     return false;
   }
   
-  // Wait for connection (with timeout)
+  l.connect_start_ms = now;
+  return true;
+}
+
+int SunSpecProxy::check_dtu_connect_(DtuLink &l) {
+  // Poll for writability without waiting
   fd_set wfds;
-  struct timeval tv;
+  struct timeval tv = {0, 0};
   FD_ZERO(&wfds);
-  FD_SET(dtu_fd_, &wfds);
-  tv.tv_sec = 2;
-  tv.tv_usec = 0;
+  FD_SET(l.fd, &wfds);
   
-  res = select(dtu_fd_ + 1, nullptr, &wfds, nullptr, &tv);
-  if (res <= 0) {
-    ESP_LOGW(TAG, "DTU: Connect timeout");
-    close(dtu_fd_);
-    dtu_fd_ = -1;
-    dtu_poll_fail_count_++;
-    return false;
+  int res = select(l.fd + 1, nullptr, &wfds, nullptr, &tv);
+  if (res == 0) {
+    if (millis() - l.connect_start_ms < DTU_CONNECT_TIMEOUT_MS) return 0;
+    ESP_LOGW(TAG, "DTU%d: Connect timeout", l.index);
+  } else if (res < 0) {
+    ESP_LOGW(TAG, "DTU%d: Select error: errno=%d", l.index, errno);
+  } else {
+    // Check socket error
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(l.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (!err) {
+      l.connected = true;
+      l.connect_time.record_ms(millis() - l.connect_start_ms);
+      l.rx.reset();
+      ESP_LOGI(TAG, "DTU%d: Connected successfully", l.index);
+      return 1;
+    }
+    ESP_LOGW(TAG, "DTU%d: Connect failed: err=%d", l.index, err);
   }
   
-  // Check socket error
-  int err = 0;
-  socklen_t len = sizeof(err);
-  getsockopt(dtu_fd_, SOL_SOCKET, SO_ERROR, &err, &len);
-  if (err) {
-    ESP_LOGW(TAG, "DTU: Connect failed: err=%d", err);
-    close(dtu_fd_);
-    dtu_fd_ = -1;
+  close_dtu_connection_(l);
+  dtu_poll_fail_count_++;
+  expire_dtu_address_(l);
+  return -1;
+}
+
+void SunSpecProxy::setup_dtu_address_(DtuLink &l) {
+  l.addr.sin_family = AF_INET;
+  l.addr.sin_port = htons(l.port);
+  // IP literals never need a lookup
+  l.host_literal = inet_aton(l.host.c_str(), &l.addr.sin_addr) != 0;
+  l.addr_valid = l.host_literal;
+}
+
+void SunSpecProxy::expire_dtu_address_(DtuLink &l) {
+  // A failed connect may mean the DTU got a new DHCP lease: look the name
+  // up again on the next attempt (the old address stays in use meanwhile)
+  if (!l.host_literal) l.addr_resolved_ms = millis() - DTU_DNS_TTL_MS;
+}
+
+// The raw DNS API belongs to lwIP's thread: on ESP32 neither the loop nor
+// the DTU task is it, so the lookup is started through tcpip_callback()
+void SunSpecProxy::dtu_dns_start_(void *arg) {
+  auto *l = static_cast<DtuLink *>(arg);
+  ip_addr_t addr;
+  err_t err = dns_gethostbyname_addrtype(l->host.c_str(), &addr, dtu_dns_found_, l, LWIP_DNS_ADDRTYPE_IPV4);
+  if (err == ERR_OK) {
+    dtu_dns_found_(nullptr, &addr, l);  // Cached: no callback follows
+  } else if (err != ERR_INPROGRESS) {
+    dtu_dns_found_(nullptr, nullptr, l);
+  }
+}
+
+void SunSpecProxy::dtu_dns_found_(const char *, const ip_addr_t *ipaddr, void *arg) {
+  // Runs in the lwIP thread: only hand the result over
+  auto *l = static_cast<DtuLink *>(arg);
+  if (ipaddr == nullptr || !IP_IS_V4(ipaddr)) {
+    l->dns_state.store(DTU_DNS_FAILED, std::memory_order_release);
+    return;
+  }
+  l->dns_result.store(ip4_addr_get_u32(ip_2_ip4(ipaddr)), std::memory_order_relaxed);
+  l->dns_state.store(DTU_DNS_DONE, std::memory_order_release);
+}
+
+bool SunSpecProxy::resolve_dtu_host_(DtuLink &l, uint32_t now) {
+  if (l.host_literal) return true;
+  
+  // Collect a finished background lookup
+  uint8_t st = l.dns_state.load(std::memory_order_acquire);
+  if (st == DTU_DNS_DONE) {
+    uint32_t a = l.dns_result.load(std::memory_order_relaxed);
+    if (!l.addr_valid || a != l.addr.sin_addr.s_addr) {
+      char ip[16];
+      struct in_addr ia;
+      ia.s_addr = a;
+      inet_ntoa_r(ia, ip, sizeof(ip));
+      ESP_LOGI(TAG, "DTU%d: %s resolved to %s", l.index, l.host.c_str(), ip);
+    }
+    l.addr.sin_addr.s_addr = a;
+    l.addr_valid = true;
+    l.addr_resolved_ms = now;
+    l.dns_state.store(DTU_DNS_IDLE, std::memory_order_relaxed);
+  } else if (st == DTU_DNS_FAILED) {
+    ESP_LOGW(TAG, "DTU%d: DNS lookup failed for %s%s", l.index, l.host.c_str(),
+             l.addr_valid ? ", keeping cached address" : "");
+    l.dns_state.store(DTU_DNS_IDLE, std::memory_order_relaxed);
     dtu_poll_fail_count_++;
-    return false;
+    // Don't retry before the next connect attempt
+    return l.addr_valid;
   }
   
-  dtu_connected_ = true;
-  ESP_LOGI(TAG, "DTU: Connected successfully");
-  return true;
+  bool fresh = l.addr_valid && now - l.addr_resolved_ms < DTU_DNS_TTL_MS;
+  if (fresh || l.dns_state.load(std::memory_order_relaxed) == DTU_DNS_PENDING) return l.addr_valid;
+  
+  // Expired or never resolved: start a lookup. The callback delivers the
+  // answer and the stale address (if any) is used until then.
+  l.dns_state.store(DTU_DNS_PENDING, std::memory_order_relaxed);
+#ifdef USE_ESP32
+  err_t err = tcpip_callback(dtu_dns_start_, &l);
+  if (err != ERR_OK) {
+    ESP_LOGW(TAG, "DTU%d: DNS lookup for %s could not be started (err=%d)", l.index, l.host.c_str(), err);
+    l.dns_state.store(DTU_DNS_IDLE, std::memory_order_relaxed);
+    dtu_poll_fail_count_++;
+    return l.addr_valid;
+  }
+#else
+  dtu_dns_start_(&l);
+#endif
+  // A cached answer may already be in: use it for this attempt
+  if (l.dns_state.load(std::memory_order_acquire) != DTU_DNS_PENDING) return resolve_dtu_host_(l, now);
+  return l.addr_valid;
 }
 
-void SunSpecProxy::close_dtu_connection_() {
-  if (dtu_fd_ >= 0) {
-    close(dtu_fd_);
-    dtu_fd_ = -1;
-    dtu_connected_ = false;
+// Every way a connection ends (failed connect, send error, peer close,
+// keepalive or read timeouts) goes through here, so the next one always
+// starts with an empty pipeline and stream and waits out the backoff
+void SunSpecProxy::close_dtu_connection_(DtuLink &l) {
+  if (l.fd >= 0) {
+    close(l.fd);
+    l.fd = -1;
   }
+  l.connected = false;
+  l.rx.reset();
+  l.silent_timeouts = 0;
+  abandon_dtu_requests_(l);
+  schedule_dtu_reconnect_(l, millis());
 }
 
-bool SunSpecProxy::send_modbus_tcp_request_(uint8_t function, uint16_t reg_start, uint16_t reg_count) {
-  if (!dtu_connected_) return false;
+// Connection manager: the next connect waits DTU_BACKOFF_MIN_MS, doubling
+// with every failure in a row up to DTU_BACKOFF_MAX_MS, less a random part
+// of up to half so links (and proxies) that failed together don't retry in
+// step. A request answered resets it, a connect alone doesn't: a DTU that
+// accepts and then drops us still backs off.
+void SunSpecProxy::schedule_dtu_reconnect_(DtuLink &l, uint32_t now) {
+  uint32_t delay = DTU_BACKOFF_MIN_MS << std::min<uint8_t>(l.connect_failures, 6);
+  if (delay > DTU_BACKOFF_MAX_MS) delay = DTU_BACKOFF_MAX_MS;
+  delay -= random_uint32() % (delay / 2 + 1);
+  l.reconnect_delay_ms = delay;
+  l.reconnect_at_ms = now + delay;
+  l.backoff_ms.store(delay, std::memory_order_relaxed);
+  if (l.connect_failures < 255) l.connect_failures++;
+}
+
+// Forget the outstanding requests but keep the connection. Answers that
+// still arrive carry transaction ids nothing waits for any more and are
+// dropped by handle_dtu_response_(), which keeps the stream in step.
+void SunSpecProxy::abandon_dtu_requests_(DtuLink &l) {
+  l.inflight_count = 0;
+  l.status_inflight = false;
+}
+
+bool SunSpecProxy::send_modbus_tcp_request_(DtuLink &l, uint8_t function, uint16_t reg_start, uint16_t reg_count) {
+  if (!l.connected) return false;
   
   uint8_t frame[12];
-  put_be16(&frame[0], modbus_transaction_id_);
+  put_be16(&frame[0], l.txn_id);
   put_be16(&frame[2], 0);  // Protocol ID = 0
   put_be16(&frame[4], 6);  // Length = 6 (unit_id + function + data)
-  frame[6] = dtu_address_;
+  frame[6] = l.address;
   frame[7] = function;
   put_be16(&frame[8], reg_start);
   put_be16(&frame[10], reg_count);
   
-  int sent = send(dtu_fd_, frame, 12, 0);
+  int sent = send(l.fd, frame, 12, 0);
   if (sent != 12) {
-    ESP_LOGW(TAG, "DTU: Send failed (%d bytes, errno=%d)", sent, errno);
-    close_dtu_connection_();
+    ESP_LOGW(TAG, "DTU%d: Send failed (%d bytes, errno=%d)", l.index, sent, errno);
+    close_dtu_connection_(l);
     return false;
   }
   
-  modbus_transaction_id_++;
+  l.txn_id++;
+  l.traffic.add_tx(12);
+  l.traffic.frame_tx();
   return true;
 }
 
-int SunSpecProxy::read_modbus_tcp_response_(uint8_t *buf, int max_len) {
-  if (!dtu_connected_) return 0;
+int SunSpecProxy::read_modbus_tcp_response_(DtuLink &l) {
+  if (!l.connected) return -1;
   
-  // Read with timeout
-  fd_set rfds;
-  struct timeval tv;
-  FD_ZERO(&rfds);
-  FD_SET(dtu_fd_, &rfds);
-  tv.tv_sec = tcp_timeout_ms_ / 1000;
-  tv.tv_usec = (tcp_timeout_ms_ % 1000) * 1000;
-  
-  int res = select(dtu_fd_ + 1, &rfds, nullptr, nullptr, &tv);
-  if (res <= 0) {
-    if (res == 0) ESP_LOGW(TAG, "DTU: Read timeout");
-    else ESP_LOGW(TAG, "DTU: Select error: errno=%d", errno);
-    close_dtu_connection_();
+  // Non-blocking read into the stream decoder; times out against the
+  // oldest outstanding request
+  int n = recv(l.fd, l.rx.write_ptr(), l.rx.write_space(), MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    if (millis() - l.request_sent_ms < tcp_timeout_ms_) return 0;
+    // One late answer isn't worth a reconnect: the caller gives the
+    // outstanding requests up and the connection stays. Only timeouts in a
+    // row with nothing at all received mean the connection is half-open.
+    l.timeouts.fetch_add(1, std::memory_order_relaxed);
+    if (++l.silent_timeouts < DTU_SILENT_TIMEOUTS) {
+      ESP_LOGW(TAG, "DTU%d: Read timeout, keeping the connection", l.index);
+      return -1;
+    }
+    ESP_LOGW(TAG, "DTU%d: Read timeout, no data for %d requests, reconnecting", l.index, l.silent_timeouts);
+    close_dtu_connection_(l);
     return -1;
   }
-  
-  int n = recv(dtu_fd_, buf, max_len, 0);
-  if (n <= 0) {
-    ESP_LOGW(TAG, "DTU: Connection closed (recv=%d, errno=%d)", n, errno);
-    close_dtu_connection_();
+  if (n < 0 && errno == ETIMEDOUT) {
+    ESP_LOGW(TAG, "DTU%d: Connection lost (keepalive unanswered)", l.index);
+    close_dtu_connection_(l);
     return -1;
   }
-  
-  // Validate MBAP header
-  if (n < 8) {
-    ESP_LOGW(TAG, "DTU: Short response (%d bytes)", n);
+  if (n <= 0) {
+    ESP_LOGW(TAG, "DTU%d: Connection closed (recv=%d, errno=%d)", l.index, n, errno);
+    close_dtu_connection_(l);
     return -1;
   }
-  
-  uint16_t trans_id = be16(&buf[0]);
-  uint16_t proto_id = be16(&buf[2]);
-  uint16_t length = be16(&buf[4]);
-  
-  if (proto_id != 0) {
-    ESP_LOGW(TAG, "DTU: Invalid protocol ID: %d", proto_id);
-    return -1;
+  l.silent_timeouts = 0;
+  l.rx.commit(n);
+  l.traffic.add_rx(n);
+  return n;
+}
+
+void SunSpecProxy::process_dtu_responses_(DtuLink &l) {
+  // Hand every complete ADU to the matcher. Partial frames stay buffered
+  // until the rest of the segment arrives; garbage is skipped by the decoder.
+  uint32_t resync_before = l.rx.resync_bytes();
+  const uint8_t *frame;
+  int frame_len;
+  while ((frame_len = l.rx.next_frame(&frame)) > 0) {
+    l.traffic.frame_rx();
+    handle_dtu_response_(l, frame, frame_len);
+  }
+  if (l.rx.resync_bytes() != resync_before) {
+    ESP_LOGW(TAG, "DTU%d: Skipped %lu bytes of invalid response data", l.index,
+             (unsigned long)(l.rx.resync_bytes() - resync_before));
+  }
+}
+
+void SunSpecProxy::handle_dtu_response_(DtuLink &l, const uint8_t *resp, int n) {
+  // Match the response to its request by MBAP transaction id
+  uint16_t txn_id = be16(&resp[0]);
+  int slot = -1;
+  for (int i = 0; i < l.inflight_count; i++) {
+    if (l.inflight[i].txn_id == txn_id) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    // Usually the answer to a request that timed out
+    ESP_LOGW(TAG, "DTU%d: Unexpected response txn=%d, ignoring", l.index, txn_id);
+    l.late_responses.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  DtuInflight req = l.inflight[slot];
+  l.inflight[slot] = l.inflight[--l.inflight_count];
+  update_dtu_deadline_(l);
+  l.connect_failures = 0;
+  l.rtt.record_us(micros() - req.sent_us);
+  if (req.chunk == DTU_INFLIGHT_STATUS) {
+    l.status_inflight = false;
+    l.status_rtt_ms = millis() - req.sent_ms;
   }
   
   // Check for exception
-  if (buf[7] & 0x80) {
-    uint8_t exc = n >= 9 ? buf[8] : 0;
-    ESP_LOGW(TAG, "DTU: Modbus exception: func=0x%02X, exc=%d", buf[7], exc);
-    return -1;
+  if (resp[7] & 0x80) {
+    uint8_t exc = n >= 9 ? resp[8] : 0;
+    ESP_LOGW(TAG, "DTU%d: Modbus exception: func=0x%02X, exc=%d", l.index, resp[7], exc);
+    l.exceptions.fetch_add(1, std::memory_order_relaxed);
+    if (req.chunk == DTU_INFLIGHT_COMMAND) {
+      l.cmd_failed = true;
+      if (exc == 0x01 || exc == 0x02) l.cmd_rejected = true;
+    } else if (req.chunk == DTU_INFLIGHT_GATEWAY) {
+      // Passed on to the client; the poll itself is fine
+      l.gateway[req.cmd].exception = exc != 0 ? exc : 0x0B;
+      l.gateway[req.cmd].state.store(GATEWAY_FAILED, std::memory_order_release);
+    } else if (req.chunk == DTU_INFLIGHT_READBACK) {
+      // Nothing lost: the next round reads the same words
+    } else if (req.chunk == DTU_INFLIGHT_STATUS) {
+      // Illegal function or address: this firmware doesn't have them
+      uint8_t kind = l.status_plan[req.cmd].kind;
+      if ((exc == 0x01 || exc == 0x02) && (l.status_kinds & kind)) {
+        l.status_kinds &= ~kind;
+        ESP_LOGW(TAG, "DTU%d: No %s registers, not reading them again", l.index,
+                 kind == DTU_STATUS_PORT ? "port status" : "limit readback");
+      }
+    } else {
+      l.poll_failed = true;
+    }
+    return;
   }
   
-  return n;
+  if (req.chunk == DTU_INFLIGHT_COMMAND) {
+    const DtuCommand &cmd = l.cmd_queue[req.cmd];
+    if (!check_dtu_fc05_response_(resp, n, cmd)) {
+      ESP_LOGW(TAG, "  Port %d: Failed to write 0x%04X", cmd.port, cmd.address);
+      l.cmd_failed = true;
+    }
+    return;
+  }
+
+  if (req.chunk == DTU_INFLIGHT_STATUS) {
+    store_dtu_status_(l, req.cmd, resp, n);
+    return;
+  }
+
+  if (req.chunk == DTU_INFLIGHT_READBACK) {
+    store_dtu_readback_(l, req.cmd, resp, n);
+    return;
+  }
+
+  if (req.chunk == DTU_INFLIGHT_GATEWAY) {
+    GatewayRange &r = l.gateway[req.cmd];
+    if (n >= 9 + r.count * 2 && resp[7] == 0x03 && resp[8] >= r.count * 2) {
+      store_gateway_range_(r, &resp[9]);
+    } else {
+      ESP_LOGW(TAG, "DTU%d: Invalid response to gateway read 0x%04X", l.index, r.start);
+      r.exception = 0x0B;
+      r.state.store(GATEWAY_FAILED, std::memory_order_release);
+    }
+    return;
+  }
+  
+  if (!store_dtu_chunk_(l, resp, n, req.chunk)) l.poll_failed = true;
 }
 
-// NEW poll_dtu_data_ implementation
-void SunSpecProxy::poll_dtu_data_() {
+// Requests of the current round or readback still outstanding. A status
+// read may be in flight beside them; it is matched whenever it arrives and
+// holds nothing up.
+static uint8_t round_inflight(const DtuLink &l) {
+  return l.inflight_count - (l.status_inflight ? 1 : 0);
+}
+
+void SunSpecProxy::update_dtu_deadline_(DtuLink &l) {
+  // The read timeout runs from the oldest request still outstanding
+  if (l.inflight_count == 0) return;
   uint32_t now = millis();
+  uint32_t oldest = l.inflight[0].sent_ms;
+  for (int i = 1; i < l.inflight_count; i++) {
+    if (now - l.inflight[i].sent_ms > now - oldest) oldest = l.inflight[i].sent_ms;
+  }
+  l.request_sent_ms = oldest;
+}
+
+bool SunSpecProxy::send_dtu_read_chunk_(DtuLink &l, uint8_t chunk) {
+  const auto &c = l.read_plan[chunk];
+  uint16_t txn_id = l.txn_id;
+  if (!send_modbus_tcp_request_(l, 0x03, c.start, c.count)) {
+    ESP_LOGW(TAG, "DTU%d: Failed to send request (chunk %d)", l.index, chunk + 1);
+    return false;
+  }
+  l.inflight[l.inflight_count++] = {txn_id, chunk, 0, millis(), micros()};
+  update_dtu_deadline_(l);
+  return true;
+}
+
+bool SunSpecProxy::store_dtu_chunk_(DtuLink &l, const uint8_t *resp, int n, uint8_t chunk) {
+  const auto &c = l.read_plan[chunk];
+  if (n < 9 || resp[7] != 0x03) {
+    ESP_LOGW(TAG, "DTU%d: Invalid response chunk %d", l.index, chunk + 1);
+    return false;
+  }
   
-  // Time for next poll?
-  if (now - last_poll_time_ < poll_interval_ms_) return;
-  last_poll_time_ = now;
-  
-  // Ensure connection
-  if (!connect_to_dtu_()) {
-    ESP_LOGW(TAG, "DTU: Not connected, skipping poll");
-    return;
+  int byte_count = resp[8];
+  int reg_count_rx = byte_count / 2;
+  if (reg_count_rx < c.count || n < 9 + c.count * 2) {
+    ESP_LOGW(TAG, "DTU%d: Short response chunk %d: %d regs", l.index, chunk + 1, reg_count_rx);
+    return false;
   }
   
-  // Read all 200 registers from 0x4000 (8 MPPT channels × 25 regs)
-  // Split into two reads if needed (max 125 regs per Modbus read)
-  ESP_LOGD(TAG, "DTU: Reading %d registers from 0x%04X", HM_TOTAL_REGS, HM_DATA_BASE);
+  // Keep only the used span of each channel block, and note which blocks
+  // differ from the previous poll (the DTU refreshes an inverter only every
+  // few tens of seconds, so most polls change nothing)
+  uint16_t *dst = &l.regs[c.first_channel * HM_CHANNEL_REGS];
+  for (int ch = 0; ch < c.channels; ch++) {
+    const uint8_t *src = &resp[9 + ch * HM_MPPT_STRIDE * 2];
+    uint16_t diff = 0;
+    for (int i = 0; i < HM_CHANNEL_REGS; i++) {
+      uint16_t v = be16(&src[i * 2]);
+      diff |= v ^ *dst;
+      *dst++ = v;
+    }
+    if (diff != 0) l.dirty[c.first_channel + ch] = 1;
+  }
+
+  // Gateway misses inside this read come along for free
+  if (l.gateway != nullptr) {
+    for (uint8_t i = 0; i < GATEWAY_RANGES; i++) {
+      GatewayRange &r = l.gateway[i];
+      if (r.plan_chunk == chunk && r.state.load(std::memory_order_relaxed) == GATEWAY_FETCHING) {
+        store_gateway_range_(r, &resp[9 + (r.start - c.start) * 2]);
+      }
+    }
+  }
+  return true;
+}
+
+void SunSpecProxy::build_dtu_read_plan_(DtuLink &l) {
+  // Read exactly the channels the configured inverters occupy: one per
+  // panel input (the DTU reports 2T models as two channels). A DTU with
+  // inverters that aren't configured here needs dtu_channels instead.
+  uint16_t channels = l.channels_override;
+  if (channels == 0) {
+    for (int i = 0; i < num_sources_; i++) {
+      if (sources_[i].dtu != l.index) continue;
+      uint8_t n = get_model_channel_count(sources_[i].model);
+      channels += n > 0 ? n : sources_[i].mppt_inputs;
+    }
+  }
+  if (channels > HM_MAX_CHANNELS) channels = HM_MAX_CHANNELS;
   
-  // Read first 125 registers
-  if (!send_modbus_tcp_request_(0x03, HM_DATA_BASE, 125)) {
-    ESP_LOGW(TAG, "DTU: Failed to send request (chunk 1)");
-    dtu_poll_fail_count_++;
+  // Split into ≤125-register reads on channel boundaries. Each read stops
+  // at the used span of its last block, so the unused tail between two
+  // reads is never fetched.
+  l.read_plan.clear();
+  l.read_regs = 0;
+  for (uint16_t ch = 0; ch < channels; ch += HM_CHANNELS_PER_READ) {
+    uint16_t n = channels - ch;
+    if (n > HM_CHANNELS_PER_READ) n = HM_CHANNELS_PER_READ;
+    uint16_t count = (n - 1) * HM_MPPT_STRIDE + HM_CHANNEL_REGS;
+    l.read_plan.push_back({(uint16_t)(HM_DATA_BASE + ch * HM_MPPT_STRIDE), count, ch, n});
+    l.read_regs += count;
+  }
+  l.read_chunks = l.read_plan.size();
+  l.regs.assign(channels * HM_CHANNEL_REGS, 0);
+  l.dirty.assign(channels, 1);
+  l.channel_map.assign(channels, DtuChannelMap{});
+  l.channels = channels;
+  l.channel_map_valid = false;
+  ESP_LOGI(TAG, "DTU%d read plan: %d channels, %d registers in %d requests, pipeline depth %d",
+           l.index, channels, l.read_regs, l.read_chunks, dtu_pipeline_depth_);
+}
+
+// Status lane. Alarms, link status and the limit the DTU holds change
+// rarely and nothing downstream waits for them, so they are read once per
+// status_interval_ms_: two small reads per inverter, the port record and
+// its control registers. A read is only started on an otherwise idle link
+// when its answer is expected before the next round comes due. A round or
+// queued write that comes due anyway doesn't wait for it: the read stays
+// in flight outside the pipeline depth and is matched when it arrives.
+void SunSpecProxy::build_dtu_status_plan_(DtuLink &l) {
+  l.status_plan.clear();
+  for (int i = 0; i < num_sources_; i++) {
+    const RtuSource &s = sources_[i];
+    if (s.dtu != l.index) continue;
+    l.status_plan.push_back(
+        {(uint16_t)(HM_PORT_BASE + s.port_number * HM_PORT_STRIDE), HM_PORT_REGS, (uint8_t) i, DTU_STATUS_PORT});
+    l.status_plan.push_back(
+        {(uint16_t)(HM_CTRL_BASE + s.port_number * HM_CTRL_STRIDE), HM_CTRL_REGS, (uint8_t) i, DTU_STATUS_LIMIT});
+  }
+  if (status_interval_ms_ > 0 && !l.status_plan.empty()) {
+    ESP_LOGI(TAG, "DTU%d status lane: %d reads every %lus", l.index, (int) l.status_plan.size(),
+             (unsigned long) (status_interval_ms_ / 1000));
+  }
+}
+
+bool SunSpecProxy::start_dtu_status_read_(DtuLink &l, uint32_t now) {
+  if (status_interval_ms_ == 0 || l.status_inflight || !l.connected) return false;
+  if (l.status_next == 0 && l.status_pass_ms != 0 && now - l.status_pass_ms < status_interval_ms_) return false;
+  if ((int32_t)(poll_due_ms_ - now) < (int32_t)(l.status_rtt_ms + POLL_ALIGN_MARGIN_MS)) return false;
+
+  // Skip what the DTU turned out not to have
+  while (l.status_next < l.status_plan.size() && !(l.status_kinds & l.status_plan[l.status_next].kind)) {
+    l.status_next++;
+  }
+  if (l.status_next >= l.status_plan.size()) {
+    l.status_next = 0;
+    return false;
+  }
+  if (l.status_next == 0) l.status_pass_ms = now;
+
+  uint8_t entry = l.status_next;
+  const DtuStatusRead &r = l.status_plan[entry];
+  uint16_t txn_id = l.txn_id;
+  if (!send_modbus_tcp_request_(l, 0x03, r.start, r.count)) return false;
+  l.inflight[l.inflight_count++] = {txn_id, DTU_INFLIGHT_STATUS, entry, now, micros()};
+  update_dtu_deadline_(l);
+  l.status_inflight = true;
+  if (++l.status_next >= l.status_plan.size()) l.status_next = 0;
+  return true;
+}
+
+void SunSpecProxy::store_dtu_status_(DtuLink &l, uint8_t entry, const uint8_t *resp, int n) {
+  const DtuStatusRead &r = l.status_plan[entry];
+  if (n < 9 + r.count * 2 || resp[7] != 0x03 || resp[8] < r.count * 2) {
+    ESP_LOGW(TAG, "DTU%d: Invalid response to status read 0x%04X", l.index, r.start);
     return;
   }
-  
-  uint8_t resp[512];
-  int n = read_modbus_tcp_response_(resp, sizeof(resp));
-  if (n < 0) {
-    ESP_LOGW(TAG, "DTU: Failed to read response (chunk 1)");
-    dtu_poll_fail_count_++;
+  const uint8_t *data = &resp[9];
+  RtuSource &s = dtu_src_[r.source];
+  l.status_reads.fetch_add(1, std::memory_order_relaxed);
+
+  if (r.kind == DTU_STATUS_LIMIT) {
+    uint16_t limit = be16(&data[2]);
+    s.limit_pct = limit > 100 ? 100 : limit;
+    trace_.record(TraceEvent::DTU_STATUS, r.source, r.kind, be16(&data[0]), limit);
     return;
   }
-  
-  // Parse first chunk
-  if (n >= 9 && resp[7] == 0x03) {
-    uint8_t byte_count = resp[8];
-    int reg_count = byte_count / 2;
-    if (reg_count >= 125) {
-      for (int i = 0; i < 125; i++) {
-        dtu_regs_[i] = be16(&resp[9 + i * 2]);
+
+  // The record names its inverter in bytes 1-6; a port that holds another
+  // one (the port numbers in the config are off) must not be taken for it
+  uint64_t key = 0;
+  for (int i = 1; i <= 6; i++) key = (key << 8) | data[i];
+  if (s.sn_key != 0 && key != s.sn_key) {
+    ESP_LOGD(TAG, "DTU%d: Port %d reports SN=%012llx, not %s", l.index, s.port_number, (unsigned long long) key,
+             s.serial_number);
+    return;
+  }
+  uint16_t alarm_code = be16(&data[HM_ALARM_CODE * 2]);
+  if (alarm_code != s.alarm_code && alarm_code != 0) {
+    ESP_LOGI(TAG, "%s: Alarm %u (%u alarms)", s.name, alarm_code, be16(&data[HM_ALARM_COUNT * 2]));
+  }
+  s.operating_status = be16(&data[HM_OPERATING_STATUS * 2]);
+  s.alarm_code = alarm_code;
+  s.alarm_count = be16(&data[HM_ALARM_COUNT * 2]);
+  s.link_status = data[HM_LINK_STATUS * 2];
+  trace_.record(TraceEvent::DTU_STATUS, r.source, r.kind, ((uint32_t) s.alarm_code << 16) | s.operating_status,
+                ((uint32_t) s.alarm_count << 8) | s.link_status);
+}
+
+// Quick readback. Once a link's limit writes are acknowledged, the power
+// words of its mapped channels are read at once and then every
+// LIMIT_READBACK_INTERVAL_MS, between rounds, until the aggregate shows the
+// limit (or check_limit_effect_() gives up). A lifted limit gets one
+// readback. Only the power is decoded; the next round brings the rest.
+bool SunSpecProxy::start_dtu_readback_(DtuLink &l, uint32_t now) {
+  if (!l.readback_pending || !l.connected || !l.channel_map_valid) return false;
+  if ((int32_t)(now - l.readback_at_ms) < 0) return false;
+  // A round that comes due first reads the power anyway
+  if ((int32_t)(poll_due_ms_ - now) < (int32_t)(l.readback_rtt_ms + POLL_ALIGN_MARGIN_MS)) return false;
+
+  // Runs of mapped channels, ≤125 registers from the first power word
+  // to the last
+  l.readback_plan.clear();
+  for (uint16_t ch = 0; ch < l.channels; ch++) {
+    if (l.channel_map[ch].inv < 0) continue;
+    if (!l.readback_plan.empty()) {
+      DtuReadChunk &c = l.readback_plan.back();
+      uint16_t count = (ch - c.first_channel) * HM_MPPT_STRIDE + 1;
+      if (count <= HM_MAX_READ_REGS) {
+        c.count = count;
+        c.channels = ch - c.first_channel + 1;
+        continue;
       }
-    } else {
-      ESP_LOGW(TAG, "DTU: Short response chunk 1: %d regs", reg_count);
-      dtu_poll_fail_count_++;
-      return;
     }
-  } else {
-    ESP_LOGW(TAG, "DTU: Invalid response chunk 1");
-    dtu_poll_fail_count_++;
+    l.readback_plan.push_back({(uint16_t)(HM_DATA_BASE + ch * HM_MPPT_STRIDE + HM_POWER), 1, ch, 1});
+  }
+  if (l.readback_plan.empty()) {
+    l.readback_pending = false;
+    return false;
+  }
+  l.readback_next = 0;
+  l.readback_start_ms = now;
+  return true;
+}
+
+void SunSpecProxy::store_dtu_readback_(DtuLink &l, uint8_t entry, const uint8_t *resp, int n) {
+  const DtuReadChunk &c = l.readback_plan[entry];
+  if (n < 9 + c.count * 2 || resp[7] != 0x03 || resp[8] < c.count * 2) {
+    ESP_LOGW(TAG, "DTU%d: Invalid response to readback 0x%04X", l.index, c.start);
     return;
   }
+  l.readbacks.fetch_add(1, std::memory_order_relaxed);
+  for (uint16_t k = 0; k < c.channels; k++) {
+    uint16_t ch = c.first_channel + k;
+    const auto &e = l.channel_map[ch];
+    if (e.inv < 0) continue;
+    uint16_t power = be16(&resp[9 + k * HM_MPPT_STRIDE * 2]);
+    uint16_t &stored = l.regs[ch * HM_CHANNEL_REGS + HM_POWER];
+    if (power == stored) continue;
+    // Kept in the raw block too, so the next round only re-decodes the
+    // channel if something else moved
+    stored = power;
+    dtu_src_[e.inv].mppt[e.slot].power_dw = power;
+    dirty_sources_.set(e.inv);
+  }
+}
+
+void SunSpecProxy::finish_dtu_readback_(DtuLink &l, uint32_t now) {
+  l.state = DtuState::IDLE;
+  if (l.readback_next < l.readback_plan.size()) return;  // Cut short: try again
+  l.readback_rtt_ms = now - l.readback_start_ms;
+  for (int i = 0; i < num_sources_; i++) {
+    if (dtu_src_[i].dtu == l.index && dirty_sources_.test(i)) aggregate_inverter_data_(i, now);
+  }
+  if (dirty_sources_.any()) aggregate_and_update_registers_();
+  check_limit_effect_();
+  l.readback_pending = limit_effect_pending_;
+  l.readback_at_ms = now + LIMIT_READBACK_INTERVAL_MS;
+}
+
+// Limit-to-effect latency: from the Victron write to the first aggregate
+// at or below the limit (plus LIMIT_EFFECT_MARGIN_PCT of rated power), as
+// served to the GX. Measured for limits below the power at the time only.
+void SunSpecProxy::check_limit_effect_() {
+  if (!limit_effect_pending_) return;
+  uint32_t elapsed = millis() - dtu_cmd_start_ms_;
+  if (dtu_result_.agg_power_dw <= limit_effect_target_dw_) {
+    limit_effect_pending_ = false;
+    limit_effect_time_.record_ms(elapsed);
+    ESP_LOGI(TAG, "VICTRON: Limit %d%% in effect after %lums (%.0fW)", dtu_cmd_limit_, (unsigned long) elapsed,
+             dtu_result_.agg_power_dw / 10.0f);
+  } else if (elapsed > LIMIT_EFFECT_TIMEOUT_MS) {
+    limit_effect_pending_ = false;
+    limit_effect_timeouts_.fetch_add(1, std::memory_order_relaxed);
+    ESP_LOGW(TAG, "VICTRON: Limit %d%% not in effect after %lus (%.0fW)", dtu_cmd_limit_,
+             (unsigned long) (elapsed / 1000), dtu_result_.agg_power_dw / 10.0f);
+  }
+}
+
+// DTU polling. Each configured DTU has its own link state machine; all of
+// them are stepped on every call, so their requests are in flight at the
+// same time and a poll round takes as long as the slowest DTU, not the sum.
+//
+// A round starts poll_delay_ms_ after the previous one (see
+// schedule_next_poll_()) by flagging every link. When the last flagged link
+// has finished (parsed or failed), the parsed channels of all links are
+// aggregated into the one SunSpec device.
+void SunSpecProxy::poll_dtu_data_() {
+  uint32_t now = millis();
   
-  // Read remaining 75 registers
-  if (!send_modbus_tcp_request_(0x03, HM_DATA_BASE + 125, 75)) {
-    ESP_LOGW(TAG, "DTU: Failed to send request (chunk 2)");
-    dtu_poll_fail_count_++;
-    return;
+  take_power_limit_request_();
+  
+  // A new limit shouldn't wait out a normal delay
+  uint32_t delay = poll_delay_ms_;
+  if (poll_mode_ == PollMode::NORMAL && limit_active_.load(std::memory_order_relaxed) &&
+      delay > poll_fast_interval_ms_) {
+    delay = poll_fast_interval_ms_;
+  }
+  // A gateway miss brings the round forward, though never closer to the
+  // last one than the fast interval
+  bool gateway_due = gateway_wanted_.load(std::memory_order_relaxed) && now - last_poll_time_ >= poll_fast_interval_ms_;
+  poll_due_ms_ = last_poll_time_ + delay;
+  if (!dtu_round_active_ && (now - last_poll_time_ >= delay || gateway_due)) {
+    last_poll_time_ = now;
+    dtu_round_active_ = true;
+    gateway_wanted_.store(false, std::memory_order_relaxed);
+    dtu_round_parsed_ = false;
+    for (int d = 0; d < num_dtus_; d++) dtu_links_[d].poll_requested = true;
   }
   
-  n = read_modbus_tcp_response_(resp, sizeof(resp));
-  if (n < 0) {
-    ESP_LOGW(TAG, "DTU: Failed to read response (chunk 2)");
-    dtu_poll_fail_count_++;
-    return;
+  bool round_pending = false;
+  for (int d = 0; d < num_dtus_; d++) {
+    DtuLink &l = dtu_links_[d];
+    poll_dtu_link_(l, now);
+    if (l.poll_requested) round_pending = true;
   }
   
-  // Parse second chunk
-  if (n >= 9 && resp[7] == 0x03) {
-    uint8_t byte_count = resp[8];
-    int reg_count = byte_count / 2;
-    if (reg_count >= 75) {
-      for (int i = 0; i < 75; i++) {
-        dtu_regs_[125 + i] = be16(&resp[9 + i * 2]);
+  if (dtu_round_active_ && !round_pending) {
+    dtu_round_active_ = false;
+    dtu_round_ms_ = now - last_poll_time_;
+    expire_stale_sources_();
+    // Update SunSpec registers from every link's latest channel data
+    if (dtu_round_parsed_ || dirty_sources_.any()) aggregate_and_update_registers_();
+    check_limit_effect_();
+    schedule_next_poll_(now, dtu_round_parsed_);
+  }
+}
+
+// Pick the delay of the next round from what the last one saw:
+//   IDLE   after POLL_IDLE_ROUNDS rounds in which no inverter produced
+//   FAST   while a Model 123 limit is active, or for POLL_FAST_HOLD_MS after
+//          total power moved by more than poll_fast_power_step_ × rated
+//   NORMAL otherwise (also while no DTU answers, so reconnects aren't slowed)
+void SunSpecProxy::schedule_next_poll_(uint32_t now, bool parsed) {
+  bool producing = false;
+  if (parsed) {
+    // Producing = any power, or any channel in the DTU's "producing" status
+    for (int i = 0; i < num_sources_ && !producing; i++) {
+      const auto &src = dtu_src_[i];
+      if (!src.data_valid) continue;
+      producing = src.producing;
+      for (int m = 0; m < src.mppt_count && !producing; m++) {
+        producing = src.mppt[m].data_valid && src.mppt[m].status == 3;
       }
-      dtu_data_valid_ = true;
-      dtu_poll_count_++;
-      last_dtu_poll_ok_ms_ = now;
-    } else {
-      ESP_LOGW(TAG, "DTU: Short response chunk 2: %d regs", reg_count);
-      dtu_poll_fail_count_++;
-      return;
     }
-  } else {
-    ESP_LOGW(TAG, "DTU: Invalid response chunk 2");
-    dtu_poll_fail_count_++;
-    return;
+    poll_idle_rounds_ = producing ? 0 : (poll_idle_rounds_ < 255 ? poll_idle_rounds_ + 1 : 255);
+    
+    int64_t power_dw = dtu_result_.agg_power_dw;
+    int64_t step_dw = (int64_t) (poll_fast_power_step_ * agg_config_.rated_power_w * 10.0f);
+    if (step_dw > 0 && poll_last_power_dw_ >= 0 && std::abs(power_dw - poll_last_power_dw_) > step_dw) {
+      poll_fast_until_ms_ = now + POLL_FAST_HOLD_MS;
+    }
+    poll_last_power_dw_ = power_dw;
   }
   
-  ESP_LOGI(TAG, "DTU: Successfully read 200 registers (poll count: %lu)", dtu_poll_count_);
-  
-  // Parse register data
-  parse_dtu_registers_(dtu_regs_, HM_TOTAL_REGS);
+  // Idle wins: a limit the GX keeps set overnight has nothing to control
+  PollMode mode = PollMode::NORMAL;
+  if (parsed && poll_idle_interval_ms_ > 0 && poll_idle_rounds_ >= POLL_IDLE_ROUNDS) {
+    mode = PollMode::IDLE;
+  } else if (!parsed && poll_mode_ == PollMode::IDLE) {
+    mode = PollMode::IDLE;  // Keep backing off when the DTUs go quiet at night
+  } else if (limit_active_.load(std::memory_order_relaxed) || (int32_t)(poll_fast_until_ms_ - now) > 0) {
+    mode = PollMode::FAST;
+  }
   
-  // Map MPPT channels to inverters
-  map_mppt_to_inverters_();
+  uint32_t delay = poll_interval_ms_;
+  if (mode == PollMode::FAST) delay = poll_fast_interval_ms_;
+  else if (mode == PollMode::IDLE) delay = poll_idle_interval_ms_;
+  if (mode != PollMode::IDLE) delay = align_poll_delay_(delay);
   
-  // Aggregate per-inverter data
-  for (int i = 0; i < num_sources_; i++) {
-    aggregate_inverter_data_(i);
+  if (mode != poll_mode_) {
+    static const char *const names[] = {"normal", "idle", "fast"};
+    ESP_LOGI(TAG, "DTU: Poll scheduler %s → %s (every %lums)", names[(int)poll_mode_], names[(int)mode],
+             (unsigned long)(mode == PollMode::FAST ? poll_fast_interval_ms_
+                              : mode == PollMode::IDLE ? poll_idle_interval_ms_ : poll_interval_ms_));
+    poll_mode_ = mode;
   }
-  
-  // Update SunSpec registers
-  aggregate_and_update_registers_();
+  poll_delay_ms_ = delay;
+  stale_limit_ms_.store(std::max(stale_timeout_ms_, 2 * delay), std::memory_order_relaxed);
 }
 
-void SunSpecProxy::parse_dtu_registers_(const uint16_t *regs, int reg_count) {
-  ESP_LOGD(TAG, "DTU: Parsing %d registers into MPPT channel data", reg_count);
+// Shift the next round by up to a quarter of its delay so it completes
+// just before one of the client's expected reads (last read + k × period,
+// minus the last round's duration and a margin).
+uint32_t SunSpecProxy::align_poll_delay_(uint32_t delay) const {
+  uint32_t period = client_read_period_ms_.load(std::memory_order_relaxed);
+  uint32_t last_read = client_read_ms_.load(std::memory_order_relaxed);
+  if (!poll_align_ || period == 0) return delay;
+  // Only follow a client that is still reading
+  if (millis() - last_read > 3 * period) return delay;
   
-  // Clear all inverter MPPT data first
-  for (int i = 0; i < num_sources_; i++) {
-    sources_[i].mppt_count = 0;
-    for (int m = 0; m < MAX_MPPT_PER_INVERTER; m++) {
-      sources_[i].mppt[m].data_valid = false;
-    }
-  }
+  uint32_t due = last_poll_time_ + delay;
+  uint32_t target = last_read + period - dtu_round_ms_ - POLL_ALIGN_MARGIN_MS;
+  int32_t err = (int32_t)(due - target) % (int32_t)period;
+  if (err < 0) err += period;
+  if (err > (int32_t)period / 2) err -= period;  // Nearest target, early or late
   
-  // Parse each 25-register block
-  int channels_found = 0;
-  for (int ch = 0; ch < HM_MAX_CHANNELS && ch * HM_MPPT_STRIDE < reg_count; ch++) {
-    const uint16_t *ch_regs = &regs[ch * HM_MPPT_STRIDE];
+  // Too far off either way (client and poll cadence differ a lot): a
+  // partial shift would only move the poll to just after a read
+  int32_t max_shift = delay / 4;
+  if (err > max_shift || err < -max_shift) return delay;
+  return delay - err;
+}
+
+void SunSpecProxy::note_client_read_(uint16_t start_reg, uint16_t count) {
+  // Reads of the inverter block mark the client's poll cycle; further reads
+  // inside the same burst (other models) don't
+  uint16_t off = start_reg - SUNSPEC_BASE;
+  if (off > SunSpecMap::data<Inv>() || off + count <= SunSpecMap::data<Inv>()) return;
+  uint32_t now = millis();
+  uint32_t last = client_read_ms_.load(std::memory_order_relaxed);
+  uint32_t interval = now - last;
+  if (last != 0 && interval < CLIENT_READ_BURST_MS) return;
+  client_read_ms_.store(now, std::memory_order_relaxed);
+  if (last == 0 || interval > 60000) return;
+  uint32_t period = client_read_period_ms_.load(std::memory_order_relaxed);
+  // Exponential average (1/4 weight), seeded with the first interval
+  period = period == 0 ? interval : period + ((int32_t)(interval - period)) / 4;
+  client_read_period_ms_.store(period, std::memory_order_relaxed);
+}
+
+// Link state machine. Each call performs at most one non-blocking step so
+// the Modbus server is never held up by a slow or unreachable DTU:
+//
+//   IDLE → CONNECTING → IDLE → TRANSFER → PARSE → IDLE
+//
+// TRANSFER keeps up to dtu_pipeline_depth_ read requests of the plan in
+// flight and matches responses back by transaction id, so a poll costs
+// about one round-trip instead of one per chunk.
+//
+// Queued power limit writes (SEND_COMMAND/AWAIT_COMMAND) are drained from
+// IDLE before the next poll starts.
+void SunSpecProxy::poll_dtu_link_(DtuLink &l, uint32_t now) {
+  switch (l.state) {
+    case DtuState::IDLE: {
+      bool cmd_pending = l.cmd_index < l.cmd_count;
+      if (!l.poll_requested && !cmd_pending) {
+        if (start_dtu_readback_(l, now)) {
+          l.state = DtuState::READBACK;
+        } else if (start_dtu_status_read_(l, now)) {
+          l.state = DtuState::STATUS;
+        }
+        return;
+      }
+      
+      // Ensure connection
+      if (!l.connected) {
+        if (start_dtu_connect_(l)) {
+          l.state = DtuState::CONNECTING;
+        } else if (l.poll_requested) {
+          l.poll_requested = false;
+          int32_t wait_ms = (int32_t)(l.reconnect_at_ms - now);
+          ESP_LOGW(TAG, "DTU%d: Not connected, skipping poll (next connect in %lds)", l.index,
+                   (long)(wait_ms > 0 ? (wait_ms + 999) / 1000 : 0));
+          // Gateway clients get their exception now instead of a timeout
+          collect_gateway_fetches_(l);
+          fail_gateway_fetches_(l);
+        }
+        return;
+      }
+      
+      if (cmd_pending) {
+        l.state = DtuState::SEND_COMMAND;
+        return;
+      }
+      
+      ESP_LOGD(TAG, "DTU%d: Reading %d registers from 0x%04X", l.index, l.read_regs, HM_DATA_BASE);
+      l.next_chunk = 0;
+      if (!l.status_inflight) l.inflight_count = 0;
+      l.poll_failed = false;
+      collect_gateway_fetches_(l);
+      l.state = DtuState::TRANSFER;
+      return;
+    }
     
-    // Check marker
-    uint16_t marker = ch_regs[HM_MARKER];
-    if (marker != 12) {
-      ESP_LOGV(TAG, "DTU: Channel %d marker invalid (%d), skipping", ch, marker);
-      continue;
+    case DtuState::CONNECTING: {
+      int res = check_dtu_connect_(l);
+      if (res != 0) l.state = DtuState::IDLE;
+      return;
     }
     
-    // Extract inverter serial number (3 regs = 6 bytes)
-    char inv_sn[13];
-    uint8_t sn_bytes[6];
-    sn_bytes[0] = (ch_regs[HM_INV_SN_1] >> 8) & 0xFF;
-    sn_bytes[1] = ch_regs[HM_INV_SN_1] & 0xFF;
-    sn_bytes[2] = (ch_regs[HM_INV_SN_2] >> 8) & 0xFF;
-    sn_bytes[3] = ch_regs[HM_INV_SN_2] & 0xFF;
-    sn_bytes[4] = (ch_regs[HM_INV_SN_3] >> 8) & 0xFF;
-    sn_bytes[5] = ch_regs[HM_INV_SN_3] & 0xFF;
+    case DtuState::STATUS: {
+      // A round or write that comes due goes ahead; the answer is matched
+      // whenever it arrives
+      if (l.poll_requested || l.cmd_index < l.cmd_count) {
+        l.state = DtuState::IDLE;
+        poll_dtu_link_(l, now);
+        return;
+      }
+      int n = read_modbus_tcp_response_(l);
+      if (n == 0) return;
+      if (n > 0) process_dtu_responses_(l);
+      if (n < 0) abandon_dtu_requests_(l);
+      if (!l.status_inflight) l.state = DtuState::IDLE;
+      return;
+    }
     
-    for (int j = 0; j < 6; j++) {
-      snprintf(&inv_sn[j*2], 3, "%02x", sn_bytes[j]);
+    case DtuState::READBACK: {
+      // Writes go first: no further readback goes out while one waits
+      uint8_t depth = dtu_pipeline_depth_ + (l.status_inflight ? 1 : 0);
+      while (l.cmd_index >= l.cmd_count && l.readback_next < l.readback_plan.size() && l.inflight_count < depth) {
+        const DtuReadChunk &c = l.readback_plan[l.readback_next];
+        uint16_t txn_id = l.txn_id;
+        if (!send_modbus_tcp_request_(l, 0x03, c.start, c.count)) break;
+        l.inflight[l.inflight_count++] = {txn_id, DTU_INFLIGHT_READBACK, l.readback_next, now, micros()};
+        update_dtu_deadline_(l);
+        l.readback_next++;
+      }
+      if (round_inflight(l) > 0) {
+        int n = read_modbus_tcp_response_(l);
+        if (n == 0) return;
+        if (n > 0) {
+          process_dtu_responses_(l);
+          return;
+        }
+        abandon_dtu_requests_(l);
+      }
+      finish_dtu_readback_(l, now);
+      return;
     }
-    inv_sn[12] = 0;
     
-    // Extract MPPT number
-    uint16_t mppt_num = ch_regs[HM_MPPT_NUM];
+    case DtuState::TRANSFER: {
+      // Queued writes have strict priority over the round: no further read
+      // goes out while one waits, so it takes the next free pipeline slot.
+      // The reads in flight are answered as usual, in between.
+      if (l.cmd_index < l.cmd_count && l.connected && !l.poll_failed) {
+        l.round_suspended = true;
+        l.state = DtuState::SEND_COMMAND;
+        poll_dtu_link_(l, now);
+        return;
+      }
+      // Top up the pipeline: the plan, then the gateway's own reads
+      uint8_t requests = l.read_chunks + l.gateway_fetches;
+      uint8_t depth = dtu_pipeline_depth_ + (l.status_inflight ? 1 : 0);
+      while (!l.poll_failed && l.next_chunk < requests && l.inflight_count < depth) {
+        bool sent = l.next_chunk < l.read_chunks
+                        ? send_dtu_read_chunk_(l, l.next_chunk)
+                        : send_gateway_fetch_(l, l.gateway_fetch[l.next_chunk - l.read_chunks]);
+        if (!sent) {
+          abandon_dtu_requests_(l);
+          break;
+        }
+        l.next_chunk++;
+      }
+      if (!l.connected) break;
+      
+      if (round_inflight(l) > 0) {
+        uint8_t outstanding = round_inflight(l);
+        int n = read_modbus_tcp_response_(l);
+        if (n == 0) return;  // Not arrived yet
+        if (n < 0) {
+          ESP_LOGW(TAG, "DTU%d: Failed to read response (%d of %d chunks outstanding)",
+                   l.index, outstanding, l.read_chunks);
+          abandon_dtu_requests_(l);
+          break;
+        }
+        process_dtu_responses_(l);
+        if (round_inflight(l) > 0) return;
+      }
+      
+      if (l.poll_failed) break;
+      if (l.next_chunk >= requests) l.state = DtuState::PARSE;
+      return;
+    }
     
-    // Find matching inverter by serial number
-    int inv_idx = -1;
-    for (int i = 0; i < num_sources_; i++) {
-      if (strlen(sources_[i].serial_number) > 0 && strcmp(sources_[i].serial_number, inv_sn) == 0) {
-        inv_idx = i;
-        break;
+    case DtuState::PARSE:
+      dtu_poll_count_++;
+      last_dtu_poll_ok_ms_ = now;
+      trace_.record(TraceEvent::DTU_READ, l.index, l.read_regs, dtu_poll_count_.load());
+      
+      // Map MPPT channels to inverters (cached between polls)
+      map_mppt_to_inverters_(l);
+      
+      // Parse register data
+      parse_dtu_registers_(l);
+      
+      // Aggregate per-inverter data
+      aggregate_dtu_inverters_(l);
+      
+      dtu_round_parsed_ = true;
+      l.poll_requested = false;
+      // The round just read the power too
+      if (l.readback_pending) l.readback_at_ms = now + LIMIT_READBACK_INTERVAL_MS;
+      l.state = DtuState::IDLE;
+      return;
+    
+    case DtuState::SEND_COMMAND: {
+      // Pipeline the queued writes; the DTU executes them in order
+      uint8_t depth = dtu_pipeline_depth_ + (l.status_inflight ? 1 : 0);
+      while (l.cmd_index < l.cmd_count && l.inflight_count < depth) {
+        uint8_t idx = l.cmd_index;
+        const DtuCommand &cmd = l.cmd_queue[idx];
+        uint16_t txn_id = l.txn_id;
+        if (!send_dtu_fc05_(l, cmd.address, cmd.value)) {
+          ESP_LOGW(TAG, "  Port %d: Failed to send write 0x%04X", cmd.port, cmd.address);
+          l.cmd_failed = true;
+          abandon_dtu_requests_(l);
+          finish_dtu_commands_(l);
+          return;
+        }
+        l.inflight[l.inflight_count++] = {txn_id, DTU_INFLIGHT_COMMAND, idx, now, micros()};
+        l.cmd_index++;
       }
+      update_dtu_deadline_(l);
+      l.state = DtuState::AWAIT_COMMAND;
+      return;
     }
     
+    case DtuState::AWAIT_COMMAND: {
+      int n = read_modbus_tcp_response_(l);
+      if (n == 0) return;
+      if (n < 0) {
+        ESP_LOGW(TAG, "DTU%d FC05: No response (%d writes outstanding)", l.index, l.inflight_count);
+        l.cmd_failed = true;
+        // Any reads of a preempted round went with them
+        if (l.round_suspended) l.poll_failed = true;
+        abandon_dtu_requests_(l);
+      } else {
+        process_dtu_responses_(l);
+        if (l.cmd_index < l.cmd_count && !l.cmd_failed) {
+          l.state = DtuState::SEND_COMMAND;  // Top up the pipeline
+          return;
+        }
+        if (l.inflight_count > 0) return;
+      }
+      finish_dtu_commands_(l);
+      return;
+    }
+  }
+  
+  // Poll step failed
+  dtu_poll_fail_count_++;
+  fail_gateway_fetches_(l);
+  l.poll_requested = false;
+  l.state = DtuState::IDLE;
+}
+
+void SunSpecProxy::build_sn_index_() {
+  // Sorted (key, source) table for binary search; built once at setup
+  sn_index_count_ = 0;
+  for (int i = 0; i < num_sources_; i++) {
+    uint64_t key = sources_[i].sn_key;
+    if (key == 0) continue;
+    int pos = sn_index_count_;
+    while (pos > 0 && sn_index_[pos - 1].key > key) {
+      sn_index_[pos] = sn_index_[pos - 1];
+      pos--;
+    }
+    if (pos > 0 && sn_index_[pos - 1].key == key) {
+      ESP_LOGW(TAG, "Serial %s is configured twice, '%s' will never match",
+               sources_[i].serial_number, sources_[i].name);
+      for (int j = pos; j < sn_index_count_; j++) sn_index_[j] = sn_index_[j + 1];
+      continue;
+    }
+    sn_index_[pos] = {key, (SourceIndex)i};
+    sn_index_count_++;
+  }
+}
+
+int SunSpecProxy::find_source_by_sn_(uint64_t key) const {
+  int lo = 0, hi = sn_index_count_ - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (sn_index_[mid].key == key) return sn_index_[mid].inv;
+    if (sn_index_[mid].key < key) lo = mid + 1; else hi = mid - 1;
+  }
+  return -1;
+}
+
+void SunSpecProxy::map_mppt_to_inverters_(DtuLink &l) {
+  // The channel → (inverter, MPPT slot) assignment only changes when the
+  // DTU reorders its channels, so it is cached and recomputed only when a
+  // channel's marker/SN/MPPT words differ from the ones it was built from
+  const uint16_t *regs = l.regs.data();
+  int channels = l.channels;
+
+  bool changed = !l.channel_map_valid;
+  for (int ch = 0; ch < channels && !changed; ch++) {
+    changed = memcmp(l.channel_map[ch].words, &regs[ch * HM_CHANNEL_REGS], sizeof(l.channel_map[ch].words)) != 0;
+  }
+  if (!changed) return;
+
+  // Slots may move, so every channel is decoded again and every inverter
+  // starts from empty MPPT data
+  for (int i = 0; i < num_sources_; i++) {
+    if (dtu_src_[i].dtu != l.index) continue;
+    channel_mppt_count_[i] = 0;
+    for (int m = 0; m < MAX_MPPT_PER_INVERTER; m++) dtu_src_[i].mppt[m].data_valid = false;
+    dirty_sources_.set(i);
+  }
+  std::fill(l.dirty.begin(), l.dirty.end(), 1);
+  for (int ch = 0; ch < channels; ch++) {
+    const uint16_t *ch_regs = &regs[ch * HM_CHANNEL_REGS];
+    auto &e = l.channel_map[ch];
+    memcpy(e.words, ch_regs, sizeof(e.words));
+    e.inv = -1;
+    e.slot = -1;
+
+    if (ch_regs[HM_MARKER] != 12) {
+      ESP_LOGV(TAG, "DTU%d: Channel %d marker invalid (%d), skipping", l.index, ch, ch_regs[HM_MARKER]);
+      continue;
+    }
+
+    // Inverter serial number: 3 regs = 6 bytes, matched as a 48-bit key
+    uint64_t key = ((uint64_t)ch_regs[HM_INV_SN_1] << 32) | ((uint64_t)ch_regs[HM_INV_SN_2] << 16) |
+                   ch_regs[HM_INV_SN_3];
+    uint16_t mppt_num = ch_regs[HM_MPPT_NUM];
+    int inv_idx = find_source_by_sn_(key);
     if (inv_idx < 0) {
-      ESP_LOGD(TAG, "DTU: Channel %d: SN=%s MPPT=%d (no matching inverter config)", ch, inv_sn, mppt_num);
+      ESP_LOGD(TAG, "DTU%d: Channel %d: SN=%012llx MPPT=%d (no matching inverter config)",
+               l.index, ch, (unsigned long long)key, mppt_num);
       continue;
     }
-    
-    auto &inv = sources_[inv_idx];
-    
-    // Find or create MPPT slot
-    int mppt_idx = -1;
-    for (int m = 0; m < inv.mppt_count; m++) {
-      if (inv.mppt[m].mppt_num == mppt_num) {
-        mppt_idx = m;
+    if (dtu_src_[inv_idx].dtu != l.index) {
+      ESP_LOGW(TAG, "DTU%d: Channel %d reports %s, which is configured on DTU%d",
+               l.index, ch, dtu_src_[inv_idx].name, dtu_src_[inv_idx].dtu);
+      continue;
+    }
+
+    // Same MPPT number on an earlier channel shares its slot
+    int slot = -1;
+    for (int prev = 0; prev < ch; prev++) {
+      if (l.channel_map[prev].inv == inv_idx && l.channel_map[prev].words[HM_MPPT_NUM] == mppt_num) {
+        slot = l.channel_map[prev].slot;
         break;
       }
     }
-    if (mppt_idx < 0 && inv.mppt_count < MAX_MPPT_PER_INVERTER) {
-      mppt_idx = inv.mppt_count++;
+    if (slot < 0 && channel_mppt_count_[inv_idx] < MAX_MPPT_PER_INVERTER) {
+      slot = channel_mppt_count_[inv_idx]++;
     }
-    if (mppt_idx < 0) {
-      ESP_LOGW(TAG, "DTU: No MPPT slot available for %s MPPT%d", inv.name, mppt_num);
+    if (slot < 0) {
+      ESP_LOGW(TAG, "DTU%d: No MPPT slot available for %s MPPT%d", l.index, dtu_src_[inv_idx].name, mppt_num);
       continue;
     }
-    
-    auto &mppt = inv.mppt[mppt_idx];
+    e.inv = inv_idx;
+    e.slot = slot;
+    ESP_LOGD(TAG, "DTU%d: Channel %d → %s MPPT%d (slot %d)", l.index, ch, dtu_src_[inv_idx].name, mppt_num, slot);
+  }
+  for (int i = 0; i < num_sources_; i++) {
+    if (dtu_src_[i].dtu == l.index) dtu_src_[i].mppt_count = channel_mppt_count_[i];
+  }
+  l.channel_map_valid = true;
+  ESP_LOGI(TAG, "DTU%d: Channel map rebuilt (%d channels)", l.index, channels);
+}
+
+void SunSpecProxy::parse_dtu_registers_(DtuLink &l) {
+  // Decode each changed, mapped channel straight into its MPPT slot. The
+  // others keep what they decoded to before: with an unchanged channel map
+  // (see map_mppt_to_inverters_()) the same channels fill the same slots.
+  uint32_t now = millis();
+  uint32_t now_s = history_.enabled() ? history_.tick(now) : 0;
+  int channels_found = 0, channels_mapped = 0;
+  for (int ch = 0; ch < l.channels; ch++) {
+    const auto &e = l.channel_map[ch];
+    bool dirty = l.dirty[ch];
+    l.dirty[ch] = 0;
+    if (e.inv < 0) continue;
+    channels_mapped++;
+    const uint16_t *ch_regs = &l.regs[ch * HM_CHANNEL_REGS];
+    auto &inv = dtu_src_[e.inv];
+
+    // History gets every poll, changed or not: it averages over time
+    uint16_t series = history_series_base_[e.inv] + e.slot;
+    if (history_.enabled() && e.slot < inv.mppt_inputs && series < history_.series()) {
+      history_.add(series, now_s,
+                   {{ch_regs[HM_POWER], ch_regs[HM_DC_VOLTAGE], ch_regs[HM_DC_CURRENT], ch_regs[HM_TEMPERATURE]}});
+    }
+
+    if (!dirty) continue;
+    dirty_sources_.set(e.inv);
+    auto &mppt = inv.mppt[e.slot];
+    uint16_t mppt_num = ch_regs[HM_MPPT_NUM];
     mppt.mppt_num = mppt_num;
     mppt.data_valid = true;
     
-    // Decode values with correct scaling
-    mppt.dc_voltage_v = (float)ch_regs[HM_DC_VOLTAGE] / 10.0f;
-    mppt.dc_current_a = (float)ch_regs[HM_DC_CURRENT] / 100.0f;  // ÷100, not ÷10!
-    mppt.ac_voltage_v = (float)ch_regs[HM_AC_VOLTAGE] / 10.0f;
-    mppt.frequency_hz = (float)ch_regs[HM_FREQUENCY] / 100.0f;
-    mppt.power_w = (float)ch_regs[HM_POWER] / 10.0f;
-    mppt.today_energy_wh = (float)ch_regs[HM_TODAY_ENERGY];
-    
-    uint32_t total_wh = ((uint32_t)ch_regs[HM_TOTAL_ENERGY_H] << 16) | ch_regs[HM_TOTAL_ENERGY_L];
-    mppt.total_energy_kwh = (float)total_wh / 1000.0f;
-    
-    mppt.temperature_c = (float)(int16_t)ch_regs[HM_TEMPERATURE] / 10.0f;
+    // Keep the DTU's fixed-point units (0.1 V, 0.01 A, 0.1 W, 0.01 Hz, Wh, 0.1 °C)
+    mppt.dc_voltage_dv = ch_regs[HM_DC_VOLTAGE];
+    mppt.dc_current_ca = ch_regs[HM_DC_CURRENT];  // ÷100, not ÷10!
+    mppt.ac_voltage_dv = ch_regs[HM_AC_VOLTAGE];
+    mppt.frequency_chz = ch_regs[HM_FREQUENCY];
+    mppt.power_dw = ch_regs[HM_POWER];
+    mppt.today_energy_wh = ch_regs[HM_TODAY_ENERGY];
+    mppt.total_energy_wh = ((uint32_t)ch_regs[HM_TOTAL_ENERGY_H] << 16) | ch_regs[HM_TOTAL_ENERGY_L];
+    mppt.temperature_dc = (int16_t)ch_regs[HM_TEMPERATURE];
     mppt.status = ch_regs[HM_STATUS];
     
     channels_found++;
     
-    ESP_LOGD(TAG, "DTU: Ch%d → %s MPPT%d: %.0fW (DC: %.1fV/%.2fA), AC: %.0fV/%.2fHz, Today: %.0fWh, Total: %.1fkWh, T: %.1f°C, Status: %d",
-             ch, inv.name, mppt_num, mppt.power_w, 
-             mppt.dc_voltage_v, mppt.dc_current_a,
-             mppt.ac_voltage_v, mppt.frequency_hz,
-             mppt.today_energy_wh, mppt.total_energy_kwh,
-             mppt.temperature_c, mppt.status);
+    trace_.record_at(now, TraceEvent::CHANNEL, e.inv, ((mppt_num & 0xF) << 12) | ch,
+                     ((uint32_t) mppt.dc_voltage_dv << 16) | mppt.power_dw, mppt.total_energy_wh);
   }
   
-  ESP_LOGI(TAG, "DTU: Parsed %d MPPT channels from register data", channels_found);
+  trace_.record_at(now, TraceEvent::DTU_PARSE, l.index, channels_found, channels_mapped);
 }
 
-void SunSpecProxy::map_mppt_to_inverters_() {
-  // Already done in parse_dtu_registers_ via serial number matching
+void SunSpecProxy::aggregate_dtu_inverters_(DtuLink &l) {
+  // Only inverters with a re-decoded channel are recomputed; the others
+  // were polled just as successfully, their data just didn't move
+  uint32_t now = millis();
+  for (int i = 0; i < num_sources_; i++) {
+    auto &s = dtu_src_[i];
+    if (s.dtu != l.index) continue;
+    if (dirty_sources_.test(i)) aggregate_inverter_data_(i, now);
+    if (s.data_valid) {
+      s.last_poll_ms = now;
+      s.poll_success_count++;
+    }
+  }
+}
+
+// Stale-data policy. A source no round has refreshed for stale_limit_ms_
+// (its DTU unreachable or failing) is dropped like one missing from the
+// DTU's data: out of the aggregate, offline, sensors unknown. Without any
+// source left the inverter block reads STANDBY / StVnd STALE with nothing
+// flowing. Its link's channels are decoded afresh once data is back, even
+// data the DTU held unchanged meanwhile.
+void SunSpecProxy::expire_stale_sources_() {
+  // Not the round's start time: sources parsed during the round are younger
+  uint32_t now = millis();
+  uint32_t limit = stale_limit_ms_.load(std::memory_order_relaxed);
+  for (int i = 0; i < num_sources_; i++) {
+    auto &s = dtu_src_[i];
+    if (!s.data_valid || now - s.last_poll_ms <= limit) continue;
+    ESP_LOGW(TAG, "%s: no data for %lus, marked stale", s.name, (unsigned long)((now - s.last_poll_ms) / 1000));
+    s.data_valid = false;
+    s.producing = false;
+    for (int m = 0; m < MAX_MPPT_PER_INVERTER; m++) s.mppt[m].data_valid = false;
+    dtu_links_[s.dtu].channel_map_valid = false;
+    dirty_sources_.set(i);
+  }
 }
 
-void SunSpecProxy::aggregate_inverter_data_(int inv_idx) {
-  auto &inv = sources_[inv_idx];
+// Recompute an inverter from its MPPT channels. Whether that counts as a
+// poll is up to the caller: a limit readback only refreshed the power.
+void SunSpecProxy::aggregate_inverter_data_(int inv_idx, uint32_t now) {
+  auto &inv = dtu_src_[inv_idx];
   
   // Reset aggregates
-  inv.power_w = 0;
-  inv.voltage_v = 0;
-  inv.current_a = 0;
-  inv.frequency_hz = 0;
-  inv.energy_kwh = 0;
+  inv.power_dw = 0;
+  inv.voltage_dv = 0;
+  inv.current_ca = 0;
+  inv.frequency_chz = 0;
   inv.today_energy_wh = 0;
-  inv.temperature_c = NAN;
-  inv.pv_voltage_v = 0;
-  inv.pv_current_a = 0;
-  inv.pv_power_w = 0;
+  inv.temperature_dc = TEMP_UNKNOWN;
+  inv.pv_voltage_dv = 0;
+  inv.pv_current_ca = 0;
+  inv.pv_power_dw = 0;
   inv.producing = false;
   inv.data_valid = false;
   
   if (inv.mppt_count == 0) return;
   
   int valid_count = 0;
-  float max_temp = NAN;
+  uint32_t sum_voltage_dv = 0, sum_frequency_chz = 0, sum_pv_voltage_dv = 0;
+  uint64_t energy_wh = 0;
   
   for (int m = 0; m < inv.mppt_count; m++) {
     auto &mppt = inv.mppt[m];
     if (!mppt.data_valid) continue;
     
     valid_count++;
-    inv.power_w += mppt.power_w;
-    inv.pv_power_w += mppt.power_w;  // For microinverters, AC ≈ DC
-    inv.voltage_v += mppt.ac_voltage_v;
-    inv.frequency_hz += mppt.frequency_hz;
+    inv.power_dw += mppt.power_dw;
+    inv.pv_power_dw += mppt.power_dw;  // For microinverters, AC ≈ DC
+    sum_voltage_dv += mppt.ac_voltage_dv;
+    sum_frequency_chz += mppt.frequency_chz;
     inv.today_energy_wh += mppt.today_energy_wh;
-    inv.energy_kwh += mppt.total_energy_kwh;
+    energy_wh += mppt.total_energy_wh;
     
     // DC side
-    inv.pv_voltage_v += mppt.dc_voltage_v;
-    inv.pv_current_a += mppt.dc_current_a;
+    sum_pv_voltage_dv += mppt.dc_voltage_dv;
+    inv.pv_current_ca += mppt.dc_current_ca;
     
     // Max temperature
-    if (std::isnan(max_temp) || mppt.temperature_c > max_temp) {
-      max_temp = mppt.temperature_c;
-    }
+    if (mppt.temperature_dc > inv.temperature_dc) inv.temperature_dc = mppt.temperature_dc;
     
-    if (mppt.power_w > 0) inv.producing = true;
+    if (mppt.power_dw > 0) inv.producing = true;
   }
   
   if (valid_count > 0) {
-    inv.voltage_v /= valid_count;
-    inv.frequency_hz /= valid_count;
-    inv.pv_voltage_v /= valid_count;
-    inv.temperature_c = max_temp;
+    inv.voltage_dv = (sum_voltage_dv + valid_count / 2) / valid_count;
+    inv.frequency_chz = (sum_frequency_chz + valid_count / 2) / valid_count;
+    inv.pv_voltage_dv = (sum_pv_voltage_dv + valid_count / 2) / valid_count;
+    // Lifetime energy only moves forward: a channel missing from this round
+    // or a restarted DTU can't pull it back
+    if (energy_wh > inv.energy_wh) inv.energy_wh = energy_wh;
     inv.data_valid = true;
-    inv.last_poll_ms = millis();
     
-    // Estimate current from power/voltage
-    if (inv.voltage_v > 0) {
-      inv.current_a = inv.power_w / inv.voltage_v;
+    // Estimate current from power/voltage: 0.1 W / 0.1 V = A, ×100 for 0.01 A
+    if (inv.voltage_dv > 0) {
+      inv.current_ca = ((uint64_t) inv.power_dw * 100 + inv.voltage_dv / 2) / inv.voltage_dv;
     }
     
-    inv.poll_success_count++;
-    
-    ESP_LOGI(TAG, "INV: %s — P=%.0fW (DC: %.1fV/%.2fA=%.0fW), AC: %.1fV/%.2fHz, Today=%.0fWh, Total=%.1fkWh, T=%.1f°C (%d MPPTs)",
-             inv.name, inv.power_w,
-             inv.pv_voltage_v, inv.pv_current_a, inv.pv_power_w,
-             inv.voltage_v, inv.frequency_hz,
-             inv.today_energy_wh, inv.energy_kwh,
-             inv.temperature_c, valid_count);
+    trace_.record_at(now, TraceEvent::INVERTER, inv_idx, valid_count | (inv.producing ? 0x8000 : 0),
+                     inv.power_dw, (uint32_t) inv.energy_wh);
   }
 }
 
-void SunSpecProxy::publish_mppt_sensors_(int inv_idx, int mppt_idx) {
-  auto &inv = sources_[inv_idx];
-  if (mppt_idx >= inv.mppt_count) return;
-  
-  auto &mppt = inv.mppt[mppt_idx];
-  if (!mppt.data_valid) return;
-  
-  // Publish per-MPPT sensors if configured
-  if (mppt_dc_voltage_sensors_[inv_idx][mppt_idx]) 
-    mppt_dc_voltage_sensors_[inv_idx][mppt_idx]->publish_state(mppt.dc_voltage_v);
-  if (mppt_dc_current_sensors_[inv_idx][mppt_idx]) 
-    mppt_dc_current_sensors_[inv_idx][mppt_idx]->publish_state(mppt.dc_current_a);
-  if (mppt_dc_power_sensors_[inv_idx][mppt_idx]) 
-    mppt_dc_power_sensors_[inv_idx][mppt_idx]->publish_state(mppt.dc_voltage_v * mppt.dc_current_a);
-  if (mppt_ac_voltage_sensors_[inv_idx][mppt_idx]) 
-    mppt_ac_voltage_sensors_[inv_idx][mppt_idx]->publish_state(mppt.ac_voltage_v);
-  if (mppt_frequency_sensors_[inv_idx][mppt_idx]) 
-    mppt_frequency_sensors_[inv_idx][mppt_idx]->publish_state(mppt.frequency_hz);
-  if (mppt_power_sensors_[inv_idx][mppt_idx]) 
-    mppt_power_sensors_[inv_idx][mppt_idx]->publish_state(mppt.power_w);
-  if (mppt_today_energy_sensors_[inv_idx][mppt_idx]) 
-    mppt_today_energy_sensors_[inv_idx][mppt_idx]->publish_state(mppt.today_energy_wh);
-  if (mppt_total_energy_sensors_[inv_idx][mppt_idx]) 
-    mppt_total_energy_sensors_[inv_idx][mppt_idx]->publish_state(mppt.total_energy_kwh);
-  if (mppt_temperature_sensors_[inv_idx][mppt_idx]) 
-    mppt_temperature_sensors_[inv_idx][mppt_idx]->publish_state(mppt.temperature_c);
-}
-
 }  // namespace sunspec_proxy
 }  // namespace esphome
@@ -1,13 +1,25 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/text_sensor/text_sensor.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
+#include "modbus_frame.h"
+#include "sunspec_models.h"
+#include "triple_buffer.h"
+#include "metrics.h"
+#include "trace.h"
+#include "history.h"
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <type_traits>
 #include <vector>
 #include <cstring>
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
+#include <lwip/dns.h>
 
 namespace esphome {
 namespace sunspec_proxy {
@@ -16,12 +28,19 @@ namespace sunspec_proxy {
 static const uint16_t SUNSPEC_BASE = 40000;
 
 // Hoymiles DTU-Pro Modbus TCP register map
-// NEW LAYOUT: Per-MPPT-channel data at 0x4000, 25 registers per channel
-// 8 channels total (2 inverters × 4 MPPT each) = 200 registers
+// NEW LAYOUT: Per-panel-channel data at 0x4000, 25 registers per channel.
+// The DTU lists the channels of all its inverters back to back; only the
+// first HM_CHANNEL_REGS of each block carry data we use.
 static const uint16_t HM_DATA_BASE = 0x4000;       // MPPT channel data start
 static const uint16_t HM_MPPT_STRIDE = 25;         // 25 registers per MPPT channel
-static const uint16_t HM_MAX_CHANNELS = 8;         // Max MPPT channels to read
-static const uint16_t HM_TOTAL_REGS = 200;         // Total registers to read (8 × 25)
+static const uint16_t HM_CHANNEL_REGS = 15;        // Used span of a channel block ([0] marker .. [14] status)
+static const uint16_t HM_MAX_INVERTERS = 99;      // DTU-Pro limit
+static const uint16_t HM_MAX_CHANNELS = HM_MAX_INVERTERS * 8;  // × up to 8 panels
+static_assert(HM_MAX_CHANNELS <= 0x1000, "TraceEvent::CHANNEL keeps the channel in 12 bits");
+static const uint16_t HM_MAX_READ_REGS = 125;      // Modbus FC03 limit
+// Whole channels per read: every block but the last is read in full, the
+// last one only up to its used span
+static const uint16_t HM_CHANNELS_PER_READ = (HM_MAX_READ_REGS - HM_CHANNEL_REGS) / HM_MPPT_STRIDE + 1;
 
 // Per-MPPT register offsets (relative to channel base at 0x4000 + channel×25)
 // Verified register layout from live DTU-Pro testing:
@@ -43,122 +62,443 @@ static const uint16_t HM_TEMPERATURE = 13;         // [13] = Temperature × 10 (
 static const uint16_t HM_STATUS = 14;              // [14] = Status (3 = producing)
 // [15:24] = Reserved/unknown
 
-// Model sizes (register count)
-static const uint16_t MODEL_1_SIZE = 66;    // Common
-static const uint16_t MODEL_101_SIZE = 50;  // Single-phase inverter (int)
-static const uint16_t MODEL_103_SIZE = 50;  // Three-phase inverter (int)
-static const uint16_t MODEL_120_SIZE = 26;  // Nameplate ratings
-static const uint16_t MODEL_123_SIZE = 24;  // Immediate controls
-static const uint16_t MODEL_END_SIZE = 0;   // End marker
-
-// Offsets within Model 101/103 for key data (relative to model data start)
-static const uint16_t INV_A = 0;       // AC Total Current
-static const uint16_t INV_AphA = 1;    // Phase A current
-static const uint16_t INV_AphB = 2;    // Phase B current
-static const uint16_t INV_AphC = 3;    // Phase C current
-static const uint16_t INV_A_SF = 4;    // Current scale factor
-static const uint16_t INV_PPVphAB = 5; // Phase AB voltage
-static const uint16_t INV_PPVphBC = 6; // Phase BC voltage
-static const uint16_t INV_PPVphCA = 7; // Phase CA voltage
-static const uint16_t INV_PhVphA = 8;  // Phase A voltage
-static const uint16_t INV_PhVphB = 9;  // Phase B voltage
-static const uint16_t INV_PhVphC = 10; // Phase C voltage
-static const uint16_t INV_V_SF = 11;   // Voltage scale factor
-static const uint16_t INV_W = 12;      // AC Power
-static const uint16_t INV_W_SF = 13;   // Power scale factor
-static const uint16_t INV_Hz = 14;     // Frequency
-static const uint16_t INV_Hz_SF = 15;  // Frequency scale factor
-static const uint16_t INV_VA = 16;     // Apparent power
-static const uint16_t INV_VA_SF = 17;  // Apparent power SF
-static const uint16_t INV_VAr = 18;    // Reactive power
-static const uint16_t INV_VAr_SF = 19; // Reactive power SF
-static const uint16_t INV_PF = 20;     // Power factor
-static const uint16_t INV_PF_SF = 21;  // Power factor SF
-static const uint16_t INV_WH = 22;     // Lifetime energy (acc32, 2 regs)
-static const uint16_t INV_WH_SF = 24;  // Energy SF
-static const uint16_t INV_DCA = 25;    // DC current
-static const uint16_t INV_DCA_SF = 26; // DC current SF
-static const uint16_t INV_DCV = 27;    // DC voltage
-static const uint16_t INV_DCV_SF = 28; // DC voltage SF
-static const uint16_t INV_DCW = 29;    // DC power
-static const uint16_t INV_DCW_SF = 30; // DC power SF
-static const uint16_t INV_TmpCab = 31; // Cabinet temp
-static const uint16_t INV_TmpSnk = 32; // Heatsink temp
-static const uint16_t INV_TmpTrns = 33;// Transformer temp
-static const uint16_t INV_TmpOt = 34;  // Other temp
-static const uint16_t INV_Tmp_SF = 35; // Temperature SF
-static const uint16_t INV_St = 36;     // Operating state
-static const uint16_t INV_StVnd = 37;  // Vendor state
-static const uint16_t INV_Evt1 = 38;   // Event bitfield 1 (32-bit)
-static const uint16_t INV_Evt2 = 40;   // Event bitfield 2 (32-bit)
-static const uint16_t INV_EvtVnd1 = 42;// Vendor event 1
-static const uint16_t INV_EvtVnd2 = 44;// Vendor event 2
-static const uint16_t INV_EvtVnd3 = 46;// Vendor event 3
-static const uint16_t INV_EvtVnd4 = 48;// Vendor event 4
-
-// Max TCP clients
-static const int MAX_TCP_CLIENTS = 4;
-// Max RTU sources (physical inverters)
-static const int MAX_RTU_SOURCES = 8;
+// Per-port records at 0x1000 + port × 0x28 carry what the 0x4000 block
+// lacks. They are byte packed: [0] data type | SN byte 0, [1:2] SN bytes
+// 1-4, [3] SN byte 5 | port, [4:12] the measurements again, then:
+static const uint16_t HM_PORT_BASE = 0x1000;
+static const uint16_t HM_PORT_STRIDE = 0x28;
+static const uint16_t HM_OPERATING_STATUS = 13;    // [13] = Operating status
+static const uint16_t HM_ALARM_CODE = 14;          // [14] = Last alarm code
+static const uint16_t HM_ALARM_COUNT = 15;         // [15] = Alarm count
+static const uint16_t HM_LINK_STATUS = 16;         // [16] high byte = Link status
+static const uint16_t HM_PORT_REGS = 17;           // Read up to the link status
+// Per-port controls at 0xC006 + port × 6: [0] ON/OFF, [1] limit % (see
+// queue_power_limit_()); read back like the status records
+static const uint16_t HM_CTRL_BASE = 0xC006;
+static const uint16_t HM_CTRL_STRIDE = 6;
+static const uint16_t HM_CTRL_REGS = 2;
+
+// SunSpec model points and the register map layout: see sunspec_models.h
+
+// Max DTU requests in flight at once
+static const uint8_t MAX_DTU_PIPELINE = 8;
+// Max TCP clients (upper bound for the configurable client table)
+static const int MAX_TCP_CLIENTS = 16;
+// Source and MPPT table sizes: the configured inverters and their DTU
+// channels, set by the code generator
+#ifndef SUNSPEC_PROXY_SOURCES
+#define SUNSPEC_PROXY_SOURCES 8
+#endif
+#ifndef SUNSPEC_PROXY_MPPTS_PER_SOURCE
+#define SUNSPEC_PROXY_MPPTS_PER_SOURCE 8
+#endif
+// Max RTU sources (physical inverters), on one DTU or spread over several
+static const int MAX_RTU_SOURCES = SUNSPEC_PROXY_SOURCES;
+static_assert(MAX_RTU_SOURCES <= HM_MAX_INVERTERS, "at most 99 inverters (rtu_sources is validated to that)");
+// A source index, signed so -1 can mean none, and a set of sources
+typedef std::conditional<(MAX_RTU_SOURCES <= INT8_MAX), int8_t, int16_t>::type SourceIndex;
+typedef std::bitset<MAX_RTU_SOURCES> SourceMask;
+// Max DTU-Pro gateways aggregated into the one SunSpec device
+static const int MAX_DTU_LINKS = 4;
 // Max MPPT channels per inverter
-static const int MAX_MPPT_PER_INVERTER = 8;
+static const int MAX_MPPT_PER_INVERTER = SUNSPEC_PROXY_MPPTS_PER_SOURCE;
+// Inverters a warm-start snapshot holds: the configured ones rounded up to
+// a multiple of 8, so the flash layout (and a saved snapshot) only changes
+// when the config crosses one
+static const int WARM_START_SOURCES = (MAX_RTU_SOURCES + 7) / 8 * 8;
+// RtuSource::temperature_dc when no channel reported a temperature
+static const int16_t TEMP_UNKNOWN = INT16_MIN;
 
 // Per-MPPT channel data (from DTU-Pro register 0x4000 + channel×25)
 struct MpptData {
   uint8_t mppt_num;         // MPPT number (1-based) from register
   bool data_valid;          // Is this data populated?
   
-  // Decoded values from registers (real-world units)
-  float dc_voltage_v;       // [5] ÷ 10
-  float dc_current_a;       // [6] ÷ 100
-  float ac_voltage_v;       // [7] ÷ 10
-  float frequency_hz;       // [8] ÷ 100
-  float power_w;            // [9] ÷ 10
-  float today_energy_wh;    // [10] raw
-  float total_energy_kwh;   // [11:12] as uint32 Wh ÷ 1000
-  float temperature_c;      // [13] ÷ 10
+  // Register values in the DTU's own fixed-point units; converted to float
+  // only when published to sensors
+  uint16_t dc_voltage_dv;   // [5] 0.1 V
+  uint16_t dc_current_ca;   // [6] 0.01 A
+  uint16_t ac_voltage_dv;   // [7] 0.1 V
+  uint16_t frequency_chz;   // [8] 0.01 Hz
+  uint16_t power_dw;        // [9] 0.1 W
+  uint16_t today_energy_wh; // [10] Wh
+  uint32_t total_energy_wh; // [11:12] Wh
+  int16_t temperature_dc;   // [13] 0.1 °C
   uint16_t status;          // [14] (3 = producing)
 };
 
 // An RTU source is a physical Hoymiles inverter
-// Data is read from the DTU-Pro via Modbus TCP at 0x4000 (per-MPPT layout)
+// Data is read from the DTU-Pro via Modbus TCP at 0x4000 (per-MPPT layout).
+// Widest fields first so the per-source copies (sources_, the task's working
+// set, the snapshot slots) pack tightly; the strings stay in flash.
 struct RtuSource {
-  uint8_t port_number;       // Legacy field (not used in TCP mode)
-  uint8_t phases;            // 1 or 3
-  uint8_t connected_phase;   // For single-phase: which grid phase (1=L1, 2=L2, 3=L3)
-  uint16_t rated_power_w;    // Rated output power in watts
-  uint8_t mppt_inputs;       // Number of MPPT inputs (DC strings)
-  char name[32];             // Friendly name for logging/sensors
-  char model[24];            // Inverter model (e.g., "HMS-2000-4T")
-  char serial_number[33];    // Inverter serial (hex string, e.g., "1520a025566b")
-  
-  // Per-MPPT data (populated by matching SN from register 0x4000+ data)
-  MpptData mppt[MAX_MPPT_PER_INVERTER];
-  uint8_t mppt_count;        // How many MPPT channels are populated
-  
-  bool data_valid;
+  uint64_t sn_key;           // serial_number as the 48-bit value the DTU reports (0 = none)
+  uint64_t energy_wh;        // Lifetime Wh, sum
+  const char *name;          // Friendly name for logging/sensors
+  const char *model;         // Inverter model (e.g., "HMS-2000-4T")
+  const char *serial_number; // Inverter serial (hex string, e.g., "1520a025566b")
   uint32_t last_poll_ms;
 
   // Statistics
   uint32_t poll_success_count;
   uint32_t poll_fail_count;
 
-  // Aggregated values for this inverter (sum/avg of all MPPTs)
-  float power_w;
-  float current_a;
-  float voltage_v;
-  float frequency_hz;
-  float energy_kwh;
-  float today_energy_wh;
-  float temperature_c;
-  float pv_voltage_v;
-  float pv_current_a;
-  float pv_power_w;
+  // Aggregated values for this inverter (sum/avg of all MPPTs), fixed point
+  uint32_t power_dw;         // 0.1 W, sum
+  uint32_t current_ca;       // 0.01 A, AC power / AC voltage
+  uint32_t today_energy_wh;
+  uint32_t pv_current_ca;    // 0.01 A, sum
+  uint32_t pv_power_dw;      // 0.1 W, sum
+  uint16_t rated_power_w;    // Rated output power in watts
+  uint16_t voltage_dv;       // 0.1 V, mean
+  uint16_t frequency_chz;    // 0.01 Hz, mean
+  int16_t temperature_dc;    // 0.1 °C, hottest channel (TEMP_UNKNOWN if none)
+  uint16_t pv_voltage_dv;    // 0.1 V, mean
   uint16_t alarm_code;
   uint16_t alarm_count;
-  uint8_t link_status;
   uint16_t operating_status;
+  uint8_t port_number;       // Legacy field (not used in TCP mode)
+  uint8_t phases;            // 1 or 3
+  uint8_t connected_phase;   // For single-phase: which grid phase (1=L1, 2=L2, 3=L3)
+  uint8_t mppt_inputs;       // Number of MPPT inputs (DC strings)
+  uint8_t dtu;               // Index of the DTU this inverter is paired with
+  uint8_t mppt_count;        // How many MPPT channels are populated
+  uint8_t link_status;
+  uint8_t limit_pct;         // Limit % read back from the DTU (0 = not read yet)
+  bool data_valid;
   bool producing;
+
+  // Per-MPPT data (populated by matching SN from register 0x4000+ data)
+  MpptData mppt[MAX_MPPT_PER_INVERTER];
+};
+
+// Serial number index entry (sorted by key for binary search)
+struct SnIndexEntry {
+  uint64_t key;             // 48-bit inverter serial
+  SourceIndex inv;          // Index into sources_
+};
+
+// Cached mapping of one DTU channel to an inverter MPPT slot. words[] holds
+// the channel's marker/SN/MPPT registers the mapping was computed from;
+// it is only recomputed when those change.
+struct DtuChannelMap {
+  uint16_t words[HM_MPPT_NUM + 1];
+  SourceIndex inv;          // Source index, -1 = no marker or no matching inverter
+  int8_t slot;              // MPPT slot within the source
+};
+
+// DTU client state machine states (see poll_dtu_link_())
+enum class DtuState : uint8_t {
+  IDLE,           // Waiting for the next poll or queued command
+  STATUS,         // A status lane read in flight between rounds
+  READBACK,       // Power readback after a limit write, between rounds
+  CONNECTING,     // Non-blocking connect() in progress
+  TRANSFER,       // Read plan requests in flight (pipelined)
+  PARSE,          // Decode + aggregate the completed register block
+  SEND_COMMAND,   // Power limit FC05 write
+  AWAIT_COMMAND,
+};
+
+// Poll scheduler modes (see schedule_next_poll_())
+enum class PollMode : uint8_t {
+  NORMAL,         // poll_interval_ms
+  IDLE,           // No inverter producing: back off to the idle interval
+  FAST,           // Power limit active or power moving quickly
+};
+
+// One register range of the DTU poll (≤125 registers per Modbus read),
+// covering `channels` consecutive channel blocks
+struct DtuReadChunk {
+  uint16_t start;           // DTU register address
+  uint16_t count;           // Register count
+  uint16_t first_channel;   // First channel in the range
+  uint16_t channels;
+};
+
+// A request sent to the DTU whose response hasn't arrived yet
+struct DtuInflight {
+  uint16_t txn_id;          // MBAP transaction id used for matching
+  uint8_t chunk;            // Index into the read plan, or DTU_INFLIGHT_COMMAND
+  uint8_t cmd;              // Index into DtuLink::cmd_queue (commands only)
+  uint32_t sent_ms;
+  uint32_t sent_us;         // For the RTT histogram
+};
+static const uint8_t DTU_INFLIGHT_COMMAND = 0xFF;
+static const uint8_t DTU_INFLIGHT_GATEWAY = 0xFE;  // DtuInflight::cmd = gateway range
+static const uint8_t DTU_INFLIGHT_STATUS = 0xFD;   // DtuInflight::cmd = status plan entry
+static const uint8_t DTU_INFLIGHT_READBACK = 0xFC; // DtuInflight::cmd = readback plan entry
+
+// What a status lane read fetches (also bits of DtuLink::status_kinds)
+enum DtuStatusKind : uint8_t {
+  DTU_STATUS_PORT = 1,      // Port record: operating status, alarms, link status
+  DTU_STATUS_LIMIT = 2,     // Control registers: limit readback
+};
+
+// One read of the status lane, for one inverter
+struct DtuStatusRead {
+  uint16_t start;           // DTU register address
+  uint8_t count;
+  uint8_t source;           // Index into sources_
+  uint8_t kind;             // DtuStatusKind
+};
+
+// A queued FC05 control write to the DTU
+struct DtuCommand {
+  uint16_t address;         // Control register (0xC000+)
+  uint16_t value;           // Raw value
+  uint8_t port;             // Inverter port (for logging), or DTU_CMD_ALL_PORTS
+};
+static const uint8_t DTU_CMD_ALL_PORTS = 0xFF;
+
+// Gateway unit IDs answer FC03 reads of a DTU's own register space from a
+// cache, so other Modbus clients never need a connection to the DTU. A
+// stale or missing range is read as part of the next poll round.
+static const uint8_t GATEWAY_RANGES = 4;    // Cached ranges per DTU
+static const uint8_t GATEWAY_PENDING = 8;   // Client reads waiting for a poll round
+
+// A gateway range changes hands with its state: the main loop owns FREE,
+// READY and FAILED ranges, the DTU side WANTED ones once a round takes them
+// as FETCHING. The registers therefore need no lock when a task polls.
+enum GatewayState : uint8_t {
+  GATEWAY_FREE,
+  GATEWAY_WANTED,     // Missed: read it in the next round
+  GATEWAY_FETCHING,   // Taken by a round (from a plan read or its own request)
+  GATEWAY_READY,      // regs as of fetched_ms
+  GATEWAY_FAILED,     // The DTU did not deliver it (exception to pass on)
+};
+
+struct GatewayRange {
+  std::atomic<uint8_t> state{GATEWAY_FREE};
+  uint16_t start{0};
+  uint16_t count{0};
+  uint8_t plan_chunk{0};    // Read plan entry it is copied from, or DTU_INFLIGHT_GATEWAY
+  uint8_t exception{0};     // Modbus exception when FAILED
+  uint32_t fetched_ms{0};
+  uint32_t used_ms{0};      // Last client read (main loop, for replacement)
+  uint16_t regs[125];
+};
+
+// A gateway read answered once its range has been fetched
+struct GatewayPending {
+  int fd{-1};               // Client socket, -1 = free entry
+  uint8_t client{0};        // Slot in clients_
+  uint8_t unit_id{0};
+  uint8_t link{0};
+  uint8_t range{0};
+  uint16_t txn_id{0};
+  uint16_t start{0};
+  uint16_t count{0};
+  uint32_t since_ms{0};
+};
+
+// Background DNS lookup state of a DtuLink
+enum DtuDnsState : uint8_t { DTU_DNS_IDLE, DTU_DNS_PENDING, DTU_DNS_DONE, DTU_DNS_FAILED };
+
+// One DTU-Pro gateway: connection, poll pipeline, channel map and command
+// queue. Every link runs its own state machine (see poll_dtu_link_()).
+struct DtuLink {
+  static const size_t RX_BUFFER_SIZE = 1024;
+
+  // Endpoint
+  std::string host;           // DTU-Pro IP/hostname
+  uint16_t port{502};         // DTU-Pro Modbus TCP port
+  uint8_t address{101};       // DTU Modbus unit ID
+  uint8_t index{0};           // Position in the link table (for logging)
+  uint8_t num_sources{0};     // Inverters configured on this DTU
+  uint16_t channels_override{0};  // Channels to read (0 = from the inverter models)
+
+  // Connection
+  int fd{-1};
+  std::atomic<bool> connected{false};  // Read by the metrics endpoint too
+  DtuState state{DtuState::IDLE};
+  uint32_t connect_start_ms{0};       // When the pending connect() was issued
+  uint32_t request_sent_ms{0};        // When the oldest outstanding request was sent
+  uint16_t txn_id{1};
+  // Reconnect backoff (see schedule_dtu_reconnect_()) and the timeouts in a
+  // row without a single byte from the DTU (see read_modbus_tcp_response_())
+  uint32_t reconnect_at_ms{0};
+  uint32_t reconnect_delay_ms{0};
+  uint8_t connect_failures{0};        // Since the DTU last answered a request
+  uint8_t silent_timeouts{0};
+  std::atomic<uint32_t> backoff_ms{0};  // Published reconnect_delay_ms while no socket is open
+
+  // Address cache. IP literals are parsed once at setup; hostnames are
+  // resolved asynchronously and re-resolved after DTU_DNS_TTL_MS (lwIP
+  // doesn't pass the record TTL on) or after a failed connect.
+  struct sockaddr_in addr{};
+  bool host_literal{false};
+  bool addr_valid{false};
+  uint32_t addr_resolved_ms{0};
+  std::atomic<uint8_t> dns_state{DTU_DNS_IDLE};  // Written by the lwIP DNS callback
+  std::atomic<uint32_t> dns_result{0};           // IPv4 address, network order
+
+  // Read plan and pipelined requests
+  bool poll_requested{false};         // Part of the current poll round
+  std::vector<DtuReadChunk> read_plan;  // Built at setup (see build_dtu_read_plan_())
+  uint8_t read_chunks{0};
+  uint16_t read_regs{0};              // Registers fetched per poll
+  uint8_t next_chunk{0};              // Next plan entry to send
+  DtuInflight inflight[MAX_DTU_PIPELINE + 1];  // + one status read, outside the depth
+  uint8_t inflight_count{0};
+  bool poll_failed{false};
+  // Gateway cache (allocated when gateway unit IDs are on). Ranges outside
+  // the plan's reads are requested after the plan; next_chunk counts on
+  // through them.
+  GatewayRange *gateway{nullptr};
+  uint8_t gateway_fetch[GATEWAY_RANGES];
+  uint8_t gateway_fetches{0};
+  // Status lane (see start_dtu_status_read_()): one read at a time, only in
+  // the gaps between rounds, so the rounds keep their timing
+  std::vector<DtuStatusRead> status_plan;
+  uint8_t status_next{0};             // Next entry of the current pass
+  uint8_t status_kinds{DTU_STATUS_PORT | DTU_STATUS_LIMIT};  // Kinds the DTU answers
+  bool status_inflight{false};
+  uint32_t status_pass_ms{0};         // Start of the current pass (0 = none yet)
+  uint32_t status_rtt_ms{0};          // Round trip of the last status read: the gap one needs
+  std::atomic<uint32_t> status_reads{0};
+  // Quick readback after a limit write (see start_dtu_readback_()): only
+  // the power words of the mapped channels, until the limit shows
+  std::vector<DtuReadChunk> readback_plan;  // start = first channel's power word
+  uint8_t readback_next{0};
+  bool readback_pending{false};
+  uint32_t readback_at_ms{0};
+  uint32_t readback_start_ms{0};
+  uint32_t readback_rtt_ms{0};        // Duration of the last readback: the gap one needs
+  std::atomic<uint32_t> readbacks{0};
+  // Response stream reassembly (frames may be split or coalesced by TCP)
+  MbapStreamDecoder<RX_BUFFER_SIZE> rx;
+  // Raw channel data, HM_CHANNEL_REGS per channel (the unused tail of
+  // each 25-register block is not stored)
+  std::vector<uint16_t> regs;
+  // Per channel: words changed since the channel was last decoded. Set by
+  // store_dtu_chunk_(), cleared by parse_dtu_registers_(), so a round that
+  // fails half-way keeps what it already saw.
+  std::vector<uint8_t> dirty;
+
+  // Cached channel map (one entry per planned channel)
+  std::vector<DtuChannelMap> channel_map;
+  uint16_t channels{0};
+  bool channel_map_valid{false};
+
+  // Queued power limit writes (drained by the state machine between polls)
+  DtuCommand cmd_queue[MAX_RTU_SOURCES * 2];
+  uint8_t cmd_count{0};
+  uint8_t cmd_index{0};               // Next queued write to send
+  bool cmd_failed{false};
+  bool cmd_rejected{false};           // A write drew illegal function/address
+  bool cmd_broadcast{false};          // Queue holds 0xC000/0xC001 writes
+  bool round_suspended{false};        // Writes preempted the round: resume it after them
+  bool broadcast_ok{true};            // Cleared once the DTU rejects a broadcast (not on a timeout)
+
+  // Telemetry (see metrics.h)
+  LatencyHistogram rtt;               // Request sent → response matched
+  LatencyHistogram connect_time;
+  TrafficCounters traffic;
+  std::atomic<uint32_t> exceptions{0};  // Modbus exception responses
+  std::atomic<uint32_t> timeouts{0};    // Requests given up on
+  std::atomic<uint32_t> late_responses{0};  // Answers to requests given up on (dropped)
+  std::atomic<uint32_t> reconnects{0};
+};
+
+// A connection to the /metrics endpoint. One request per connection: the
+// response is rendered once and the socket closed after it has been sent.
+struct MetricsClient {
+  int fd{-1};
+  char rx[256];
+  uint16_t rx_len{0};
+  std::string tx;
+  size_t tx_pos{0};
+  uint32_t opened_ms{0};               // Reset by progress: the timeout is for stuck clients
+  // GET /history streams chunk by chunk (see fill_history_chunk_())
+  int8_t history_tier{-1};             // -1 = not streaming
+  uint8_t history_series{0};
+  uint32_t history_block{0};           // Next block of history_series
+  uint32_t history_since_s{0};
+};
+
+// A connected Modbus TCP client (Victron GX, Home Assistant, ...)
+// Each slot buffers its own request stream so requests that arrive split or
+// back-to-back are all served, and queues responses until the socket takes them.
+struct TcpClient {
+  static const uint16_t RX_BUFFER_SIZE = 2 * MBAP_MAX_ADU;
+  static const uint16_t TX_BUFFER_SIZE = 4 * MBAP_MAX_ADU;
+
+  int fd{-1};
+  MbapStreamDecoder<RX_BUFFER_SIZE> rx;
+  uint8_t tx[TX_BUFFER_SIZE];
+  uint16_t tx_len{0};       // Queued response bytes not yet sent
+  uint32_t last_activity_ms{0};  // Last request received (for idle/LRU eviction)
+};
+
+// Output of one DTU poll: the model 101/103 block and the aggregate values,
+// built by the DTU side and applied to the register image by the main loop
+struct DtuPollResult {
+  uint16_t inv_block[SunSpecInverter::LENGTH];
+  uint16_t mppt_block[SunSpecMpptModel::LENGTH];
+  uint32_t agg_power_dw;
+  uint32_t agg_current_ca;
+  uint16_t agg_voltage_dv;
+  uint16_t agg_frequency_chz;
+  uint64_t agg_energy_wh;
+  SourceMask dirty_sources; // Sources whose data changed (none = blocks as before)
+};
+
+// Everything the main loop needs from a DTU poll when polling runs in its
+// own task (see dtu_task_core)
+struct DtuSnapshot {
+  DtuPollResult result;
+  RtuSource sources[MAX_RTU_SOURCES];
+};
+
+// Saved to flash so a reboot serves the last known state instead of an
+// empty Model 103 (see restore_warm_start_())
+struct WarmStart {
+  uint16_t inv_block[SunSpecInverter::LENGTH];
+  uint16_t controls[SunSpecControls::LENGTH];
+  uint64_t source_sn[WARM_START_SOURCES];         // sn_key the energy below belongs to
+  uint64_t source_energy_wh[WARM_START_SOURCES];  // Lifetime Wh per inverter
+  uint64_t energy_wh;                          // Lifetime Wh served in Model 103
+};
+
+// Value behind a numeric sensor (see sensor_value_())
+enum class SensorField : uint8_t {
+  SRC_POWER, SRC_VOLTAGE, SRC_CURRENT, SRC_ENERGY, SRC_TODAY_ENERGY, SRC_FREQUENCY,
+  SRC_TEMPERATURE, SRC_PV_VOLTAGE, SRC_PV_CURRENT, SRC_PV_POWER, SRC_ALARM_CODE,
+  SRC_ALARM_COUNT, SRC_LINK_STATUS, SRC_POLL_OK, SRC_POLL_FAIL,
+  MPPT_DC_VOLTAGE, MPPT_DC_CURRENT, MPPT_DC_POWER, MPPT_AC_VOLTAGE, MPPT_FREQUENCY,
+  MPPT_POWER, MPPT_TODAY_ENERGY, MPPT_TOTAL_ENERGY, MPPT_TEMPERATURE,
+  AGG_POWER, AGG_VOLTAGE, AGG_CURRENT, AGG_ENERGY, AGG_FREQUENCY,
+  TCP_CLIENTS, TCP_REQUESTS, TCP_ERRORS, POWER_LIMIT, POWER_LIMIT_LATENCY, DTU_POLL_OK, DTU_POLL_FAIL,
+};
+
+// Deadband classes (order matches DEADBAND_CLASSES in __init__.py)
+enum SensorClass : uint8_t {
+  SENSOR_CLASS_POWER,
+  SENSOR_CLASS_VOLTAGE,
+  SENSOR_CLASS_CURRENT,
+  SENSOR_CLASS_ENERGY,
+  SENSOR_CLASS_FREQUENCY,
+  SENSOR_CLASS_TEMPERATURE,
+  SENSOR_CLASS_DIAGNOSTIC,
+  SENSOR_CLASS_COUNT,
+};
+
+// A value is published once it moved by at least max(absolute, relative × last)
+struct SensorDeadband {
+  float absolute;           // In the sensor's unit
+  float relative;           // Fraction of the last published value
+};
+
+// One configured numeric sensor and its publish state
+struct SensorBinding {
+  sensor::Sensor *sensor;
+  SensorField field;
+  uint8_t cls;              // SensorClass
+  uint8_t inv;              // Source index (per-source / per-MPPT fields)
+  uint8_t mppt;             // MPPT slot (per-MPPT fields)
+  bool published;
+  float last_value;         // Last value sent
+  uint32_t last_publish_ms;
 };
 
 // The aggregated SunSpec device presented to Victron
@@ -178,13 +518,45 @@ class SunSpecProxy : public Component {
   void setup() override;
   void loop() override;
   float get_setup_priority() const override { return setup_priority::AFTER_WIFI; }
+  void on_safe_shutdown() override;
 
-  void set_dtu_host(const std::string &host) { dtu_host_ = host; }
-  void set_dtu_port(uint16_t port) { dtu_port_ = port; }
-  void set_dtu_address(uint8_t addr) { dtu_address_ = addr; }
+  void add_dtu(const std::string &host, uint16_t port, uint8_t address, uint16_t channels = 0);
   void set_tcp_port(uint16_t port) { tcp_port_ = port; }
-  void set_poll_interval_ms(uint32_t ms) { poll_interval_ms_ = ms; }
+  void set_poll_interval_ms(uint32_t ms) { poll_interval_ms_ = ms; poll_delay_ms_ = ms; }
+  void set_idle_poll_interval_ms(uint32_t ms) { poll_idle_interval_ms_ = ms; }
+  void set_fast_poll_interval_ms(uint32_t ms) { poll_fast_interval_ms_ = ms; }
+  void set_fast_poll_power_step(float fraction) { poll_fast_power_step_ = fraction; }
+  void set_status_interval_ms(uint32_t ms) { status_interval_ms_ = ms; }
+  void set_align_polls_to_client(bool b) { poll_align_ = b; }
   void set_tcp_timeout_ms(uint32_t ms) { tcp_timeout_ms_ = ms; }
+  void set_stale_timeout_ms(uint32_t ms) {
+    stale_timeout_ms_ = ms;
+    stale_limit_ms_.store(ms, std::memory_order_relaxed);
+  }
+  void set_dtu_pipeline_depth(uint8_t depth) { dtu_pipeline_depth_ = depth; }
+  void set_max_tcp_clients(uint8_t n) { max_tcp_clients_ = n < 1 ? 1 : (n > MAX_TCP_CLIENTS ? MAX_TCP_CLIENTS : n); }
+  void set_tcp_idle_timeout_ms(uint32_t ms) { tcp_idle_timeout_ms_ = ms; }
+  void set_metrics_port(uint16_t port) { metrics_port_ = port; }
+  // Serve DTU n's registers on unit_id + n (see GatewayRange)
+  void set_gateway(uint8_t unit_id, uint32_t max_age_ms) {
+    gateway_unit_id_ = unit_id;
+    gateway_max_age_ms_ = max_age_ms;
+  }
+  // Decode the trace ring (see trace.h) into the log, oldest record first
+  void dump_trace();
+  void set_dtu_task_core(int8_t core) { dtu_task_core_ = core; }
+  void set_power_limit_broadcast(bool b) { limit_broadcast_ = b; }
+  void set_sensor_heartbeat_ms(uint32_t ms) { sensor_heartbeat_ms_ = ms; }
+  void set_warm_start_interval_ms(uint32_t ms) { warm_start_interval_ms_ = ms; }
+  // Per-MPPT history tiers (see history.h); not called = no history
+  void set_history(uint32_t fine_interval_s, uint32_t fine_retention_s, uint32_t coarse_interval_s,
+                   uint32_t coarse_retention_s) {
+    history_config_[0] = {fine_interval_s, fine_retention_s};
+    history_config_[1] = {coarse_interval_s, coarse_retention_s};
+  }
+  void set_sensor_publish_slice(uint8_t n) { sensor_publish_slice_ = n < 1 ? 1 : n; }
+  void set_sensor_deadband_absolute(uint8_t cls, float v) { if (cls < SENSOR_CLASS_COUNT) sensor_deadbands_[cls].absolute = v; }
+  void set_sensor_deadband_relative(uint8_t cls, float v) { if (cls < SENSOR_CLASS_COUNT) sensor_deadbands_[cls].relative = v; }
 
   // Aggregated device identity
   void set_unit_id(uint8_t id) { agg_config_.unit_id = id; }
@@ -197,64 +569,66 @@ class SunSpecProxy : public Component {
   // Add an RTU source (physical inverter to poll)
   void add_rtu_source(uint8_t rtu_address, uint8_t phases, uint16_t rated_power_w,
                       uint8_t connected_phase, uint8_t mppt_inputs,
-                      const std::string &name, const std::string &model,
-                      const std::string &serial);
+                      const char *name, const char *model,
+                      const char *serial, uint8_t dtu_index = 0);
 
   // --- Sensor setters (per-source, indexed 0..N-1) ---
-  void set_source_power_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_power_sensors_[idx] = s; }
-  void set_source_voltage_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_voltage_sensors_[idx] = s; }
-  void set_source_current_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_current_sensors_[idx] = s; }
-  void set_source_energy_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_energy_sensors_[idx] = s; }
-  void set_source_today_energy_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_today_energy_sensors_[idx] = s; }
-  void set_source_frequency_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_frequency_sensors_[idx] = s; }
-  void set_source_temperature_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_temperature_sensors_[idx] = s; }
-  void set_source_pv_voltage_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_pv_voltage_sensors_[idx] = s; }
-  void set_source_pv_current_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_pv_current_sensors_[idx] = s; }
-  void set_source_pv_power_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_pv_power_sensors_[idx] = s; }
-  void set_source_alarm_code_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_alarm_code_sensors_[idx] = s; }
-  void set_source_alarm_count_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_alarm_count_sensors_[idx] = s; }
-  void set_source_link_status_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_link_status_sensors_[idx] = s; }
-  void set_source_poll_success_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_poll_ok_sensors_[idx] = s; }
-  void set_source_poll_fail_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) src_poll_fail_sensors_[idx] = s; }
+  // Numeric sensors go straight into the binding list, so only configured
+  // sensors take RAM
+  void set_source_power_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_POWER, SENSOR_CLASS_POWER, idx); }
+  void set_source_voltage_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_VOLTAGE, SENSOR_CLASS_VOLTAGE, idx); }
+  void set_source_current_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_CURRENT, SENSOR_CLASS_CURRENT, idx); }
+  void set_source_energy_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_ENERGY, SENSOR_CLASS_ENERGY, idx); }
+  void set_source_today_energy_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_TODAY_ENERGY, SENSOR_CLASS_ENERGY, idx); }
+  void set_source_frequency_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_FREQUENCY, SENSOR_CLASS_FREQUENCY, idx); }
+  void set_source_temperature_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_TEMPERATURE, SENSOR_CLASS_TEMPERATURE, idx); }
+  void set_source_pv_voltage_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_PV_VOLTAGE, SENSOR_CLASS_VOLTAGE, idx); }
+  void set_source_pv_current_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_PV_CURRENT, SENSOR_CLASS_CURRENT, idx); }
+  void set_source_pv_power_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_PV_POWER, SENSOR_CLASS_POWER, idx); }
+  void set_source_alarm_code_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_ALARM_CODE, SENSOR_CLASS_DIAGNOSTIC, idx); }
+  void set_source_alarm_count_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_ALARM_COUNT, SENSOR_CLASS_DIAGNOSTIC, idx); }
+  void set_source_link_status_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_LINK_STATUS, SENSOR_CLASS_DIAGNOSTIC, idx); }
+  void set_source_poll_success_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_POLL_OK, SENSOR_CLASS_DIAGNOSTIC, idx); }
+  void set_source_poll_fail_sensor(int idx, sensor::Sensor *s) { if (idx < MAX_RTU_SOURCES) add_sensor_binding_(s, SensorField::SRC_POLL_FAIL, SENSOR_CLASS_DIAGNOSTIC, idx); }
   void set_source_online_sensor(int idx, binary_sensor::BinarySensor *s) { if (idx < MAX_RTU_SOURCES) src_online_sensors_[idx] = s; }
   void set_source_status_sensor(int idx, text_sensor::TextSensor *s) { if (idx < MAX_RTU_SOURCES) src_status_sensors_[idx] = s; }
 
   // --- Per-MPPT sensor setters ---
-  void set_mppt_dc_voltage_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_dc_voltage_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_dc_voltage_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_DC_VOLTAGE, SENSOR_CLASS_VOLTAGE, inv_idx, mppt_idx);
   }
-  void set_mppt_dc_current_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_dc_current_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_dc_current_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_DC_CURRENT, SENSOR_CLASS_CURRENT, inv_idx, mppt_idx);
   }
-  void set_mppt_dc_power_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_dc_power_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_dc_power_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_DC_POWER, SENSOR_CLASS_POWER, inv_idx, mppt_idx);
   }
-  void set_mppt_ac_voltage_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_ac_voltage_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_ac_voltage_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_AC_VOLTAGE, SENSOR_CLASS_VOLTAGE, inv_idx, mppt_idx);
   }
-  void set_mppt_frequency_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_frequency_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_frequency_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_FREQUENCY, SENSOR_CLASS_FREQUENCY, inv_idx, mppt_idx);
   }
-  void set_mppt_power_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_power_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_power_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_POWER, SENSOR_CLASS_POWER, inv_idx, mppt_idx);
   }
-  void set_mppt_today_energy_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_today_energy_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_today_energy_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_TODAY_ENERGY, SENSOR_CLASS_ENERGY, inv_idx, mppt_idx);
   }
-  void set_mppt_total_energy_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_total_energy_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_total_energy_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_TOTAL_ENERGY, SENSOR_CLASS_ENERGY, inv_idx, mppt_idx);
   }
-  void set_mppt_temperature_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) { 
-    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER) 
-      mppt_temperature_sensors_[inv_idx][mppt_idx] = s; 
+  void set_mppt_temperature_sensor(int inv_idx, int mppt_idx, sensor::Sensor *s) {
+    if (inv_idx < MAX_RTU_SOURCES && mppt_idx < MAX_MPPT_PER_INVERTER)
+      add_sensor_binding_(s, SensorField::MPPT_TEMPERATURE, SENSOR_CLASS_TEMPERATURE, inv_idx, mppt_idx);
   }
 
   // --- Aggregate sensors ---
@@ -271,6 +645,7 @@ class SunSpecProxy : public Component {
   void set_victron_connected_sensor(binary_sensor::BinarySensor *s) { victron_connected_sensor_ = s; }
   void set_victron_status_sensor(text_sensor::TextSensor *s) { victron_status_sensor_ = s; }
   void set_power_limit_sensor(sensor::Sensor *s) { power_limit_sensor_ = s; }
+  void set_power_limit_latency_sensor(sensor::Sensor *s) { power_limit_latency_sensor_ = s; }
 
   // --- DTU diagnostic sensors ---
   void set_dtu_serial_sensor(text_sensor::TextSensor *s) { dtu_serial_sensor_ = s; }
@@ -278,57 +653,160 @@ class SunSpecProxy : public Component {
   void set_dtu_poll_fail_sensor(sensor::Sensor *s) { dtu_poll_fail_sensor_ = s; }
   void set_dtu_online_sensor(binary_sensor::BinarySensor *s) { dtu_online_sensor_ = s; }
 
+  // Incremented each time a new inverter block is published to clients
+  uint32_t get_register_generation() const { return register_generation_.load(std::memory_order_acquire); }
+
  protected:
   // TCP server (for Victron)
   void setup_tcp_server_();
   void handle_tcp_clients_();
-  void process_tcp_request_(int client_fd, uint8_t *buf, int len);
-  void send_tcp_response_(int client_fd, uint16_t transaction_id, uint8_t unit_id,
+  void record_service_time_(uint8_t fc, uint32_t us);
+
+  // HTTP /metrics endpoint (Prometheus text format)
+  void setup_metrics_server_();
+  void handle_metrics_clients_();
+  void close_metrics_client_(MetricsClient &c);
+  void render_metrics_(std::string &out);
+  void render_trace_(std::string &out);
+  void start_history_stream_(MetricsClient &c);
+  bool fill_history_chunk_(MetricsClient &c);
+  int format_trace_record_(const TraceRecord &r, char *buf, size_t len) const;
+  void accept_tcp_client_(uint32_t now);
+  void process_tcp_request_(TcpClient &client, const uint8_t *buf, int len);
+  bool flush_tcp_client_(TcpClient &client);
+  void close_tcp_client_(TcpClient &client);
+  void send_tcp_response_(TcpClient &client, uint16_t transaction_id, uint8_t unit_id,
                           uint8_t function_code, const uint8_t *data, uint16_t data_len);
-  void send_tcp_error_(int client_fd, uint16_t transaction_id, uint8_t unit_id,
+  void send_tcp_frame_(TcpClient &client, const uint8_t *hdr, uint16_t hdr_len,
+                       const uint8_t *body, uint16_t body_len);
+  void send_tcp_error_(TcpClient &client, uint16_t transaction_id, uint8_t unit_id,
                        uint8_t function_code, uint8_t error_code);
+  // Exception response for a request to our unit ID (counted and traced)
+  void reject_tcp_request_(TcpClient &client, uint16_t transaction_id, uint8_t unit_id,
+                           uint8_t function_code, uint8_t error_code);
+
+  // Modbus gateway (main loop side)
+  void process_gateway_request_(TcpClient &client, const uint8_t *buf, int len);
+  int find_gateway_range_(DtuLink &l, uint16_t start, uint16_t count, uint32_t now, bool allocate);
+  void send_gateway_response_(TcpClient &client, uint16_t transaction_id, uint8_t unit_id, const GatewayRange &r,
+                              uint16_t start, uint16_t count);
+  void answer_gateway_reads_(uint32_t now);
+  // Modbus gateway (DTU side)
+  void collect_gateway_fetches_(DtuLink &l);
+  bool send_gateway_fetch_(DtuLink &l, uint8_t range);
+  void store_gateway_range_(GatewayRange &r, const uint8_t *data);
+  void fail_gateway_fetches_(DtuLink &l);
 
-  // Modbus TCP client (to DTU-Pro)
-  void setup_dtu_client_();
+  // Modbus TCP client (to DTU-Pro), non-blocking state machine
+  // (one state machine per DtuLink, stepped together by poll_dtu_data_())
   void poll_dtu_data_();
-  bool connect_to_dtu_();
-  void close_dtu_connection_();
-  bool send_modbus_tcp_request_(uint8_t function, uint16_t reg_start, uint16_t reg_count);
-  int read_modbus_tcp_response_(uint8_t *buf, int max_len);
+  void poll_dtu_link_(DtuLink &l, uint32_t now);
+  void schedule_next_poll_(uint32_t now, bool parsed);
+  uint32_t align_poll_delay_(uint32_t delay) const;
+  void note_client_read_(uint16_t start_reg, uint16_t count);
+  bool start_dtu_connect_(DtuLink &l);
+  int check_dtu_connect_(DtuLink &l);
+  void close_dtu_connection_(DtuLink &l);
+  void schedule_dtu_reconnect_(DtuLink &l, uint32_t now);
+  void abandon_dtu_requests_(DtuLink &l);
+  void setup_dtu_address_(DtuLink &l);
+  bool resolve_dtu_host_(DtuLink &l, uint32_t now);
+  void expire_dtu_address_(DtuLink &l);
+  static void dtu_dns_start_(void *arg);
+  static void dtu_dns_found_(const char *, const ip_addr_t *ipaddr, void *arg);
+  bool send_modbus_tcp_request_(DtuLink &l, uint8_t function, uint16_t reg_start, uint16_t reg_count);
+  int read_modbus_tcp_response_(DtuLink &l);
+  void process_dtu_responses_(DtuLink &l);
+  void handle_dtu_response_(DtuLink &l, const uint8_t *resp, int n);
+  void update_dtu_deadline_(DtuLink &l);
+  void build_dtu_read_plan_(DtuLink &l);
+  bool send_dtu_read_chunk_(DtuLink &l, uint8_t chunk);
+  bool store_dtu_chunk_(DtuLink &l, const uint8_t *resp, int n, uint8_t chunk);
+  // Status lane: alarms, link status and limit readback at a slow cadence
+  void build_dtu_status_plan_(DtuLink &l);
+  bool start_dtu_status_read_(DtuLink &l, uint32_t now);
+  void store_dtu_status_(DtuLink &l, uint8_t entry, const uint8_t *resp, int n);
+  // Power readback after a limit write, and the limit-to-effect latency
+  bool start_dtu_readback_(DtuLink &l, uint32_t now);
+  void store_dtu_readback_(DtuLink &l, uint8_t entry, const uint8_t *resp, int n);
+  void finish_dtu_readback_(DtuLink &l, uint32_t now);
+  void check_limit_effect_();
+
+  // Hand-off of poll results from the DTU side to the main loop
+  void publish_dtu_result_();
+  void apply_dtu_result_(const DtuPollResult &result);
+  void consume_dtu_snapshot_();
+#ifdef USE_ESP32
+  bool start_dtu_task_();
+  static void dtu_task_(void *arg);
+  void wait_dtu_io_(uint32_t max_ms);
+#endif
 
   // SunSpec register handling
-  bool read_sunspec_registers_(uint16_t start_reg, uint16_t count, uint16_t *out);
+  const uint8_t *sunspec_wire_slice_(uint16_t start_reg, uint16_t count) const;
   bool write_sunspec_registers_(uint16_t start_reg, uint16_t count, const uint16_t *values);
   void build_static_registers_();
   void aggregate_and_update_registers_();
+  void build_mppt_block_();
 
-  // Forward power limit to all RTU sources
+  // Forward power limit to all RTU sources (posted to limit_request_, queued
+  // and sent by the DTU state machine)
   void forward_power_limit_(uint16_t pct_raw, bool enabled);
+  void take_power_limit_request_();
+  void queue_power_limit_(DtuLink &l, bool per_port);
+  void finish_dtu_commands_(DtuLink &l);
   
-  // Modbus TCP FC 0x05 helper (Write Single Coil with raw value)
-  bool send_dtu_fc05_(uint16_t address, uint16_t value);
+  // Modbus TCP FC 0x05 helpers (Write Single Coil with raw value)
+  bool send_dtu_fc05_(DtuLink &l, uint16_t address, uint16_t value);
+  bool check_dtu_fc05_response_(const uint8_t *resp, int n, const DtuCommand &cmd);
 
   // Data parsing and mapping
-  void parse_dtu_registers_(const uint16_t *regs, int reg_count);
-  void map_mppt_to_inverters_();
-  void aggregate_inverter_data_(int inv_idx);
+  void parse_dtu_registers_(DtuLink &l);
+  void build_sn_index_();
+  int find_source_by_sn_(uint64_t key) const;
+  void map_mppt_to_inverters_(DtuLink &l);
+  void aggregate_dtu_inverters_(DtuLink &l);
+  void aggregate_inverter_data_(int inv_idx, uint32_t now);
+  void expire_stale_sources_();
   
-  // Sensor publishing
-  void publish_source_sensors_(int idx);
-  void publish_mppt_sensors_(int inv_idx, int mppt_idx);
-  void publish_aggregate_sensors_();
-  void publish_tcp_sensors_();
+  // Sensor publishing. Numeric sensors go through the binding list: each
+  // pass evaluates a few bindings per loop() and only publishes values that
+  // moved past their class deadband, or have been silent for the heartbeat.
+  void build_sensor_bindings_();
+  void add_sensor_binding_(sensor::Sensor *s, SensorField field, uint8_t cls, uint8_t inv = 0, uint8_t mppt = 0);
+  bool sensor_value_(const SensorBinding &b, float *out) const;
+  void run_sensor_publisher_(uint32_t now);
+  void publish_status_sensors_();
   void update_source_status_(int idx);
   uint32_t last_sensor_publish_ms_{0};
   static const uint32_t SENSOR_PUBLISH_INTERVAL_MS = 5000;
 
+  std::vector<SensorBinding> sensor_bindings_;
+  size_t sensor_pass_pos_{0};            // Next binding of the current pass
+  uint32_t sensor_pass_gen_{0};          // Register generation the pass started at
+  uint32_t sensor_pass_start_ms_{0};
+  uint8_t sensor_publish_slice_{8};      // Bindings evaluated per loop()
+  uint32_t sensor_heartbeat_ms_{60000};  // Republish unchanged values this often (0 = never)
+  // Defaults follow the displayed precision of each class
+  SensorDeadband sensor_deadbands_[SENSOR_CLASS_COUNT]{
+      {1.0f, 0.0f},    // Power (W)
+      {0.1f, 0.0f},    // Voltage (V)
+      {0.01f, 0.0f},   // Current (A)
+      {0.0f, 0.0f},    // Energy: any change
+      {0.01f, 0.0f},   // Frequency (Hz)
+      {0.1f, 0.0f},    // Temperature (°C)
+      {0.0f, 0.0f},    // Diagnostics: any change
+  };
+
   // Config
-  std::string dtu_host_;       // DTU-Pro IP/hostname
-  uint16_t dtu_port_{502};     // DTU-Pro Modbus TCP port
-  uint8_t dtu_address_{101};   // DTU Modbus unit ID
   uint16_t tcp_port_{502};     // SunSpec server port (for Victron)
   uint32_t poll_interval_ms_{5000};
   uint32_t tcp_timeout_ms_{3000};
+  // Stale-data policy (see expire_stale_sources_()): data older than the
+  // limit leaves the aggregate and its source reads offline. The limit is
+  // stale_timeout_ms_, but never less than two rounds of the current mode.
+  uint32_t stale_timeout_ms_{30000};
+  std::atomic<uint32_t> stale_limit_ms_{30000};
 
   // Aggregated device config
   AggregatedConfig agg_config_{};
@@ -336,60 +814,188 @@ class SunSpecProxy : public Component {
   // RTU sources
   int num_sources_{0};
   RtuSource sources_[MAX_RTU_SOURCES];
+  RtuSource *dtu_src_{sources_};       // Working set of the DTU side (a private copy in task mode)
 
   // TCP server state
   int server_fd_{-1};
-  int client_fds_[MAX_TCP_CLIENTS];
+  std::vector<TcpClient> clients_;     // Sized to max_tcp_clients_ at setup
+  uint8_t max_tcp_clients_{4};
+  uint32_t tcp_idle_timeout_ms_{120000};  // 0 = never evict idle clients
+  static const uint32_t TCP_LRU_MIN_IDLE_MS = 10000;  // Min quiet time before LRU replacement
   uint32_t tcp_request_count_{0};
   uint32_t tcp_error_count_{0};
+  uint32_t foreign_unit_count_{0};  // Requests for other unit IDs (discovery probes)
   uint32_t last_tcp_activity_ms_{0};
+  TrafficCounters tcp_traffic_;
+
+  // Modbus gateway (0 = off)
+  uint8_t gateway_unit_id_{0};
+  uint32_t gateway_max_age_ms_{10000};
+  GatewayPending gateway_pending_[GATEWAY_PENDING];
+  std::atomic<bool> gateway_wanted_{false};  // A miss pulls the next round forward
+  uint32_t gateway_hits_{0};
+  uint32_t gateway_misses_{0};
+  uint32_t gateway_failures_{0};             // Fetch failed or timed out, or no room to wait
 
-  // DTU client state
-  int dtu_fd_{-1};             // DTU connection socket
+  // Telemetry, exported on metrics_port_ (0 = off). DTU side metrics live
+  // in DtuLink.
+  uint16_t metrics_port_{0};
+  int metrics_fd_{-1};
+  static const int MAX_METRICS_CLIENTS = 2;
+  static const uint32_t METRICS_TIMEOUT_MS = 5000;
+  static const int HISTORY_CHUNK_BLOCKS = 8;  // Per HTTP chunk of a /history stream
+  MetricsClient metrics_clients_[MAX_METRICS_CLIENTS];
+  LatencyHistogram loop_time_;
+  LatencyHistogram service_time_[3];   // FC03, FC06, FC16
+  LatencyHistogram limit_apply_time_;  // Victron write → last FC05 acknowledged
+  LatencyHistogram limit_effect_time_; // Victron write → aggregate power within the limit
+  TraceRing<SUNSPEC_PROXY_TRACE_RECORDS> trace_;  // Poll and request trace (dump_trace, /trace)
+
+  // DTU links (non-copyable: they hold atomics, so a fixed table)
+  DtuLink dtu_links_[MAX_DTU_LINKS];
+  uint8_t num_dtus_{0};
+  uint8_t dtu_pipeline_depth_{2};      // Max requests in flight per link
   uint32_t last_poll_time_{0};
-  uint32_t last_dtu_connect_attempt_{0};
-  uint16_t modbus_transaction_id_{1};
-  bool dtu_connected_{false};
-  
-  // Raw register buffer from DTU (200 registers = 8 channels × 25)
-  uint16_t dtu_regs_[HM_TOTAL_REGS];
-  bool dtu_data_valid_{false};
+  bool dtu_round_active_{false};       // Links still polling for this round
+  bool dtu_round_parsed_{false};       // At least one link delivered data this round
+  uint32_t dtu_round_ms_{0};           // Duration of the last completed round
+
+  // Adaptive poll scheduling. The next round starts poll_delay_ms_ after
+  // the last one started; the delay is recomputed whenever a round ends.
+  uint32_t poll_delay_ms_{5000};
+  uint32_t poll_idle_interval_ms_{60000};  // 0 = never back off
+  uint32_t poll_fast_interval_ms_{1000};
+  float poll_fast_power_step_{0.05f};      // Power change per round (× rated) that triggers fast mode
+  bool poll_align_{true};                  // Land fresh data just before the GX reads
+  PollMode poll_mode_{PollMode::NORMAL};
+  uint8_t poll_idle_rounds_{0};            // Consecutive rounds without production
+  uint32_t poll_fast_until_ms_{0};
+  int64_t poll_last_power_dw_{-1};     // Total power of the last parsed round (-1 = none)
+  static const uint8_t POLL_IDLE_ROUNDS = 3;
+  static const uint32_t POLL_FAST_HOLD_MS = 30000;
+  static const uint32_t POLL_ALIGN_MARGIN_MS = 100;
+  static const uint32_t CLIENT_READ_BURST_MS = 500;   // Reads closer than this belong to one GX cycle
+  uint32_t poll_due_ms_{0};                // When the next round comes due (DTU side)
+  uint32_t status_interval_ms_{60000};     // Status lane pass every (0 = off)
+
+  // Client read cadence, written by the main loop. Only reads that cover
+  // the inverter block count; the period is a smoothed cycle length.
+  std::atomic<uint32_t> client_read_ms_{0};
+  std::atomic<uint32_t> client_read_period_ms_{0};
+  static const uint32_t DTU_CONNECT_TIMEOUT_MS = 2000;
+  static const int DTU_KEEPALIVE_IDLE_S = 30;      // Probe after this much silence
+  static const int DTU_KEEPALIVE_INTERVAL_S = 5;
+  static const int DTU_KEEPALIVE_COUNT = 3;        // Unanswered probes before drop
+  static const uint32_t DTU_DNS_TTL_MS = 300000;
+  static const uint32_t DTU_BACKOFF_MIN_MS = 1000;   // First retry after a failure
+  static const uint32_t DTU_BACKOFF_MAX_MS = 60000;
+  static const uint8_t DTU_SILENT_TIMEOUTS = 2;      // Then the connection counts as half-open
+
+  // Power limit being sent (queued on every link with inverters)
+  uint8_t dtu_cmd_links_pending_{0};   // Links whose writes haven't finished
+  bool dtu_cmd_failed_{false};
+  uint16_t dtu_cmd_limit_{100};        // Limit the queue was built for (for the per-port fallback)
+  bool dtu_cmd_enabled_{false};
+  uint32_t dtu_cmd_start_ms_{0};       // When Victron wrote the limit being sent
+  // Limit-to-effect tracking (see check_limit_effect_()), DTU side
+  bool limit_effect_pending_{false};
+  uint32_t limit_effect_target_dw_{0}; // Aggregate power at which the limit counts as in effect
+  std::atomic<uint32_t> limit_effect_timeouts_{0};
+  static const uint32_t LIMIT_EFFECT_MARGIN_PCT = 2;    // Of rated power, above the limit
+  static const uint32_t LIMIT_EFFECT_TIMEOUT_MS = 60000;
+  static const uint32_t LIMIT_READBACK_INTERVAL_MS = 500;
+  bool limit_broadcast_{true};         // Use the all-inverter registers
+
+  // Latest power limit from Victron, picked up by the DTU side in IDLE.
+  // Bit 31 = pending, bit 16 = enabled, bits 0-15 = Hoymiles limit %.
+  // A newer request simply overwrites an older one that wasn't taken yet.
+  std::atomic<uint32_t> limit_request_{0};
+  static const uint32_t LIMIT_REQ_PENDING = 1UL << 31;
+  static const uint32_t LIMIT_REQ_ENABLED = 1UL << 16;
+  std::atomic<uint32_t> limit_request_ms_{0};
+  std::atomic<uint32_t> limit_latency_ms_{0};  // Victron write → last FC05 acknowledged
+  uint32_t limit_coalesced_count_{0};          // Requests replaced before being sent
+  std::atomic<bool> limit_active_{false};      // Last Victron limit restricts output
+
+  // Warm start: the last register state, restored at boot (0 = off)
+  void restore_warm_start_();
+  void save_warm_start_(uint32_t now, bool force);
+  uint32_t warm_start_interval_ms_{600000};    // Min time between flash writes
+  ESPPreferenceObject warm_start_pref_;
+  WarmStart warm_start_saved_{};               // Last written, to skip unchanged saves
+  uint32_t warm_start_saved_ms_{0};
+  bool warm_start_stale_{false};               // Serving the restored image, no DTU data yet
+  uint64_t energy_floor_wh_{0};                // DTU side: Model 103 WH is never served below this
+
+  // Per-MPPT history, fed from parse_dtu_registers_(); one series per
+  // Model 160 module, series_base is a source's first one
+  void setup_history_();
+  HistoryStore::TierConfig history_config_[HISTORY_TIERS]{};  // interval 0 = off
+  HistoryStore history_;
+  uint16_t history_series_base_[MAX_RTU_SOURCES]{};
+
+  // DTU polling task (ESP32 only; -1 = poll inline from loop())
+  int8_t dtu_task_core_{-1};
+  bool dtu_task_running_{false};
+  TripleBuffer<DtuSnapshot> *dtu_snapshots_{nullptr};
+  static const uint32_t DTU_TASK_STACK_SIZE = 4096;
+  static const uint32_t DTU_TASK_WAIT_MS = 10;
+
+
+  // Serial number → source lookup (across all DTUs)
+  SnIndexEntry sn_index_[MAX_RTU_SOURCES];
+  uint8_t sn_index_count_{0};
+  uint8_t channel_mppt_count_[MAX_RTU_SOURCES]{};  // MPPT slots in use per source
+  // Sources with a re-decoded channel since the last aggregation (bit per
+  // source); unchanged inverters are neither re-aggregated nor re-encoded
+  SourceMask dirty_sources_;
 
   // Single register map for the aggregated device
   static const uint16_t OFF_SUNS = 0;
-  static const uint16_t OFF_MODEL1 = 2;
-  static const uint16_t OFF_INV = 70;
-  static const uint16_t OFF_M120 = 122;
-  static const uint16_t OFF_M123 = 150;
-  static const uint16_t OFF_END = 176;
-  static const uint16_t TOTAL_REGS = 178;
+  static const uint16_t OFF_MODEL1 = SunSpecMap::header<SunSpecCommon>();
+  static const uint16_t OFF_INV = SunSpecMap::header<SunSpecInverter>();
+  static const uint16_t OFF_M120 = SunSpecMap::header<SunSpecNameplate>();
+  static const uint16_t OFF_M123 = SunSpecMap::header<SunSpecControls>();
+  static const uint16_t OFF_M160 = SunSpecMap::header<SunSpecMpptModel>();
+  static const uint16_t OFF_END = SunSpecMap::END;
+  static const uint16_t TOTAL_REGS = SunSpecMap::TOTAL;
+
+  // Register map for the aggregated device. regs[] is host order; wire[] is
+  // its big-endian shadow, kept in sync by the code that writes the map, so
+  // FC03 responses are sent straight from it without copying.
+  struct RegisterImage {
+    uint16_t regs[TOTAL_REGS];
+    uint8_t wire[TOTAL_REGS * 2];
+  };
 
-  uint16_t register_map_[TOTAL_REGS];
+  // Double-buffered: clients read the front image while the aggregator
+  // builds the next model 101/103 and 160 blocks in the back image, which are
+  // then published with a single index swap. register_generation_ increments on
+  // every publish and doubles as a cheap "data changed" signal.
+  RegisterImage images_[2];
+  std::atomic<uint8_t> active_image_{0};
+  std::atomic<uint32_t> register_generation_{0};
+
+  RegisterImage &front_image_() { return images_[active_image_.load(std::memory_order_acquire)]; }
+  const RegisterImage &front_image_() const { return images_[active_image_.load(std::memory_order_acquire)]; }
+  static void sync_wire_range_(RegisterImage &img, uint16_t off, uint16_t count);
+  RegisterImage &begin_register_update_();
+  void commit_register_update_();
+
+  // Poll result staging on the DTU side. inv_block and mppt_block start as
+  // the static blocks, so registers the aggregator never touches keep their
+  // value.
+  DtuPollResult dtu_result_{};
 
   // Aggregated decoded values (for sensors)
-  float agg_power_w_{0};
-  float agg_current_a_{0};
-  float agg_voltage_v_{0};
-  float agg_frequency_hz_{0};
-  float agg_energy_kwh_{0};
+  uint32_t agg_power_dw_{0};
+  uint32_t agg_current_ca_{0};
+  uint16_t agg_voltage_dv_{0};
+  uint16_t agg_frequency_chz_{0};
+  uint64_t agg_energy_wh_{0};
 
   // --- Sensor pointers ---
-  // Per-source
-  sensor::Sensor *src_power_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_voltage_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_current_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_energy_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_today_energy_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_frequency_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_temperature_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_pv_voltage_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_pv_current_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_pv_power_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_alarm_code_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_alarm_count_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_link_status_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_poll_ok_sensors_[MAX_RTU_SOURCES]{};
-  sensor::Sensor *src_poll_fail_sensors_[MAX_RTU_SOURCES]{};
+  // Per-source (numeric ones live in sensor_bindings_)
   binary_sensor::BinarySensor *src_online_sensors_[MAX_RTU_SOURCES]{};
   text_sensor::TextSensor *src_status_sensors_[MAX_RTU_SOURCES]{};
 
@@ -407,26 +1013,16 @@ class SunSpecProxy : public Component {
   binary_sensor::BinarySensor *victron_connected_sensor_{nullptr};
   text_sensor::TextSensor *victron_status_sensor_{nullptr};
   sensor::Sensor *power_limit_sensor_{nullptr};
+  sensor::Sensor *power_limit_latency_sensor_{nullptr};
 
   // DTU diagnostics
-  uint32_t dtu_poll_count_{0};           // Successful DTU polls
-  uint32_t dtu_poll_fail_count_{0};      // Failed DTU polls
-  uint32_t last_dtu_poll_ok_ms_{0};      // Timestamp of last successful DTU poll
+  std::atomic<uint32_t> dtu_poll_count_{0};       // Successful DTU polls
+  std::atomic<uint32_t> dtu_poll_fail_count_{0};  // Failed DTU polls
+  std::atomic<uint32_t> last_dtu_poll_ok_ms_{0};  // Timestamp of last successful DTU poll
   text_sensor::TextSensor *dtu_serial_sensor_{nullptr};
   sensor::Sensor *dtu_poll_ok_sensor_{nullptr};
   sensor::Sensor *dtu_poll_fail_sensor_{nullptr};
   binary_sensor::BinarySensor *dtu_online_sensor_{nullptr};
-
-  // Per-MPPT sensor arrays [inverter_idx][mppt_idx]
-  sensor::Sensor *mppt_dc_voltage_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_dc_current_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_dc_power_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_ac_voltage_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_frequency_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_power_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_today_energy_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_total_energy_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
-  sensor::Sensor *mppt_temperature_sensors_[MAX_RTU_SOURCES][MAX_MPPT_PER_INVERTER]{};
 };
 
 }  // namespace sunspec_proxy
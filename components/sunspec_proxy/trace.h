@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * Binary trace ring for the per-poll and per-request hot paths
+ *
+ * Recording a trace event stores a 16-byte record: millis(), an event id and
+ * four integers in the units the code already works in (0.1 W, Wh, ...).
+ * Nothing is formatted until someone asks: the ring is decoded to text by the
+ * sunspec_proxy.dump_trace action and by GET /trace on the metrics port, so
+ * tracing can stay on in production without the log traffic of one
+ * formatted line per channel and poll.
+ *
+ * Writers (the main loop and the DTU task) claim slots with one atomic add,
+ * so they never block each other. A dump racing a writer can show the one
+ * record being written half-updated; that is the price of not locking.
+ */
+
+#include "esphome/core/hal.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+enum class TraceEvent : uint8_t {
+  DTU_READ = 1,  // a = DTU, b = registers, c = poll count
+  DTU_PARSE,     // a = DTU, b = channels changed (decoded), c = channels mapped
+  CHANNEL,       // a = inverter, b = MPPT << 12 | channel, c = DC 0.1 V << 16 | 0.1 W, d = total Wh
+  INVERTER,      // a = inverter, b = MPPTs | 0x8000 if producing, c = 0.1 W, d = total Wh
+  AGGREGATE,     // a = valid sources, b = 1 if producing, c = 0.1 W, d = total Wh
+  TCP_READ,      // a = client socket, b = start register, c = count, d = transaction id
+  TCP_WRITE,     // a = client socket, b = start register, c = count, d = transaction id
+  TCP_REJECT,    // a = client socket, b = unit << 8 | function code, c = exception code, d = transaction id
+  DTU_STATUS,    // a = inverter, b = DtuStatusKind, port record: c = alarm code << 16 | operating status,
+                 // d = alarm count << 8 | link status; limit readback: c = ON/OFF, d = limit %
+};
+
+struct TraceRecord {
+  uint32_t ms;
+  uint8_t event;  // TraceEvent, 0 = never written
+  uint8_t a;
+  uint16_t b;
+  uint32_t c;
+  uint32_t d;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord layout");
+
+#ifndef SUNSPEC_PROXY_TRACE_RECORDS
+#define SUNSPEC_PROXY_TRACE_RECORDS 256
+#endif
+
+template<uint32_t N> class TraceRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "trace ring size must be a power of two");
+
+ public:
+  static constexpr uint32_t SIZE = N;
+
+  void record(TraceEvent e, uint8_t a, uint16_t b = 0, uint32_t c = 0, uint32_t d = 0) {
+    record_at(millis(), e, a, b, c, d);
+  }
+  // For loops that record many events at once: take the time once
+  void record_at(uint32_t ms, TraceEvent e, uint8_t a, uint16_t b = 0, uint32_t c = 0, uint32_t d = 0) {
+    uint32_t seq = head_.fetch_add(1, std::memory_order_relaxed);
+    records_[seq & (N - 1)] = {ms, (uint8_t) e, a, b, c, d};
+  }
+
+  // Sequence number of the next record; the ring holds [next - N, next)
+  uint32_t next() const { return head_.load(std::memory_order_acquire); }
+  const TraceRecord &at(uint32_t seq) const { return records_[seq & (N - 1)]; }
+
+ protected:
+  std::atomic<uint32_t> head_{0};
+  TraceRecord records_[N]{};
+};
+
+}  // namespace sunspec_proxy
+}  // namespace esphome
@@ -0,0 +1,45 @@
+#pragma once
+
+/**
+ * Lock-free single-producer/single-consumer triple buffer
+ *
+ * The producer always owns one slot and the consumer another; the third sits
+ * in the middle and is swapped atomically. Neither side ever waits for the
+ * other, the producer can publish as often as it likes, and the consumer
+ * always gets the most recently published slot (older ones are skipped).
+ * Because the producer never touches the consumer's slot, the consumer can
+ * read it in place for as long as it wants.
+ */
+
+#include <atomic>
+#include <cstdint>
+
+namespace esphome {
+namespace sunspec_proxy {
+
+template<typename T> class TripleBuffer {
+ public:
+  // Producer side: fill write_slot() completely, then publish() it
+  T &write_slot() { return slots_[back_]; }
+  void publish() { back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+  // Consumer side: the newest published slot, or nullptr if nothing was
+  // published since the last take(). Valid until the next take().
+  const T *take() {
+    if (!(middle_.load(std::memory_order_acquire) & FRESH)) return nullptr;
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+    return &slots_[front_];
+  }
+
+ protected:
+  static const uint8_t INDEX = 0x03;
+  static const uint8_t FRESH = 0x04;
+
+  T slots_[3];
+  uint8_t back_{0};                   // Producer-owned
+  uint8_t front_{1};                  // Consumer-owned
+  std::atomic<uint8_t> middle_{2};    // Index of the shared slot + FRESH flag
+};
+
+}  // namespace sunspec_proxy
+}  // namespace esphome